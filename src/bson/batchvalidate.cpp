@@ -0,0 +1,133 @@
+// batchvalidate.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include "batchvalidate.h"
+#include "endian.h"
+
+namespace _bson {
+
+    namespace {
+
+        enum { SerialCutoff = 1024 * 1024 };    // below this, bytes, one thread without a pool
+
+        /** finds where each document starts.  A size prefix that doesn't fit ends the
+            search; the rest of the sequence is then the last "document".
+        */
+        void frame(const char *data, size_t len, std::vector<size_t>& docs) {
+            size_t pos = 0;
+            while( pos < len ) {
+                docs.push_back( pos );
+                size_t left = len - pos;
+                if ( left < 5 )
+                    break;
+                int n = readInt( data + pos );
+                if ( n < 5 || (size_t) n > left )
+                    break;
+                pos += n;
+            }
+        }
+
+        /** what one run found */
+        struct RunResult {
+            std::vector<batchvalidation::Failure> failures;
+            // words of the bitmap the run shares with its neighbours: word, bits
+            std::vector< std::pair<size_t, unsigned long long> > edges;
+        };
+
+        /** validates documents [b, e).  Words of r.good wholly in the run are written
+            directly; the one or two at its ends, which may have bits of other runs, go in
+            out.edges, to be or'ed in when every run is done.
+        */
+        void validateRun(const char *data, size_t len, BSONValidateLevel level, size_t b,
+                         size_t e, batchvalidation& r, RunResult& out) {
+            unsigned long long bits = 0;
+            for( size_t i = b; i < e; i++ ) {
+                size_t start = r.docs[i];
+                size_t end = i + 1 < r.docs.size() ? r.docs[i + 1] : len;
+                size_t at;
+                if ( checkBSON( data + start, end - start, level, &at ) == 0 ) {
+                    bits |= 1ULL << ( i % 64 );
+                }
+                else {
+                    batchvalidation::Failure f = { i, start + at };
+                    out.failures.push_back( f );
+                }
+                if ( i % 64 == 63 || i + 1 == e ) {
+                    size_t w = i / 64;
+                    if ( w * 64 >= b && ( w + 1 ) * 64 <= e )
+                        r.good[w] = bits;
+                    else
+                        out.edges.push_back( std::make_pair( w, bits ) );
+                    bits = 0;
+                }
+            }
+        }
+
+        void merge(const RunResult& x, batchvalidation& r) {
+            r.failures.insert( r.failures.end(), x.failures.begin(), x.failures.end() );
+            for( size_t k = 0; k < x.edges.size(); k++ )
+                r.good[x.edges[k].first] |= x.edges[k].second;
+        }
+
+    }
+
+    batchvalidation validateBatch(const char *data, size_t len, BSONValidateLevel level,
+                                  workpool* pool) {
+        batchvalidation r;
+        frame( data, len, r.docs );
+        size_t n = r.docs.size();
+        r.good.resize( ( n + 63 ) / 64 );
+
+        if ( pool == 0 && len < SerialCutoff ) {
+            RunResult x;
+            validateRun( data, len, level, 0, n, r, x );
+            merge( x, r );
+            return r;
+        }
+
+        workpool *p = pool;
+        std::unique_ptr<workpool> made;
+        if ( p == 0 ) {
+            made.reset( new workpool() );
+            p = made.get();
+        }
+
+        // runs of about len / nRuns bytes, cut at the document nearest below each share
+        size_t nRuns = p->size() * 4;
+        std::vector<size_t> bounds( 1, 0 );
+        for( size_t k = 1; k < nRuns; k++ ) {
+            size_t target = (size_t) ( (double) len * k / nRuns );
+            size_t i = std::lower_bound( r.docs.begin(), r.docs.end(), target ) - r.docs.begin();
+            if ( i > bounds.back() )
+                bounds.push_back( i );
+        }
+        if ( n > bounds.back() )
+            bounds.push_back( n );
+
+        size_t runs = bounds.size() - 1;
+        std::vector<RunResult> results( runs );
+        p->parallelFor( runs, 1, [&](size_t k) {
+            validateRun( data, len, level, bounds[k], bounds[k + 1], r, results[k] );
+        } );
+
+        for( size_t k = 0; k < runs; k++ )
+            merge( results[k], r );
+        return r;
+    }
+
+}
@@ -0,0 +1,68 @@
+// batchvalidate.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "bson_validate.h"
+#include "workpool.h"
+
+namespace _bson {
+
+    /** what validateBatch() found in a BSON sequence */
+    struct batchvalidation {
+        struct Failure {
+            size_t doc;         // index of the document
+            size_t offset;      // of its first problem, from the start of the sequence
+        };
+
+        /** where each document starts, from the start of the sequence */
+        std::vector<size_t> docs;
+
+        /** bit i % 64 of good[i / 64] is set if document i passed */
+        std::vector<unsigned long long> good;
+
+        /** the documents that didn't, in order */
+        std::vector<Failure> failures;
+
+        size_t size() const { return docs.size(); }
+        bool passed(size_t i) const { return ( good[i / 64] >> ( i % 64 ) ) & 1; }
+        bool allPassed() const { return failures.empty(); }
+    };
+
+    /** validateBSON() on each document of a BSON sequence -- documents back to back, as in a
+        dump file or a batch off the wire -- on several threads.
+
+        The documents are found from their size prefixes first, which reads one int per
+        document; then they are split into runs of about equal bytes, a few per thread, and
+        validated in parallel.  If a size prefix is less than 5 or runs past len, the
+        sequence can't be followed past it: everything from there on is one last document,
+        which fails.  Documents are checked with checkBSON(), so no messages are made and a
+        bad document costs no more than a good one; call validateBSON() on one for its
+        message.
+
+        example:
+          batchvalidation v = validateBatch( buf, len );
+          for( size_t i = 0; i < v.failures.size(); i++ )
+              log() << "document " << v.failures[i].doc << " bad at " << v.failures[i].offset;
+
+        pool: the pool to run on; if null one with a thread per core is made for the call,
+        unless the sequence is small enough to be quicker on the calling thread.
+    */
+    batchvalidation validateBatch(const char *data, size_t len,
+                                  BSONValidateLevel level = ValidateFull, workpool* pool = 0);
+
+}
@@ -70,6 +70,15 @@ namespace _bson {
         return bsonobj(value());
     }
 
+    inline StatusWith<bsonobj> bsonelement::tryObject() const {
+        if ( !isObject() )
+            return StatusWith<bsonobj>( typeMismatch() );
+        int size = readInt( value() );
+        if ( size <= 0 || size > BSONObjMaxInternalSize )
+            return StatusWith<bsonobj>( Status::literal( InvalidBSON, "bad embedded object size" ) );
+        return StatusWith<bsonobj>( bsonobj( value() ) );
+    }
+
     inline bsonobj bsonelement::codeWScopeObject() const {
         verify( type() == CodeWScope );
         int strSizeWNull = *(int *)( value() + 4 );
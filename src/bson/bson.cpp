@@ -11,8 +11,9 @@ namespace _bson {
     namespace iter {
         // values herein represent size of the element of the corresponding type.
         // if >= 0x80, size is in the next dword + the value herein & 0x7f
-        // 0xff = fall back to full code in BSONElement::_size()
-        unsigned char sizeForBsonType[] = {
+        // 0xfe = regex (two cstrings)
+        // 0xff = invalid type
+        unsigned char sizeForBsonType[256] = {
             0, // EOO
             8,  // double
             0x84,  // string
@@ -24,15 +25,15 @@ namespace _bson {
             1,  // bool
             8,  // date
             0,  // null
-            0xff,  // regex,
-            0xff,  // dbref,
-            0xff,  // code,
-            0xff,  // symbol,
-            0xff,  // codewscope,
+            0xfe,  // regex,
+            0x90,  // dbref - string + oid
+            0x84,  // code,
+            0x84,  // symbol,
+            0x80,  // codewscope,
             4,  // int,
             8,  // timestamp,
             8,  // long = 18
-            0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, // 32
+            0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, // 32
             0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
             0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, //64
             0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
@@ -64,10 +65,10 @@ namespace _bson {
                 q(log() << "next will be:" << (p  1) << '\n' << endl;);
             }
             else {
-                if (z == 0xff) {
+                if (z >= 0xfe) {
                     q(log() << "backcompat" << endl;);
                     bsonelement e(elem);
-                    p += e.size();
+                    p = elem + e.size();
                 }
                 else {
                     int len = *((int *)p);
@@ -90,7 +91,7 @@ namespace _bson {
             sz += z;
         }
         else {
-            if (z == 0xff) {
+            if (z >= 0xfe) {
                 q(log() << "backcompat" << endl;);
                 sz += sizeOld() - fieldNameSize() - 1;
             }
@@ -110,7 +111,7 @@ namespace _bson {
         return bsonobjiterator(s, e);
     }
 
-    inline int bsonelement::size() const {
+    int bsonelement::size() const {
         if (totalSize >= 0)
             return totalSize;
         int x = _valuesize();
@@ -400,6 +401,18 @@ namespace _bson {
         }
     }
 
+    int bsonobj::nFields() const {
+        int n = 0;
+        bsonobjiterator i(*this);
+        while ( i.moreWithEOO() ) {
+            bsonelement e = i.next();
+            if ( e.eoo() )
+                break;
+            n++;
+        }
+        return n;
+    }
+
     /* return has eoo() true if no match
     supports "." notation to reach into embedded objects
     */
@@ -453,107 +466,286 @@ namespace _bson {
     int bsonelement::size(int maxLen) const {
         if (totalSize >= 0)
             return totalSize;
+        if (maxLen == -1)
+            return size();
 
-        int remain = maxLen - fieldNameSize() - 1;
+        int fnSize;
+        int x = iter::checkedElementSize(data, maxLen, fnSize);
+        if (x < 0)
+            iter::elementSizeError(x, data);
+        fieldNameSize_ = fnSize;
+        totalSize = x;
+        return totalSize;
+    }
 
-        int x = 0;
-        switch (type()) {
-        case EOO:
-        case Undefined:
-        case jstNULL:
-        case MaxKey:
-        case MinKey:
+    void iter::elementSizeError(int err, const char *p) {
+        switch (err) {
+        case InvalidFieldName:
+            msgasserted(10333, elementSizeErrorString(err));
             break;
-        case _bson::Bool:
-            x = 1;
+        case BadElementSize:
+            msgasserted(16446, elementSizeErrorString(err));
             break;
-        case NumberInt:
-            x = 4;
-            break;
-        case Timestamp:
-        case _bson::Date:
-        case NumberDouble:
-        case NumberLong:
-            x = 8;
-            break;
-        case jstOID:
-            x = 12;
-            break;
-        case Symbol:
-        case Code:
-        case _bson::String:
-            massert(10313, "Insufficient bytes to calculate element size", maxLen == -1 || remain > 3);
-            x = valuestrsize() + 4;
-            break;
-        case CodeWScope:
-            massert(10314, "Insufficient bytes to calculate element size", maxLen == -1 || remain > 3);
-            x = objsize();
+        case BadElementType: {
+            StringBuilder ss;
+            ss << elementSizeErrorString(err) << ' ' << (int)*p;
+            msgasserted(13655, ss.str());
             break;
+        }
+        default:
+            msgasserted(10313, elementSizeErrorString(err));
+        }
+    }
 
-        case DBRef:
-            massert(10315, "Insufficient bytes to calculate element size", maxLen == -1 || remain > 3);
-            x = valuestrsize() + 4 + 12;
-            break;
-        case Object:
-        case _bson::Array:
-            massert(10316, "Insufficient bytes to calculate element size", maxLen == -1 || remain > 3);
-            x = objsize();
-            break;
-        case BinData:
-            massert(10317, "Insufficient bytes to calculate element size", maxLen == -1 || remain > 3);
-            x = valuestrsize() + 4 + 1/*subtype*/;
-            break;
-        case RegEx: {
-            const char *p = value();
-            size_t len1 = (maxLen == -1) ? strlen(p) : (size_t)strnlen(p, remain);
-            //massert( 10318 ,  "Invalid regex string", len1 != -1 ); // ERH - 4/28/10 - don't think this does anything
-            p = p + len1 + 1;
-            size_t len2;
-            if (maxLen == -1)
-                len2 = strlen(p);
-            else {
-                size_t x = remain - len1 - 1;
-                verify(x <= 0x7fffffff);
-                len2 = strnlen(p, (int)x);
+    const char* iter::elementSizeErrorString(int err) {
+        switch (err) {
+        case InvalidFieldName:
+            return "Invalid field name";
+        case BadElementSize:
+            return "bsonelement has bad size";
+        case BadElementType:
+            return "bsonelement: bad type";
+        default:
+            return "Insufficient bytes to calculate element size";
+        }
+    }
+
+    bsonobjbuilder& bsonobjbuilder::appendElementsUnique(bsonobj x) {
+        bsonobjiterator it(x);
+        while (it.more())
+            appendUnique(it.next());
+        return *this;
+    }
+
+    bool bsonobjbuilder::appendUnique(const bsonelement& e) {
+        if ( hasField(e.fieldNameStringData()) )
+            return false;
+        append(e);
+        return true;
+    }
+
+    bsonobjbuilder& bsonobjbuilder::appendOrReplace(const bsonelement& e) {
+        verify(!e.eoo());
+        int at = findField(e.fieldNameStringData());
+        if ( at == 0 )
+            return append(e);
+
+        int oldSize = bsonelement(_b.buf() + at).size();
+        int newSize = e.size();
+        int delta = newSize - oldSize;
+        int len = _b.len();
+        if ( delta > 0 )
+            _b.grow(delta);
+        char *p = _b.buf() + at;
+        memmove(p + newSize, p + oldSize, len - at - oldSize);
+        memcpy(p, e.rawdata(), newSize);
+        if ( delta < 0 )
+            _b.setlen(len + delta);
+
+        if ( delta ) {
+            for ( size_t i = 0; i < _fields.size(); i++ ) {
+                if ( _fields[i].offset > at )
+                    _fields[i].offset += delta;
             }
-            //massert( 10319 ,  "Invalid regex options string", len2 != -1 ); // ERH - 4/28/10 - don't think this does anything
-            x = (int)(len1 + 1 + len2 + 1);
+            _indexed += delta;
         }
-            break;
-        default: {
-            StringBuilder ss;
-            ss << "bsonelement: bad type " << (int)type();
-            std::string msg = ss.str();
-            massert(13655, msg.c_str(), false);
+        if ( _hashed > at )
+            _hashed = 0;    // hash64() starts over
+        return *this;
+    }
+
+    namespace {
+        /** is the field at p called name? */
+        inline bool fieldNamed(const char *p, const StringData& name) {
+            return strncmp(p + 1, name.rawData(), name.size()) == 0 && p[1 + name.size()] == 0;
         }
+
+        inline unsigned fieldHash(const StringData& name) {
+            return (unsigned) hash64(name.rawData(), name.size());
         }
-        totalSize = x + fieldNameSize() + 1; // BSONType
+    }
 
-        return totalSize;
+    /** adds the fields appended since the last call to _fields */
+    void bsonobjbuilder::indexFields() const {
+        int start = _offset + 4;
+        int end = _b.len() - (_doneCalled ? 1 : 0);
+        if ( _indexed > end || _indexed < start ) {
+            // first time, or shrunk under us (asTempObj(), a reused buffer): start over
+            _fields.assign(16, IndexedField());
+            _nIndexed = 0;
+            _indexed = start;
+        }
+        while ( _indexed < end ) {
+            bsonelement e(_b.buf() + _indexed);
+            StringData name = e.fieldNameStringData();
+            unsigned h = fieldHash(name);
+            size_t mask = _fields.size() - 1;
+            size_t i = h & mask;
+            for ( ; _fields[i].offset; i = (i + 1) & mask ) {
+                if ( _fields[i].hash == h && fieldNamed(_b.buf() + _fields[i].offset, name) )
+                    break;
+            }
+            // a second field of the same name isn't added: the first is the one found,
+            // as with bsonobj::getField()
+            if ( _fields[i].offset == 0 ) {
+                _fields[i].hash = h;
+                _fields[i].offset = _indexed;
+                if ( ++_nIndexed * 2 > (int) _fields.size() ) {
+                    std::vector<IndexedField> old;
+                    old.swap(_fields);
+                    _fields.assign(old.size() * 2, IndexedField());
+                    mask = _fields.size() - 1;
+                    for ( size_t k = 0; k < old.size(); k++ ) {
+                        if ( old[k].offset == 0 )
+                            continue;
+                        size_t j = old[k].hash & mask;
+                        while ( _fields[j].offset )
+                            j = (j + 1) & mask;
+                        _fields[j] = old[k];
+                    }
+                }
+            }
+            _indexed += e.size();
+        }
     }
 
-    bsonobjbuilder& bsonobjbuilder::appendElementsUnique(bsonobj x) {
-        std::set<std::string> have;
-        {
-            bsonobjiterator i = iterator();
-            while (i.more())
-                have.insert(i.next().fieldName());
+    /** @return the offset in _b of the field called name, 0 if none */
+    int bsonobjbuilder::findField(const StringData& name) const {
+        indexFields();
+        unsigned h = fieldHash(name);
+        size_t mask = _fields.size() - 1;
+        for ( size_t i = h & mask; _fields[i].offset; i = (i + 1) & mask ) {
+            if ( _fields[i].hash == h && fieldNamed(_b.buf() + _fields[i].offset, name) )
+                return _fields[i].offset;
         }
+        return 0;
+    }
 
-        bsonobjiterator it(x);
-        while (it.more()) {
-            bsonelement e = it.next();
-            if (have.count(e.fieldName()))
-                continue;
-            append(e);
+    bool bsonobjbuilder::hasField(const StringData& name) const {
+        return findField(name) != 0;
+    }
+
+    int bsonobj::woCompare(const bsonobj& r, const Ordering &o, bool considerFieldName) const {
+        if ( isEmpty() )
+            return r.isEmpty() ? 0 : -1;
+        if ( r.isEmpty() )
+            return 1;
+
+        bsonobjiterator i(*this);
+        bsonobjiterator j(r);
+        unsigned mask = 1;
+        while ( 1 ) {
+            // so far, equal...
+
+            bsonelement l = i.next();
+            bsonelement r = j.next();
+            if ( l.eoo() )
+                return r.eoo() ? 0 : -1;
+            if ( r.eoo() )
+                return 1;
+
+            int x = l.woCompare( r, considerFieldName );
+            if( o.descending(mask) )
+                x = -x;
+            if ( x != 0 )
+                return x;
+            mask <<= 1;
         }
-        return *this;
+        return -1;
+    }
+
+    /* well ordered compare */
+    int bsonobj::woCompare(const bsonobj &r, const bsonobj &idxKey,
+                           bool considerFieldName) const {
+        if ( isEmpty() )
+            return r.isEmpty() ? 0 : -1;
+        if ( r.isEmpty() )
+            return 1;
+
+        bool ordered = !idxKey.isEmpty();
+
+        bsonobjiterator i(*this);
+        bsonobjiterator j(r);
+        bsonobjiterator k(idxKey);
+        while ( 1 ) {
+            // so far, equal...
+
+            bsonelement l = i.next();
+            bsonelement r = j.next();
+            bsonelement o;
+            if ( ordered ) {
+                o = k.next();
+                // fields past the end of the pattern are ascending
+                if ( o.eoo() )
+                    ordered = false;
+            }
+            if ( l.eoo() )
+                return r.eoo() ? 0 : -1;
+            if ( r.eoo() )
+                return 1;
+
+            int x = l.woCompare( r, considerFieldName );
+            if ( ordered && o.number() < 0 )
+                x = -x;
+            if ( x != 0 )
+                return x;
+        }
+        return -1;
+    }
+
+    /* well ordered compare */
+    int bsonobj::woSortOrder(const bsonobj& other, const bsonobj& sortKey , bool useDotted ) const {
+        if ( isEmpty() )
+            return other.isEmpty() ? 0 : -1;
+        if ( other.isEmpty() )
+            return 1;
+
+        uassert( 10060 ,  "woSortOrder needs a non-empty sortKey" , ! sortKey.isEmpty() );
+
+        // { "" : null } -- missing fields sort as null
+        static const char staticNull[] = { 7, 0, 0, 0, jstNULL, 0, 0 };
+
+        bsonobjiterator i(sortKey);
+        while ( 1 ) {
+            bsonelement f = i.next();
+            if ( f.eoo() )
+                return 0;
+
+            bsonelement l = useDotted ? getFieldDotted( f.fieldName() ) : getField( f.fieldName() );
+            if ( l.eoo() )
+                l = bsonobj( staticNull ).firstElement();
+            bsonelement r = useDotted ? other.getFieldDotted( f.fieldName() ) : other.getField( f.fieldName() );
+            if ( r.eoo() )
+                r = bsonobj( staticNull ).firstElement();
+
+            int x = l.woCompare( r, false );
+            if ( f.number() < 0 )
+                x = -x;
+            if ( x != 0 )
+                return x;
+        }
+        return -1;
+    }
+
+    Ordering Ordering::make(const bsonobj& obj) {
+        unsigned b = 0;
+        bsonobjiterator k(obj);
+        unsigned n = 0;
+        while( 1 ) {
+            bsonelement e = k.next();
+            if( e.eoo() )
+                break;
+            uassert( 13103, "too many compound keys", n <= 31 );
+            if( e.number() < 0 )
+                b |= (1 << n);
+            n++;
+        }
+        return Ordering(b);
     }
 
     /* must be same type when called, unless both sides are #s
-    this large function is in header to facilitate inline-only use of bson
     */
-    inline int compareElementValues(const bsonelement& l, const bsonelement& r) {
+    int compareElementValues(const bsonelement& l, const bsonelement& r) {
         int f;
 
         switch (l.type()) {
@@ -666,4 +858,193 @@ namespace _bson {
         return -1;
     }
 
+    namespace {
+
+        /* valueHash() support.  Whatever compareElementValues() treats as equal must hash
+           the same, so keep the two in step. */
+
+        /** one multiply per word; the avalanche at the end of hashObject() spreads it */
+        inline unsigned long long mix(unsigned long long h, unsigned long long v) {
+            h = ( h ^ v ) * hashdetail::P1;
+            return hashdetail::rotl( h, 31 );
+        }
+
+        /** mixes in byte w followed by the null terminated name at p, 8 bytes a word.
+            @return the end of the name
+        */
+        inline const char * mixName(unsigned long long& h, unsigned long long w, const char *p) {
+            int n = 1;
+            for( ; *p; p++ ) {
+                w = ( w << 8 ) | (unsigned char) *p;
+                if ( ++n == 8 ) {
+                    h = mix( h, w );
+                    w = 0;
+                    n = 0;
+                }
+            }
+            h = mix( h, w ^ ( (unsigned long long) n << 56 ) );
+            return p + 1;
+        }
+
+        /** mixes in p[0, len), 8 bytes a word */
+        inline unsigned long long mixBytes(unsigned long long h, const char *p, size_t len) {
+            h = mix( h, len );
+            for( ; len >= 8; p += 8, len -= 8 ) {
+                unsigned long long w;
+                memcpy( &w, p, 8 );
+                h = mix( h, w );
+            }
+            if ( len ) {
+                unsigned long long w = 0;
+                for( size_t i = 0; i < len; i++ )
+                    w = ( w << 8 ) | (unsigned char) p[i];
+                h = mix( h, w );
+            }
+            return h;
+        }
+
+        /** numbers of all types hash as their double value, with one zero and one NaN.
+            Longs past 2^53 that round to the same double collide -- they have to, as each
+            compares equal to that double.
+        */
+        inline unsigned long long numberBits(double d) {
+            if ( d == 0 )
+                d = 0;      // -0.0
+            if ( isNaN( d ) )
+                return 0x7ff8000000000000ULL;
+            unsigned long long x;
+            memcpy( &x, &d, sizeof(x) );
+            return x;
+        }
+
+        inline long long loadLong(const char *p) {
+            long long x;
+            memcpy( &x, p, sizeof(x) );
+            return endian_ll( x );
+        }
+
+        inline unsigned long long hashCString(const char *p) {
+            return hash64( p, strlen( p ) );
+        }
+
+        unsigned long long hashObject(const char *obj, bool considerFieldName);
+
+        /** mixes the element at p into h.  @return the end of the element */
+        const char * hashElement(const char *p, bool considerFieldName, unsigned long long& h) {
+            BSONType t = (BSONType) *p;
+            const char *v;
+            if ( considerFieldName ) {
+                v = mixName( h, (unsigned char) canonicalizeBSONType( t ), p + 1 );
+            }
+            else {
+                h = mix( h, canonicalizeBSONType( t ) );
+                v = p + 1 + strlen( p + 1 ) + 1;
+            }
+
+            unsigned long long x;
+            const char *end;
+            switch ( t ) {
+            case EOO:
+            case Undefined:
+            case jstNULL:
+            case MaxKey:
+            case MinKey:
+                return v;   // the type says it all
+            case NumberDouble: {
+                long long bits = loadLong( v );
+                double d;
+                memcpy( &d, &bits, sizeof(d) );
+                x = numberBits( d );
+                end = v + 8;
+                break;
+            }
+            case NumberInt:
+                x = numberBits( readInt( v ) );
+                end = v + 4;
+                break;
+            case NumberLong:
+                x = numberBits( (double) loadLong( v ) );
+                end = v + 8;
+                break;
+            case Bool:
+                x = (unsigned char) *v;
+                end = v + 1;
+                break;
+            case Date:
+            case Timestamp:
+                x = loadLong( v );
+                end = v + 8;
+                break;
+            case jstOID:
+                h = mixBytes( h, v, 12 );
+                return v + 12;
+            case Code:
+            case Symbol:
+            case String: {
+                int sz = readInt( v );
+                h = mixBytes( h, v + 4, sz );
+                return v + 4 + sz;
+            }
+            case Object:
+            case Array:
+                x = hashObject( v, true );
+                end = v + readInt( v );
+                break;
+            case DBRef: {
+                int sz = 4 + readInt( v ) + 12;
+                x = hash64( v, sz );
+                end = v + sz;
+                break;
+            }
+            case BinData: {
+                int sz = 4 + 1 + readInt( v );
+                x = hash64( v, sz );
+                end = v + sz;
+                break;
+            }
+            case RegEx: {
+                const char *flags = v + strlen( v ) + 1;
+                x = mix( hashCString( v ), hashCString( flags ) );
+                end = flags + strlen( flags ) + 1;
+                break;
+            }
+            case CodeWScope: {
+                // compareElementValues() strcmp()s the code and the start of the scope
+                const char *code = v + 8;
+                x = mix( hashCString( code ), hashCString( code + strlen( code ) + 1 ) );
+                end = v + readInt( v );
+                break;
+            }
+            default:
+                verify(false);
+                return v;
+            }
+            h = mix( h, x );
+            return end;
+        }
+
+        unsigned long long hashObject(const char *obj, bool considerFieldName) {
+            unsigned long long h = hashdetail::P5;
+            const char *p = obj + 4;
+            while ( *p != EOO )
+                p = hashElement( p, considerFieldName, h );
+            return hashdetail::avalanche( h );
+        }
+
+    }
+
+    unsigned long long bsonelement::valueHash() const {
+        unsigned long long h = hashdetail::P5;
+        hashElement( rawdata(), false, h );
+        return hashdetail::avalanche( h );
+    }
+
+    unsigned long long bsonobj::valueHash(bool considerFieldName) const {
+        return hashObject( objdata(), considerFieldName );
+    }
+
+    bool bsonobj::equal(const bsonobj& r) const {
+        return woCompare( r ) == 0;
+    }
+
 }
@@ -0,0 +1,294 @@
+// bson_validate.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cstring>
+#include "bson_validate.h"
+#include "bsontypes.h"
+#include "builder.h"
+#include "endian.h"
+
+namespace _bson {
+
+    namespace {
+
+        struct Frame {
+            const char *end;        // the document's EOO
+            bool isArray;
+            int index;              // of the next array element
+        };
+
+        /** is [name, nul) the decimal for index, with no leading zeros? */
+        inline bool isArrayKey(const char *name, const char *nul, int index) {
+            size_t n = nul - name;
+            if ( n == 1 )
+                return *name - '0' == index;
+            if ( n == 0 || n > 10 || name[0] == '0' )
+                return false;
+            long long v = 0;
+            for( ; name < nul; name++ ) {
+                if ( *name < '0' || *name > '9' )
+                    return false;
+                v = v * 10 + ( *name - '0' );
+            }
+            return v == index;
+        }
+
+        inline bool isRegexOptions(const char *p, const char *nul) {
+            for( ; p < nul; p++ ) {
+                if ( !strchr( "ilmsux", *p ) )
+                    return false;
+            }
+            return true;
+        }
+
+        /** @return the end of the terminated string at p, or 0 if it runs into end.  Every
+            document checked ends in a 0 byte, its EOO, so there's no need to test for end
+            each byte.  ascii is set false if there's a byte past 0x7f.
+        */
+        inline const char* cstringEnd(const char *p, const char *end, bool& ascii) {
+            unsigned char all = 0;
+            for( ; *p; p++ )
+                all |= (unsigned char) *p;
+            ascii = all < 0x80;
+            return p < end ? p : 0;
+        }
+
+        inline const char* cstringEnd(const char *p, const char *end) {
+            bool ascii;
+            return cstringEnd( p, end, ascii );
+        }
+
+        /** isValidUTF8(), with the test for short ASCII strings inline */
+        inline bool isUTF8(const char *p, size_t len) {
+            if ( len >= 16 )
+                return isValidUTF8( p, len );
+            const char *s = p, *e = p + len;
+            unsigned long long all = 0;
+            for( ; e - p >= 8; p += 8 ) {
+                unsigned long long w;
+                memcpy( &w, p, 8 );
+                all |= w;
+            }
+            for( ; p < e; p++ )
+                all |= (unsigned char) *p;
+            return ( all & 0x8080808080808080ULL ) == 0 || isValidUTF8( s, len );
+        }
+
+        /** checks an embedded document of at most left bytes at v.  @return its end, or 0 */
+        inline const char* documentEnd(const char *v, size_t left) {
+            if ( left < 5 )
+                return 0;
+            int n = readInt( v );
+            if ( n < 5 || (size_t) n > left || v[n - 1] != EOO )
+                return 0;
+            return v + n - 1;
+        }
+
+        /** @return 0 if the document is good, or what's wrong, with at where */
+        template< int Level >
+        const char* check(const char *buf, size_t maxLength, const char *&at) {
+            at = buf;
+            if ( maxLength < 5 )
+                return "document shorter than 5 bytes";
+            int len = readInt( buf );
+            if ( len < 5 || (size_t) len > maxLength || len > BSONObjMaxInternalSize )
+                return "bad document size";
+            if ( buf[len - 1] != EOO )
+                return "document doesn't end in EOO";
+
+            Frame stack[BSONValidateMaxDepth + 1];
+            int depth = 0;
+            Frame *f = stack;
+            f->end = buf + len - 1;
+            f->isArray = false;
+            f->index = 0;
+
+            const char *p = buf + 4;
+            while( true ) {
+                at = p;
+                const char *end = f->end;
+                int type = (signed char) *p;
+                if ( type == EOO ) {
+                    if ( p != end )
+                        return "EOO before the end of the document";
+                    if ( depth == 0 )
+                        return 0;
+                    p = end + 1;
+                    f = &stack[--depth];
+                    continue;
+                }
+
+                const char *name = p + 1;
+                bool ascii;
+                const char *nul = cstringEnd( name, end, ascii );
+                if ( nul == 0 )
+                    return "field name not terminated";
+                if ( Level >= ValidateTypes && f->isArray && !isArrayKey( name, nul, f->index++ ) )
+                    return "array keys not 0, 1, 2, ...";
+                if ( Level >= ValidateFull && !ascii && !isValidUTF8( name, nul - name ) )
+                    return "field name not UTF-8";
+
+                const char *v = nul + 1;
+                size_t left = end - v;      // for the value: up to, not including, the EOO
+                size_t size;
+                switch( type ) {
+                case Undefined:
+                case jstNULL:
+                case MinKey:
+                case MaxKey:
+                    size = 0;
+                    break;
+                case Bool:
+                    size = 1;
+                    if ( Level >= ValidateTypes && left >= 1 && (unsigned char) *v > 1 )
+                        return "bool not 0 or 1";
+                    break;
+                case NumberInt:
+                    size = 4;
+                    break;
+                case NumberDouble:
+                case Date:
+                case Timestamp:
+                case NumberLong:
+                    size = 8;
+                    break;
+                case jstOID:
+                    size = 12;
+                    break;
+                case String:
+                case Code:
+                case Symbol:
+                case DBRef: {
+                    if ( left < 4 )
+                        return "value runs past the end of the document";
+                    int n = readInt( v );
+                    if ( n < 1 || (size_t) n > left - 4 || v[4 + n - 1] != 0 )
+                        return "bad string size";
+                    if ( Level >= ValidateFull && !isUTF8( v + 4, n - 1 ) )
+                        return "string not UTF-8";
+                    size = 4 + n + ( type == DBRef ? 12 : 0 );
+                    break;
+                }
+                case BinData: {
+                    if ( left < 5 )
+                        return "value runs past the end of the document";
+                    int n = readInt( v );
+                    if ( n < 0 || (size_t) n > left - 5 )
+                        return "bad bin data size";
+                    if ( Level >= ValidateTypes ) {
+                        int subtype = (unsigned char) v[4];
+                        if ( subtype == ByteArrayDeprecated && ( n < 4 || readInt( v + 5 ) != n - 4 ) )
+                            return "bad inner size for bin data subtype 2";
+                        if ( ( subtype == bdtUUID || subtype == newUUID || subtype == MD5Type ) && n != 16 )
+                            return "UUID or MD5 bin data not 16 bytes";
+                    }
+                    size = 5 + n;
+                    break;
+                }
+                case RegEx: {
+                    const char *pattern = cstringEnd( v, end );
+                    const char *options = pattern ? cstringEnd( pattern + 1, end ) : 0;
+                    if ( options == 0 )
+                        return "regex not terminated";
+                    if ( Level >= ValidateTypes && !isRegexOptions( pattern + 1, options ) )
+                        return "bad regex options";
+                    if ( Level >= ValidateFull && !isUTF8( v, pattern - v ) )
+                        return "regex not UTF-8";
+                    size = options + 1 - v;
+                    break;
+                }
+                case Object:
+                case Array: {
+                    const char *e = documentEnd( v, left );
+                    if ( e == 0 )
+                        return "bad embedded document size";
+                    if ( depth == BSONValidateMaxDepth )
+                        return "nested too deeply";
+                    f = &stack[++depth];
+                    f->end = e;
+                    f->isArray = type == Array;
+                    f->index = 0;
+                    p = v + 4;
+                    continue;
+                }
+                case CodeWScope: {
+                    // { int total, int n, code[n], scope document }
+                    if ( left < 14 )
+                        return "value runs past the end of the document";
+                    int total = readInt( v );
+                    int n = readInt( v + 4 );
+                    if ( total < 14 || (size_t) total > left || n < 1 || n > total - 13 ||
+                         v[8 + n - 1] != 0 )
+                        return "bad code with scope size";
+                    if ( Level >= ValidateFull && !isUTF8( v + 8, n - 1 ) )
+                        return "code not UTF-8";
+                    const char *scope = v + 8 + n;
+                    const char *e = documentEnd( scope, total - 8 - n );
+                    if ( e == 0 || e != v + total - 1 )
+                        return "bad code with scope size";
+                    if ( depth == BSONValidateMaxDepth )
+                        return "nested too deeply";
+                    f = &stack[++depth];
+                    f->end = e;
+                    f->isArray = false;
+                    f->index = 0;
+                    p = scope + 4;
+                    continue;
+                }
+                default:
+                    return "unknown type";
+                }
+                if ( size > left )
+                    return "value runs past the end of the document";
+                p = v + size;
+            }
+        }
+
+    }
+
+    const char* checkBSON(const char *buf, size_t maxLength, BSONValidateLevel level,
+                          size_t *errorOffset) {
+        const char *at;
+        const char *problem;
+        switch( level ) {
+        case ValidateStructure:
+            problem = check<ValidateStructure>( buf, maxLength, at );
+            break;
+        case ValidateTypes:
+            problem = check<ValidateTypes>( buf, maxLength, at );
+            break;
+        default:
+            problem = check<ValidateFull>( buf, maxLength, at );
+            break;
+        }
+        if ( problem && errorOffset )
+            *errorOffset = at - buf;
+        return problem;
+    }
+
+    Status validateBSON(const char *buf, size_t maxLength, BSONValidateLevel level,
+                        size_t *errorOffset) {
+        size_t at;
+        const char *problem = checkBSON( buf, maxLength, level, &at );
+        if ( problem == 0 )
+            return Status::OK();
+        if ( errorOffset )
+            *errorOffset = at;
+        StringBuilder sb;
+        sb << "invalid BSON: " << problem << " at offset " << (long long) at;
+        return Status( InvalidBSON, sb.str() );
+    }
+
+}
@@ -0,0 +1,64 @@
+// bson_validate.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include "status.h"
+#include "utf8.h"
+
+namespace _bson {
+
+    /** how much validateBSON() checks.  Each level checks what the ones before it do. */
+    enum BSONValidateLevel {
+        /** everything needed to walk the document without reading outside it: sizes of the
+            document, embedded documents and values are in bounds and agree with each other,
+            names and strings are terminated, types are known, nesting is at most
+            BSONValidateMaxDepth.  Enough for bsonobjiterator, getField() and the like.
+        */
+        ValidateStructure,
+
+        /** also the rules of each type: bools are 0 or 1, array keys are "0", "1", ... in
+            order, UUID and MD5 bin data are 16 bytes, old style (subtype 2) bin data has a
+            correct inner length, regex options are from "ilmsux".
+        */
+        ValidateTypes,
+
+        /** also that field names, strings, code, symbols and regexes are UTF-8 */
+        ValidateFull
+    };
+
+    const int BSONValidateMaxDepth = 100;  // embedded documents in embedded documents...
+
+    /** checks the document at buf, of at most maxLength bytes, in one pass over it.  Throws
+        nothing: a problem is a Status of InvalidBSON, saying what and where, and its offset
+        from buf goes in *errorOffset if that's given.
+
+        example:
+          Status s = validateBSON( data, len );
+          if ( !s.isOK() )
+              return s;
+          bsonobj doc( data );      // safe to use as any other now
+    */
+    Status validateBSON(const char *buf, size_t maxLength,
+                        BSONValidateLevel level = ValidateFull, size_t *errorOffset = 0);
+
+    /** validateBSON() without the Status: nothing is allocated, good document or bad.
+        @return 0 if the document is good, otherwise what's wrong with it, a literal
+    */
+    const char* checkBSON(const char *buf, size_t maxLength,
+                          BSONValidateLevel level = ValidateFull, size_t *errorOffset = 0);
+
+}
@@ -0,0 +1,165 @@
+// bsonarrayview.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "bsonobjiterator.h"
+#include "parse_number.h"
+
+namespace _bson {
+
+    /** Random access view of a BSON array.
+
+        The first call to size(), at() or slice() scans the array once and builds a table of
+        element offsets and sizes; after that at(i) is O(1) and does no key parsing.  The
+        table is shared by slices of the view.
+
+        By default the keys are checked: a key equal to the expected "0", "1", ... costs a
+        memcmp; any other numeric key places the element at that position (leaving eoo()
+        holes, as bsonelement::Array() does) and non-numeric keys are ignored.  Pass
+        trustSequentialKeys=true to skip that and take the i'th element as index i.
+
+        example:
+          bsonarrayview v( obj["samples"] );
+          for( int i = 0; i < v.size(); i += 100 )
+              total += v[i].number();
+
+        The underlying bson must stay in scope for the life of the view.  The lazy table build
+        is not thread safe -- call size() before sharing a view between threads.
+    */
+    class bsonarrayview {
+    public:
+        explicit bsonarrayview(const bsonobj& arr, bool trustSequentialKeys = false)
+            : _arr(arr), _trust(trustSequentialKeys), _first(0), _n(-1) { }
+
+        /** @param e an element of type Array (or Object); throws MsgAssertionException otherwise */
+        explicit bsonarrayview(const bsonelement& e, bool trustSequentialKeys = false)
+            : _arr(checkArray(e)), _trust(trustSequentialKeys), _first(0), _n(-1) { }
+
+        /** @return number of positions in the view */
+        int size() const {
+            index();
+            return _n;
+        }
+
+        bool empty() const { return size() == 0; }
+
+        /** @return the element at position i; eoo() if out of range or a hole. */
+        bsonelement at(int i) const {
+            index();
+            if ( (unsigned) i >= (unsigned) _n )
+                return bsonelement();
+            const Entry& x = (*_index)[_first + i];
+            if ( x.ofs == 0 )
+                return bsonelement();
+            bsonelement e( _arr.objdata() + x.ofs, x.fieldNameSize, bsonelement::FieldNameSizeTag() );
+            e.totalSize = x.size;
+            return e;
+        }
+
+        bsonelement operator[](int i) const { return at(i); }
+
+        /** @return view of positions [begin, end), clamped to the bounds of this view.  Shares
+            the offset table with this view.
+        */
+        bsonarrayview slice(int begin, int end) const {
+            index();
+            if ( begin < 0 ) begin = 0;
+            if ( end > _n ) end = _n;
+            if ( end < begin ) end = begin;
+            bsonarrayview v( *this );
+            v._first = _first + begin;
+            v._n = end - begin;
+            return v;
+        }
+
+        /** the array object viewed (the whole array, even for a slice) */
+        const bsonobj& obj() const { return _arr; }
+
+    private:
+        struct Entry {
+            int ofs;            // offset of the element within _arr; 0 for a hole
+            int size;           // total element size
+            int fieldNameSize;  // including the null terminator
+        };
+
+        static bsonobj checkArray(const bsonelement& e) {
+            massert( 18101, "bsonarrayview: element is not an array", e.isObject() );
+            return e.object();
+        }
+
+        void index() const {
+            if ( _n < 0 )
+                buildIndex();
+        }
+
+        void buildIndex() const {
+            std::shared_ptr< std::vector<Entry> > v = std::make_shared< std::vector<Entry> >();
+            const char *base = _arr.objdata();
+            // next expected key, as a decimal string
+            char key[16] = { '0', 0 };
+            int keyLen = 1;
+            for( bsonelemiterator i = _arr.begin(); i != _arr.end(); ++i ) {
+                const bsonelement& e = *i;
+                Entry x;
+                x.ofs = (int) ( e.rawdata() - base );
+                x.size = e.size();
+                x.fieldNameSize = e.fieldNameSize();
+                if ( _trust || ( x.fieldNameSize == keyLen + 1 &&
+                                 memcmp( e.fieldName(), key, keyLen ) == 0 ) ) {
+                    v->push_back( x );
+                }
+                else {
+                    unsigned u;
+                    if ( !parseNumberFromString( e.fieldName(), &u ).isOK() )
+                        continue; // ignore non-numeric keys
+                    massert( 18100, "array index out of range", u < (unsigned) _arr.objsize() );
+                    if ( u >= v->size() ) {
+                        Entry hole = { 0, 0, 0 };
+                        v->resize( u + 1, hole );
+                    }
+                    (*v)[u] = x;
+                }
+                if ( !_trust )
+                    keyLen = nextKey( key, (int) v->size() );
+            }
+            _n = (int) v->size();
+            _index = v;
+        }
+
+        /** write the decimal representation of n into key.  @return its length */
+        static int nextKey(char *key, int n) {
+            char tmp[16];
+            int len = 0;
+            do {
+                tmp[len++] = (char) ( '0' + n % 10 );
+                n /= 10;
+            } while ( n );
+            for( int i = 0; i < len; i++ )
+                key[i] = tmp[len - 1 - i];
+            key[len] = 0;
+            return len;
+        }
+
+        bsonobj _arr;
+        bool _trust;
+        int _first;
+        mutable int _n;
+        mutable std::shared_ptr< const std::vector<Entry> > _index;
+    };
+
+}
@@ -0,0 +1,279 @@
+// bsondiff.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cstring>
+#include <vector>
+#include "bsondiff.h"
+#include "bsonobjbuilder.h"
+#include "bsonobjiterator.h"
+
+namespace _bson {
+
+    namespace {
+
+        bool sameElement(const bsonelement& x, const bsonelement& y) {
+            return x.size() == y.size() && memcmp( x.rawdata(), y.rawdata(), x.size() ) == 0;
+        }
+
+        /** same type and value bytes, whatever the names */
+        bool sameValue(const bsonelement& x, const bsonelement& y) {
+            return x.type() == y.type() && x.valuesize() == y.valuesize() &&
+                   memcmp( x.value(), y.value(), x.valuesize() ) == 0;
+        }
+
+        /** @return true if there's a field called name at or after p */
+        bool hasFieldFrom(const char *p, const StringData& name) {
+            while( *p != EOO ) {
+                bsonelement e( p );
+                if ( e.fieldNameStringData() == name )
+                    return true;
+                p += e.size();
+            }
+            return false;
+        }
+
+        /** appends the elements in elems, if any, as an object named name */
+        void appendSection(BufBuilder& b, const char *name, const BufBuilder& elems) {
+            if ( elems.len() == 0 )
+                return;
+            b.appendChar( (char) Object );
+            b.appendStr( name );
+            b.appendNum( 4 + elems.len() + 1 );
+            b.appendBuf( elems.buf(), elems.len() );
+            b.appendChar( EOO );
+        }
+
+        /** appends e's value named name */
+        void appendAs(BufBuilder& b, const bsonelement& e, const StringData& name) {
+            b.appendChar( (char) e.type() );
+            b.appendStr( name );
+            b.appendBuf( e.value(), e.valuesize() );
+        }
+
+        bool diffObject(const bsonobj& a, const bsonobj& b, BufBuilder& out);
+        void diffArray(const bsonobj& a, const bsonobj& b, BufBuilder& out);
+
+        /** for a field changed from x to y: appends the delta of the two to s, if they're
+            objects or arrays and that's smaller than y, and y to u if not
+        */
+        void diffValue(const bsonelement& x, const bsonelement& y, BufBuilder& s, BufBuilder& u) {
+            if ( x.type() == y.type() && x.isObject() ) {
+                BufBuilder sub( 0 );
+                sub.skip( 4 );
+                bool ok = true;
+                if ( y.type() == Array )
+                    diffArray( x.object(), y.object(), sub );
+                else
+                    ok = diffObject( x.object(), y.object(), sub );
+                sub.appendChar( EOO );
+                if ( ok && sub.len() < y.valuesize() ) {
+                    *( (int*) sub.buf() ) = endian_int( sub.len() );
+                    s.appendChar( (char) Object );
+                    s.appendStr( y.fieldNameStringData() );
+                    s.appendBuf( sub.buf(), sub.len() );
+                    return;
+                }
+            }
+            u.appendBuf( y.rawdata(), y.size() );
+        }
+
+        /** appends the delta's elements to out.  @return false if b can't be made from a with
+            deletes, replacements and fields added at the end
+        */
+        bool diffObject(const bsonobj& a, const bsonobj& b, BufBuilder& out) {
+            BufBuilder d( 0 ), u( 0 ), i( 0 ), s( 0 );
+            const char *p = a.objdata() + 4;
+            const char *q = b.objdata() + 4;
+            while( *p != EOO && *q != EOO ) {
+                bsonelement x( p ), y( q );
+                StringData name = x.fieldNameStringData();
+                if ( name == y.fieldNameStringData() ) {
+                    if ( !sameElement( x, y ) )
+                        diffValue( x, y, s, u );
+                    p += x.size();
+                    q += y.size();
+                }
+                else if ( !hasFieldFrom( q, name ) ) {
+                    d.appendChar( (char) Bool );
+                    d.appendStr( name );
+                    d.appendChar( 1 );
+                    p += x.size();
+                }
+                else {
+                    // x is still there, after something that wasn't: a move or an insert
+                    return false;
+                }
+            }
+            for( ; *p != EOO; p += bsonelement( p ).size() ) {
+                d.appendChar( (char) Bool );
+                d.appendStr( bsonelement( p ).fieldNameStringData() );
+                d.appendChar( 1 );
+            }
+            const char *end = b.objdata() + b.objsize() - 1;
+            if ( q < end )      // i has no buffer yet: no memcpy to null, even of 0 bytes
+                i.appendBuf( q, end - q );
+
+            appendSection( out, "d", d );
+            appendSection( out, "u", u );
+            appendSection( out, "i", i );
+            appendSection( out, "s", s );
+            return true;
+        }
+
+        void diffArray(const bsonobj& a, const bsonobj& b, BufBuilder& out) {
+            std::vector<bsonelement> x, y;
+            for( bsonelemiterator i = a.begin(); i != a.end(); ++i )
+                x.push_back( *i );
+            for( bsonelemiterator i = b.begin(); i != b.end(); ++i )
+                y.push_back( *i );
+            size_t pre = 0;
+            while( pre < x.size() && pre < y.size() && sameValue( x[pre], y[pre] ) )
+                pre++;
+            size_t suf = 0;
+            while( suf < x.size() - pre && suf < y.size() - pre &&
+                   sameValue( x[x.size() - 1 - suf], y[y.size() - 1 - suf] ) )
+                suf++;
+            size_t nx = x.size() - pre - suf, ny = y.size() - pre - suf;
+
+            if ( nx == ny ) {
+                BufBuilder u( 0 ), s( 0 );
+                for( size_t k = pre; k < pre + nx; k++ ) {
+                    if ( !sameValue( x[k], y[k] ) )
+                        diffValue( x[k], y[k], s, u );
+                }
+                appendSection( out, "u", u );
+                appendSection( out, "s", s );
+                return;
+            }
+
+            out.appendChar( (char) NumberInt );
+            out.appendStr( "p" );
+            out.appendNum( (int) pre );
+            out.appendChar( (char) NumberInt );
+            out.appendStr( "n" );
+            out.appendNum( (int) nx );
+            out.appendChar( (char) Array );
+            out.appendStr( "v" );
+            int start = out.len();
+            out.skip( 4 );
+            for( size_t k = 0; k < ny; k++ )
+                appendAs( out, y[pre + k], bsonobjbuilder::numStr( (int) k ) );
+            out.appendChar( EOO );
+            *( (int*) ( out.buf() + start ) ) = endian_int( out.len() - start );
+        }
+
+        void applyObject(const bsonobj& doc, const bsonobj& delta, BufBuilder& b);
+
+        /** appends e changed by delta */
+        void applyValue(const bsonelement& e, const bsonobj& delta, BufBuilder& b) {
+            massert( 18117, "applyDiff: delta doesn't fit the document", e.isObject() );
+            b.appendChar( (char) e.type() );
+            b.appendStr( e.fieldNameStringData() );
+            int start = b.len();
+            b.skip( 4 );
+            bsonelement p = delta["p"];
+            if ( e.type() == Array && !p.eoo() ) {
+                // a splice: elements after it are renumbered
+                int at = p.numberInt();
+                int n = delta["n"].numberInt();
+                bsonobj v = delta["v"].object();
+                int k = 0, j = 0;
+                bsonobj arr = e.object();
+                for( bsonelemiterator i = arr.begin(); ; ++i, k++ ) {
+                    if ( k == at ) {
+                        for( bsonelemiterator w = v.begin(); w != v.end(); ++w )
+                            appendAs( b, *w, bsonobjbuilder::numStr( j++ ) );
+                    }
+                    if ( i == arr.end() )
+                        break;
+                    if ( k < at || k >= at + n )
+                        appendAs( b, *i, bsonobjbuilder::numStr( j++ ) );
+                }
+                massert( 18117, "applyDiff: delta doesn't fit the document", at + n <= k );
+            }
+            else {
+                applyObject( e.object(), delta, b );
+            }
+            b.appendChar( EOO );
+            *( (int*) ( b.buf() + start ) ) = endian_int( b.len() - start );
+        }
+
+        /** appends the elements of doc changed by delta */
+        void applyObject(const bsonobj& doc, const bsonobj& delta, BufBuilder& b) {
+            bsonobj d = delta.getObjectField( "d" );
+            bsonobj u = delta.getObjectField( "u" );
+            bsonobj i = delta.getObjectField( "i" );
+            bsonobj s = delta.getObjectField( "s" );
+            int left = d.nFields() + u.nFields() + s.nFields();
+
+            const char *run = doc.objdata() + 4;     // unchanged fields not yet copied
+            const char *p = run;
+            while( *p != EOO && left ) {
+                bsonelement e( p );
+                int size = e.size();
+                StringData name = e.fieldNameStringData();
+                bsonelement x;
+                if ( !d.isEmpty() && !d.getField( name ).eoo() ) {
+                    b.appendBuf( run, p - run );
+                }
+                else if ( !u.isEmpty() && !( x = u.getField( name ) ).eoo() ) {
+                    b.appendBuf( run, p - run );
+                    b.appendBuf( x.rawdata(), x.size() );
+                }
+                else if ( !s.isEmpty() && !( x = s.getField( name ) ).eoo() ) {
+                    b.appendBuf( run, p - run );
+                    applyValue( e, x.object(), b );
+                }
+                else {
+                    p += size;
+                    continue;
+                }
+                p += size;
+                run = p;
+                left--;
+            }
+            massert( 18117, "applyDiff: delta doesn't fit the document", left == 0 );
+            const char *end = doc.objdata() + doc.objsize() - 1;
+            b.appendBuf( run, end - run );
+            b.appendBuf( i.objdata() + 4, i.objsize() - 5 );
+        }
+
+    }
+
+    bsonobj diff(const bsonobj& from, const bsonobj& to, bsonobjbuilder& b) {
+        if ( from.binaryEqual( to ) )
+            return b.obj();
+        BufBuilder& bb = b.bb();
+        int start = bb.len();
+        if ( !diffObject( from, to, bb ) || bb.len() - start >= to.objsize() ) {
+            bb.setlen( start );
+            b.append( "r", to );
+        }
+        return b.obj();
+    }
+
+    bsonobj applyDiff(const bsonobj& doc, const bsonobj& delta, bsonobjbuilder& b) {
+        bsonelement r = delta["r"];
+        if ( !r.eoo() ) {
+            bsonobj to = r.object();
+            b.bb().appendBuf( to.objdata() + 4, to.objsize() - 5 );
+        }
+        else {
+            applyObject( doc, delta, b.bb() );
+        }
+        return b.obj();
+    }
+
+}
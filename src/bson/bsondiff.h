@@ -0,0 +1,55 @@
+// bsondiff.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include "bsonobj.h"
+
+namespace _bson {
+
+    class bsonobjbuilder;
+
+    /* Structural diffs: diff() makes a delta, a small document saying how one document
+       differs from another, and applyDiff() makes the second document from the first and
+       the delta -- byte for byte the same.
+
+       The two documents are walked in step.  Fields whose bytes are the same are skipped
+       with a memcmp, so unchanged embedded objects cost one compare, not a walk.  Changed
+       objects and arrays are diffed in turn, where that gives a smaller delta than their
+       new value.
+
+       A delta for an object has any of
+         d : { name : true, ... }            fields deleted
+         u : { name : value, ... }           fields whose value is replaced, in place
+         i : { name : value, ... }           fields added, at the end, in this order
+         s : { name : delta, ... }           objects and arrays changed inside
+       and for an array either
+         u : { index : value, ... }, s : { index : delta, ... }      same length
+       or a splice
+         p : at, n : count, v : [ values ]   n elements from p replaced by v
+       A document that can't be made that way -- fields moved, or new ones put in the
+       middle -- gets { r : document }, a replacement; objects inside get a u.  Documents
+       that are the same give {}.
+    */
+
+    /** builds into b the delta from from to to.  @return b.obj() */
+    bsonobj diff(const bsonobj& from, const bsonobj& to, bsonobjbuilder& b);
+
+    /** builds into b doc changed by delta, which must be a diff() from doc.  Throws if the
+        delta doesn't fit doc.  @return b.obj()
+    */
+    bsonobj applyDiff(const bsonobj& doc, const bsonobj& delta, bsonobjbuilder& b);
+
+}
@@ -23,6 +23,7 @@
 #include "cstdint.h"
 #include "builder.h"
 #include "endian.h"
+#include "status_with.h"
 
 namespace _bson {
     class bsonobj;
@@ -77,11 +78,63 @@ namespace _bson {
         long long Long()            const { return chk(NumberLong)._numberLong(); }
         int Int()                   const { return chk(NumberInt)._numberInt(); }
         bool Bool()                 const { return chk(_bson::Bool).boolean(); }
-        std::vector<bsonelement> Array() const; // see implementation for detailed comments
+        std::vector<bsonelement> Array() const; // see implementation for detailed comments. see also bsonarrayview
         _bson::OID OID()            const { return chk(jstOID).__oid(); }
         void Null()                 const { chk(isNull()); } // throw MsgAssertionException if not null
         void OK()                   const { chk(ok()); }     // throw MsgAssertionException if element DNE
 
+        /** The accessors above without the exceptions, for loops where missing or mistyped
+            fields are expected: the value, or a Status of NoSuchKey if the element is EOO or
+            TypeMismatch if it is of another type.  Nothing is allocated either way -- the
+            Status's reason is a literal.  tryString() points into the element. Example:
+
+            StatusWith<int> n = obj["n"].tryInt();
+            if ( !n.isOK() )
+                return n.getStatus();
+        */
+        StatusWith<StringData> tryString() const {
+            if ( type() != _bson::String )
+                return StatusWith<StringData>( typeMismatch() );
+            return StatusWith<StringData>( StringData( valuestr(), valuestrsize() - 1 ) );
+        }
+        StatusWith<Date_t> tryDate() const {
+            if ( type() != _bson::Date )
+                return StatusWith<Date_t>( typeMismatch() );
+            return StatusWith<Date_t>( date() );
+        }
+        StatusWith<double> tryNumber() const {
+            if ( !isNumber() )
+                return StatusWith<double>( typeMismatch() );
+            return StatusWith<double>( number() );
+        }
+        StatusWith<double> tryDouble() const {
+            if ( type() != NumberDouble )
+                return StatusWith<double>( typeMismatch() );
+            return StatusWith<double>( _numberDouble() );
+        }
+        StatusWith<long long> tryLong() const {
+            if ( type() != NumberLong )
+                return StatusWith<long long>( typeMismatch() );
+            return StatusWith<long long>( _numberLong() );
+        }
+        StatusWith<int> tryInt() const {
+            if ( type() != NumberInt )
+                return StatusWith<int>( typeMismatch() );
+            return StatusWith<int>( _numberInt() );
+        }
+        StatusWith<bool> tryBool() const {
+            if ( type() != _bson::Bool )
+                return StatusWith<bool>( typeMismatch() );
+            return StatusWith<bool>( boolean() );
+        }
+        StatusWith<_bson::OID> tryOID() const {
+            if ( type() != jstOID )
+                return StatusWith<_bson::OID>( typeMismatch() );
+            return StatusWith<_bson::OID>( __oid() );
+        }
+        /** object() for an Object or Array; InvalidBSON if its size is out of range */
+        StatusWith<bsonobj> tryObject() const;
+
         /** @return the embedded object associated with this field.
             Note the returned object is a reference to within the parent bson object. If that
             object is out of scope, this pointer will no longer be valid. Call getOwned() on the
@@ -358,6 +411,12 @@ namespace _bson {
             return woCompare( r , false ) == 0;
         }
 
+        /** @return a hash of the value consistent with valuesEqual(): values that compare
+            equal hash the same -- 1, 1.0 and NumberLong(1), say, or 0.0 and -0.0.  Objects
+            and arrays are hashed all the way down.
+        */
+        unsigned long long valueHash() const;
+
         /** Returns true if elements are equal. */
         bool operator==(const bsonelement& r) const {
             return woCompare( r , true ) == 0;
@@ -492,6 +551,9 @@ namespace _bson {
         mutable int totalSize; /* caches the computed size */
 
         friend class bsonobjiterator;
+        template <bool Checked> friend class _bsonelemiterator;
+        template <class Access> friend class bsonview;
+        friend class bsonarrayview;
         friend class bsonobj;
         const bsonelement& chk(int t) const {
             if ( t != type() ) {
@@ -508,8 +570,110 @@ namespace _bson {
             massert(13118, "unexpected or missing type value in BSON object", expr);
             return *this;
         }
+        Status typeMismatch() const {
+            if ( eoo() )
+                return Status::literal( NoSuchKey, "field not found" );
+            return Status::literal( TypeMismatch, "wrong type for field" );
+        }
     };
 
+    namespace iter {
+        // size of the value for each type; see bson.cpp
+        extern unsigned char sizeForBsonType[];
+
+        /** errors returned by checkedElementSize() */
+        enum ElementSizeError {
+            InsufficientBytes = -1,
+            InvalidFieldName = -2,
+            BadElementSize = -3,
+            BadElementType = -4
+        };
+
+        /** Table driven, bounds checked computation of an element's total size (type byte,
+            field name and value).  Reads nothing at or past p + maxLen and never throws.
+            @param fieldNameSize set to the field name size including its null terminator; 0
+                   for EOO, which has no field name -- what bsonelement's constructors store
+                   for it, not the 1 that strlen( fieldName() ) + 1 would give
+            @return the size of the element, or a (negative) ElementSizeError
+        */
+        inline int checkedElementSize(const char *p, int maxLen, int& fieldNameSize) {
+            if ( maxLen < 1 )
+                return InsufficientBytes;
+            unsigned char t = (unsigned char) *p;
+            if ( t == EOO ) {
+                fieldNameSize = 0;
+                return 1;
+            }
+            const char *nul = (const char *) memchr( p + 1, 0, maxLen - 1 );
+            if ( nul == 0 )
+                return InvalidFieldName;
+            int hdr = (int) ( nul - p ) + 1;
+            fieldNameSize = hdr - 1;
+            int remain = maxLen - hdr;
+            unsigned z = sizeForBsonType[t];
+            if ( z < 0x80 ) {
+                return (int) z <= remain ? hdr + (int) z : InsufficientBytes;
+            }
+            if ( z < 0xfe ) {
+                // length prefixed
+                if ( remain < 4 )
+                    return InsufficientBytes;
+                int len = readInt( p + hdr );
+                int extra = z & 0x7f;
+                if ( len < 0 || len > remain - extra )
+                    return BadElementSize;
+                return hdr + len + extra;
+            }
+            if ( z == 0xfe ) {
+                // regex: two cstrings
+                const char *v = p + hdr;
+                const char *a = (const char *) memchr( v, 0, remain );
+                if ( a == 0 )
+                    return BadElementSize;
+                const char *b = (const char *) memchr( a + 1, 0, remain - ( a + 1 - v ) );
+                if ( b == 0 )
+                    return BadElementSize;
+                return (int) ( b - p ) + 1;
+            }
+            return BadElementType;
+        }
+
+        /** throws MsgAssertionException describing an error from checkedElementSize() */
+        void elementSizeError(int err, const char *p);
+
+        /** what an error from checkedElementSize() means, as a literal */
+        const char* elementSizeErrorString(int err);
+
+        /** An element's total size, from the table, with no checks at all: for documents
+            known to be well formed -- built here, or passed by validateBSON().  Unlike
+            bsonelement::size() there is no path in it that throws.
+            @param fieldNameSize set to the field name size including its null terminator; 0
+                   for EOO, as with checkedElementSize()
+        */
+        inline int trustedElementSize(const char *p, int& fieldNameSize) {
+            unsigned char t = (unsigned char) *p;
+            if ( t == EOO ) {
+                fieldNameSize = 0;
+                return 1;
+            }
+            // names are short: a loop beats a call to strlen
+            const char *nul = p + 1;
+            while( *nul )
+                nul++;
+            int hdr = (int) ( nul - p ) + 1;
+            fieldNameSize = hdr - 1;
+            unsigned z = sizeForBsonType[t];
+            if ( z < 0x80 )
+                return hdr + (int) z;
+            if ( z < 0xfe )
+                return hdr + readInt( p + hdr ) + (int) ( z & 0x7f );
+            // regex, two cstrings.  (0xff, an unknown type, can't be in a good document.)
+            const char *v = p + hdr;
+            size_t a = strlen( v );
+            return hdr + (int) ( a + 1 + strlen( v + a + 1 ) + 1 );
+        }
+    }
+
     inline bool bsonelement::trueValue() const {
         // NOTE Behavior changes must be replicated in Value::coerceToBool().
         switch( type() ) {
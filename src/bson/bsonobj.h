@@ -15,6 +15,7 @@
 
 #pragma once
 
+#include <functional>
 #include <set>
 #include <list>
 #include <string>
@@ -23,11 +24,15 @@
 #include "bsonelement.h"
 #include "string_data.h"
 #include "builder.h"
+#include "hash.h"
 #include "ordering.h"
 
 namespace _bson {
 
     class bsonobjiterator;
+    template <bool Checked> class _bsonelemiterator;
+    typedef _bsonelemiterator<false> bsonelemiterator;
+    typedef _bsonelemiterator<true> checkedbsonelemiterator;
 
     /**
        C++ view of a "BSON" object.
@@ -122,11 +127,22 @@ namespace _bson {
             return getField(field);
         }
 
+        /** Get the field whose name is the decimal representation of 'field' -- i.e. the
+            element at that position of an array.  This is a linear scan; see bsonarrayview
+            for repeated random access into large arrays.
+        */
         bsonelement operator[] (int field) const {
-            StringBuilder ss;
-            ss << field;
-            std::string s = ss.str();
-            return getField(s.c_str());
+            char buf[16];
+            char *p = buf + sizeof(buf) - 1;
+            *p = 0;
+            unsigned u = field < 0 ? 0u - (unsigned) field : (unsigned) field;
+            do {
+                *--p = (char) ('0' + u % 10);
+                u /= 10;
+            } while ( u );
+            if ( field < 0 )
+                *--p = '-';
+            return getField(StringData(p, buf + sizeof(buf) - 1 - p));
         }
 
         /** @return true if field exists */
@@ -186,7 +202,7 @@ namespace _bson {
             return readInt(objdata());
         }
 
-        /** performs a cursory check on the object's size only. */
+        /** performs a cursory check on the object's size only.  See valid() for a full check. */
         bool isValid() const;
 #if 0
         /** Same as above with the following extra restrictions
@@ -309,15 +325,47 @@ namespace _bson {
         */
         bool getObjectID(bsonelement& e) const;
 
-        /** @return A hash code for the object */
+        /** @return A hash code for the object.  31 bits of hash64(). */
         int hash() const {
-            unsigned x = 0;
-            const char *p = objdata();
-            for ( int i = 0; i < objsize(); i++ )
-                x = x * 131 + p[i];
-            return (x & 0x7fffffff) | 0x8000000; // must be > 0
+            unsigned long long h = hash64();
+            return (int) ( ( h ^ ( h >> 32 ) ) & 0x7fffffff ) | 0x8000000; // must be > 0
         }
 
+        /** @return a 64 bit hash of the object's bytes -- binaryEqual() objects hash the
+            same.  The size prefix is left out (the hash covers the length anyway), so that
+            bsonobjbuilder::hash64() can hash a document before its size is known.
+        */
+        unsigned long long hash64() const {
+            return _bson::hash64( objdata() + 4, objsize() - 4 );
+        }
+
+        /** Functors for hash containers keyed on the exact bytes of documents:
+              std::unordered_set<bsonobj, bsonobj::Hasher, bsonobj::BinaryEqual> s;
+            (operator== is woCompare equality, under which 1 and 1.0 are equal but hash
+            differently, so it is not the equality to use with Hasher.)
+        */
+        struct Hasher {
+            size_t operator()(const bsonobj& o) const { return (size_t) o.hash64(); }
+        };
+        struct BinaryEqual {
+            bool operator()(const bsonobj& l, const bsonobj& r) const { return l.binaryEqual( r ); }
+        };
+
+        /** @return a hash consistent with woCompare(r, bsonobj(), considerFieldName) == 0:
+            objects that compare equal hash the same, though their bytes may differ -- { a : 1 }
+            and { a : 1.0 }, for instance.  See bsonelement::valueHash().  Slower than
+            hash64(), as it has to walk the elements.
+        */
+        unsigned long long valueHash(bool considerFieldName = true) const;
+
+        /** Functor for hash containers that use operator== (woCompare) equality:
+              std::unordered_set<bsonobj, bsonobj::ValueHasher> s;
+            std::hash<bsonobj> is this, so std::unordered_set<bsonobj> is the same thing.
+        */
+        struct ValueHasher {
+            size_t operator()(const bsonobj& o) const { return (size_t) o.valueHash(); }
+        };
+
         // Return a version of this object where top level elements of types
         // that are not part of the bson wire protocol are replaced with
         // string identifier equivalents.
@@ -328,12 +376,16 @@ namespace _bson {
             passed object. */
         bsonobj replaceFieldNames( const bsonobj &obj ) const;
 
-        /** true unless corrupt */
+        /** true unless corrupt: validateBSON() at ValidateFull, trusting objsize() for the
+            length.  For data from outside, call validateBSON() with the length received. */
         bool valid() const;
 
-        /** @return an md5 value for this object. */
+        /** @return an md5 value for this object, in hex.  See digest.h. */
         std::string md5() const;
 
+        /** @return the SHA-256 digest of this object, in hex.  See digest.h. */
+        std::string sha256() const;
+
         bool operator==( const bsonobj& other ) const { return equal( other ); }
         bool operator!=(const bsonobj& other) const { return !operator==( other); }
 
@@ -364,15 +416,35 @@ namespace _bson {
         void vals(std::list<T> &) const;
 
         friend class bsonobjiterator;
-        typedef bsonobjiterator iterator;
-
-        /** use something like this:
-            for( bsonobj::iterator i = myObj.begin(); i.more(); ) {
-                bsonelement e = i.next();
-                ...
-            }
+        typedef bsonelemiterator iterator;
+        typedef bsonelemiterator const_iterator;
+
+        /** STL style iteration over the elements of the object (the trailing EOO is not
+            visited).  Works with range-for and the standard algorithms:
+              for( bsonelement e : myObj ) {
+                  ...
+              }
+            See bsonobjiterator for the more()/next() style of iteration.
         */
-        bsonobjiterator begin() const;
+        bsonelemiterator begin() const;
+        bsonelemiterator end() const;
+
+        /** begin/end pair usable with range-for. */
+        template <class It>
+        struct elemrange {
+            It b, e;
+            It begin() const { return b; }
+            It end() const { return e; }
+        };
+
+        /** Like begin()/end() but bounds checks each element against the object's size;
+            use on data from an untrusted source:
+              for( bsonelement e : myObj.checked() ) {
+                  ...
+              }
+            throws MsgAssertionException if the object is malformed.
+        */
+        elemrange<checkedbsonelemiterator> checked() const;
 
         void appendSelfToBufBuilder(BufBuilder& b) const {
             verify( objsize() != 0 );
@@ -406,4 +478,14 @@ namespace _bson {
 
 }
 
+namespace std {
+
+    /** hashes as bsonobj::ValueHasher, so equal objects under operator== (woCompare) --
+        which std::equal_to uses -- hash the same.  For containers keyed on the exact bytes
+        use bsonobj::Hasher and bsonobj::BinaryEqual.
+    */
+    template <> struct hash<_bson::bsonobj> : _bson::bsonobj::ValueHasher { };
+
+}
+
 #include "bson-inl.h"
@@ -18,6 +18,7 @@
 #include <map>
 #include <cmath>
 #include <limits>
+#include <vector>
 #include "bsontypes.h"
 #include "parse_number.h"
 #include "bsonelement.h"
@@ -43,6 +44,16 @@ namespace _bson {
         BufBuilder _buf;
         int _offset;
         bool _doneCalled;
+        hash64stream _hash;     // of [_offset + 4, _hashed) -- see hash64()
+        int _hashed;
+
+        struct IndexedField {
+            unsigned hash;
+            int offset;         // in _b.  0 for an empty slot
+        };
+        mutable std::vector<IndexedField> _fields;  // open addressed, by name -- see hasField()
+        mutable int _nIndexed;
+        mutable int _indexed;   // _fields has the fields in [_offset + 4, _indexed)
 
     public:
         char* _done() {
@@ -59,15 +70,17 @@ namespace _bson {
         }
 
         /** @param initsize this is just a hint as to the final size of the object */
-        bsonobjbuilder(int initsize = 512) : _b(_buf), _buf(initsize + sizeof(unsigned)), _offset(0),_doneCalled(false) {
+        bsonobjbuilder(int initsize = 512) : _b(_buf), _buf(initsize + sizeof(unsigned)), _offset(0),_doneCalled(false), _nIndexed(0), _indexed(0) {
             _b.skip(4); /*leave room for size field and ref-count*/
+            _hashed = _b.len();
         }
 
         /** @param baseBuilder construct a bsonobjbuilder using an existing BufBuilder
         *  This is for more efficient adding of subobjects/arrays. See docs for subobjStart for example.
         */
-        bsonobjbuilder(BufBuilder &baseBuilder) : _b(baseBuilder), _buf(0), _offset(baseBuilder.len()), _doneCalled(false) {
+        bsonobjbuilder(BufBuilder &baseBuilder) : _b(baseBuilder), _buf(0), _offset(baseBuilder.len()), _doneCalled(false), _nIndexed(0), _indexed(0) {
             _b.skip(4);
+            _hashed = _b.len();
         }
 
         ~bsonobjbuilder() {
@@ -82,6 +95,14 @@ namespace _bson {
         /** add all the fields from the object specified to this object if they don't exist already */
         bsonobjbuilder& appendElementsUnique(bsonobj x);
 
+        /** appends e if there's no field with its name yet.  @return true if it was appended */
+        bool appendUnique(const bsonelement& e);
+
+        /** appends e, or if there's a field with its name already, puts e in its place.  The
+            fields after it are moved if the size differs.  e mustn't point into this builder.
+        */
+        bsonobjbuilder& appendOrReplace(const bsonelement& e);
+
         /** append element to the object we are building */
         bsonobjbuilder& append(const bsonelement& e) {
             verify(!e.eoo()); // do not append eoo, that would corrupt us. the builder auto appends when done() is called.
@@ -486,6 +507,30 @@ namespace _bson {
             _doneCalled = true;
         }
 
+        /** @return bsonobj::hash64() of the object done() would return now.  Callable at
+            any point, before or after done().  Hashing is incremental: each call hashes only
+            what was appended since the last, so a document built a piece at a time can be
+            hashed as it goes, while the new bytes are still in cache, with no second pass
+            over it at the end.  Don't call it while a subobjStart() / subarrayStart()
+            builder is open on this one: the sub-object's size isn't filled in yet.
+        */
+        unsigned long long hash64() {
+            int start = _offset + 4;
+            if ( _hashed > _b.len() || _hashed < start ) {
+                // shrunk under us (asTempObj(), a reused buffer): start over
+                _hash = hash64stream();
+                _hashed = start;
+            }
+            _hash.update( _b.buf() + _hashed, _b.len() - _hashed );
+            _hashed = _b.len();
+            if ( _doneCalled )
+                return _hash.digest();
+            hash64stream h( _hash );
+            char eoo = EOO;
+            h.update( &eoo, 1 );
+            return h.digest();
+        }
+
         void appendKeys(const bsonobj& keyPattern, const bsonobj& values);
 
         static std::string  numStr(int i) {
@@ -505,6 +550,12 @@ namespace _bson {
 
         bsonobjiterator iterator() const;
 
+        /** @return true if a field called name has been appended.  Field names are kept in a
+            hash, made on the first call and brought up to date on each later one with just the
+            fields appended since -- so checking as a document is built is O(1) a check, not a
+            scan of what's there.  Nothing is allocated for a builder that never asks.  As with
+            hash64(), not while a subobjStart() / subarrayStart() builder is open on this one.
+        */
         bool hasField(const StringData& name) const;
 
         int len() const { return _b.len(); }
@@ -512,6 +563,9 @@ namespace _bson {
         BufBuilder& bb() { return _b; }
 
     private:
+        void indexFields() const;
+        int findField(const StringData& name) const;
+
         static const std::string numStrs[100]; // cache of 0 to 99 inclusive
         static bool numStrsReady; // for static init safety. see comments in db/jsobj.cpp
     };
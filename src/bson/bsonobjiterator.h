@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <cstddef>
+#include <iterator>
 #include "bsonobj.h"
 
 namespace _bson {
@@ -28,8 +30,7 @@ namespace _bson {
 
        The bsonobj must stay in scope for the duration of the iterator's execution.
 
-       todo: we may want to make a more stl-like iterator interface for this
-             with things like begin() and end()
+       See also bsonelemiterator for an stl-like interface with begin() and end().
     */
     class bsonobjiterator {
     public:
@@ -56,23 +57,50 @@ namespace _bson {
         /** @return true if more elements exist to be enumerated INCLUDING the EOO element which is always at the end. */
         bool moreWithEOO() { return _pos <= _theend; }
 
-        /** @return the next element in the object. For the final element, element.eoo() will be true. */
+        /** @return the next element in the object. For the final element, element.eoo() will be true. 
+            @param checkEnd if true the element is bounds checked against the end of the object,
+                   throwing MsgAssertionException if it is malformed.
+        */
         bsonelement next( bool checkEnd ) {
             verify( _pos <= _theend );
-            
-            int maxLen = -1;
-            if ( checkEnd ) {
-                maxLen = _theend + 1 - _pos;
-                verify( maxLen > 0 );
-            }
+            if ( !checkEnd )
+                return next();
 
-            bsonelement e( _pos, maxLen );
-            int esize = e.size( maxLen );
-            massert( 16446, "bsonelement has bad size", esize > 0 );
-            _pos += esize;
+            int fnSize;
+            int esize = iter::checkedElementSize( _pos, (int) ( _theend + 1 - _pos ), fnSize );
+            if ( esize < 0 )
+                iter::elementSizeError( esize, _pos );
 
+            bsonelement e( _pos );
+            e.fieldNameSize_ = fnSize;
+            e.totalSize = esize;
+            _pos += esize;
             return e;
         }
+        /** next( true ) without the exception: the next element, or a Status of
+            InvalidBSON if it runs past the end of the object.  Nothing is allocated on the
+            error path.  Example:
+
+            while( i.more() ) {
+                StatusWith<bsonelement> e = i.tryNext();
+                if ( !e.isOK() )
+                    return e.getStatus();
+                ...
+            }
+        */
+        StatusWith<bsonelement> tryNext() {
+            int fnSize;
+            int esize = iter::checkedElementSize( _pos, (int) ( _theend + 1 - _pos ), fnSize );
+            if ( esize < 0 )
+                return StatusWith<bsonelement>( Status::literal( InvalidBSON,
+                                                iter::elementSizeErrorString( esize ) ) );
+            bsonelement e( _pos );
+            e.fieldNameSize_ = fnSize;
+            e.totalSize = esize;
+            _pos += esize;
+            return StatusWith<bsonelement>( e );
+        }
+
         bsonelement next() {
             verify( _pos <= _theend );
             bsonelement e(_pos);
@@ -91,6 +119,103 @@ namespace _bson {
         const char* _pos;
         const char* _theend;
     };
+
+    /** stl style forward iterator for a bsonobj.  Obtain one with bsonobj::begin() / end(),
+        or bsonobj::checked() for the bounds checked variant.
+
+        The size of each element is computed exactly once, when the iterator arrives at it, and
+        is cached in the bsonelement handed out -- so e.size(), e.value() etc. on the
+        dereferenced element are free.  The EOO element is not visited.
+
+        Checked == true validates each element's size against the end of the object (see
+        iter::checkedElementSize()) and throws MsgAssertionException on malformed data.
+        Checked == false checks nothing and has no path that throws (see
+        iter::trustedElementSize()): for documents known to be well formed.  See also
+        bsonview, for the two as a compile time policy.
+
+        The bsonobj must stay in scope for the duration of the iterator's execution.
+    */
+    template <bool Checked>
+    class _bsonelemiterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef bsonelement value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const bsonelement* pointer;
+        typedef const bsonelement& reference;
+
+        _bsonelemiterator() : _pos(0), _theend(0) { }
+
+        /** @param pos first element
+            @param theend the object's terminating EOO
+        */
+        _bsonelemiterator(const char *pos, const char *theend) : _pos(pos), _theend(theend) {
+            load();
+        }
+
+        reference operator*() const { return _e; }
+        pointer operator->() const { return &_e; }
+
+        _bsonelemiterator& operator++() {
+            _pos += _e.totalSize;
+            load();
+            return *this;
+        }
+        _bsonelemiterator operator++(int) {
+            _bsonelemiterator old(*this);
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const _bsonelemiterator& r) const { return _pos == r._pos; }
+        bool operator!=(const _bsonelemiterator& r) const { return _pos != r._pos; }
+
+    private:
+        void load() {
+            if ( _pos >= _theend )
+                return;
+            if ( Checked )
+                loadChecked();
+            else {
+                _e = bsonelement(_pos);
+                _e.totalSize = iter::trustedElementSize( _pos, _e.fieldNameSize_ );
+            }
+        }
+
+        void loadChecked() {
+            massert( 10331, "EOO Before end of object", *_pos != EOO );
+            int fnSize;
+            int esize = iter::checkedElementSize( _pos, (int) ( _theend - _pos ), fnSize );
+            if ( esize < 0 )
+                iter::elementSizeError( esize, _pos );
+            _e = bsonelement( _pos );
+            _e.fieldNameSize_ = fnSize;
+            _e.totalSize = esize;
+        }
+
+        const char* _pos;
+        const char* _theend;
+        bsonelement _e;
+    };
+
+    inline bsonelemiterator bsonobj::begin() const {
+        return bsonelemiterator( objdata() + 4, objdata() + objsize() - 1 );
+    }
+
+    inline bsonelemiterator bsonobj::end() const {
+        const char *theend = objdata() + objsize() - 1;
+        return bsonelemiterator( theend, theend );
+    }
+
+    inline bsonobj::elemrange<checkedbsonelemiterator> bsonobj::checked() const {
+        const char *theend = objdata() + objsize() - 1;
+        elemrange<checkedbsonelemiterator> r = {
+            checkedbsonelemiterator( objdata() + 4, theend ),
+            checkedbsonelemiterator( theend, theend )
+        };
+        return r;
+    }
+
 #if 0
     /** Base class implementing ordered iteration through BSONElements. */
     class BSONIteratorSorted {
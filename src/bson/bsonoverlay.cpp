@@ -0,0 +1,361 @@
+// bsonoverlay.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cstring>
+#include "bsonoverlay.h"
+#include "bsonobjbuilder.h"
+
+namespace _bson {
+
+    namespace {
+        /** @return an element with an empty name: type, 0, value */
+        std::string makeValue(char type, const char *value, int len) {
+            std::string s( 2 + len, '\0' );
+            s[0] = type;
+            memcpy( &s[2], value, len );
+            return s;
+        }
+
+        std::string makeValue(const bsonelement& v) {
+            return makeValue( (char) v.type(), v.value(), v.valuesize() );
+        }
+
+        void checkName(const StringData& name) {
+            massert( 18113, "bsonoverlay: bad field name",
+                     !name.empty() && name.find( '.' ) == std::string::npos &&
+                     name.find( '\0' ) == std::string::npos );
+        }
+
+        bool isContainer(const char *e) {
+            return e[0] == Object || e[0] == Array;
+        }
+    }
+
+    bsonoverlay::bsonoverlay(const bsonobj& doc) : _root(new Node), _got(0) {
+        _root->obj = doc;
+    }
+
+    bsonoverlay::~bsonoverlay() { }
+
+    /** @return the first field in n.fields at or after the place for an edit of the original
+        element at offset: after fields that come earlier in the original and after fields
+        added before that element.
+    */
+    bsonoverlay::FieldIt bsonoverlay::slot(Node& n, int offset) {
+        FieldIt i = n.fields.begin();
+        while( i != n.fields.end() && ( i->offset < offset || ( i->offset == offset && i->added ) ) )
+            ++i;
+        return i;
+    }
+
+    /** @return the offset of the first original element called name, -1 if there's none */
+    int bsonoverlay::lookup(Node& n, const StringData& name) {
+        const char *base = n.obj.objdata();
+        size_t len = name.size();
+        // names first, of elements already walked over; then on from there
+        for( size_t i = 0; i < n.offsets.size(); i++ ) {
+            const char *fn = base + n.offsets[i] + 1;
+            if ( strncmp( fn, name.rawData(), len ) == 0 && fn[len] == 0 )
+                return n.offsets[i];
+        }
+        while( base[n.scanned] != EOO ) {
+            int off = n.scanned;
+            bsonelement e( base + off );
+            n.offsets.push_back( off );
+            n.scanned += e.size();
+            if ( e.fieldNameStringData() == name )
+                return off;
+        }
+        return -1;
+    }
+
+    /** finds the field now called name.  @return it if it's been edited or added; otherwise
+        n.fields.end(), with *offset set to the original element's offset, or -1 if there is
+        no field called name.
+    */
+    bsonoverlay::FieldIt bsonoverlay::find(Node& n, const StringData& name, int* offset) {
+        *offset = -1;
+        for( FieldIt i = n.fields.begin(); i != n.fields.end(); ++i ) {
+            if ( !i->removed && name == StringData( i->name ) )
+                return i;
+        }
+        int off = lookup( n, name );
+        // the original name only counts if the element hasn't been edited
+        if ( off >= 0 ) {
+            FieldIt i = slot( n, off );
+            if ( i == n.fields.end() || i->offset != off )
+                *offset = off;
+        }
+        return n.fields.end();
+    }
+
+    /** @return the edit of the original element at offset, made if there isn't one */
+    bsonoverlay::Field& bsonoverlay::edit(Node& n, int offset) {
+        FieldIt i = slot( n, offset );
+        if ( i != n.fields.end() && i->offset == offset )
+            return *i;
+        bsonelement e( n.obj.objdata() + offset );
+        i = n.fields.insert( i, Field() );
+        i->offset = offset;
+        i->size = e.size();
+        i->name = e.fieldName();
+        return *i;
+    }
+
+    bsonoverlay::Field& bsonoverlay::add(Node& n, const StringData& name, FieldIt pos, int offset) {
+        FieldIt i = n.fields.insert( pos, Field() );
+        i->offset = offset;
+        i->added = true;
+        i->name = name.toString();
+        return *i;
+    }
+
+    /** removes the field called name from n.  @return false if there was none */
+    bool bsonoverlay::remove(Node& n, const StringData& name) {
+        int off;
+        FieldIt i = find( n, name, &off );
+        if ( i == n.fields.end() ) {
+            if ( off < 0 )
+                return false;
+            edit( n, off ).removed = true;
+        }
+        else if ( i->added ) {
+            n.fields.erase( i );
+        }
+        else {
+            i->removed = true;
+            i->child.reset();
+            i->value.clear();
+        }
+        return true;
+    }
+
+    /** throws if n is an array and name isn't its next index: a new element has to keep the
+        indexes 0, 1, 2, ...  Called after find() has missed name, so every original element
+        has been walked and is in n.offsets.
+    */
+    void bsonoverlay::checkAppend(Node& n, const StringData& name) {
+        if ( !n.array )
+            return;
+        int count = (int) n.offsets.size();
+        for( FieldIt i = n.fields.begin(); i != n.fields.end(); ++i ) {
+            if ( i->added )
+                count++;
+        }
+        massert( 18121, "bsonoverlay: a new array element must be the next index",
+                 name == StringData( bsonobjbuilder::numStr( count ) ) );
+    }
+
+    /** @return the overlay of f's value, which must be an object or array */
+    bsonoverlay::Node * bsonoverlay::childOf(const Node& n, Field& f) {
+        if ( !f.child ) {
+            const char *e = f.element( n.obj );
+            f.child.reset( new Node );
+            f.child->obj = bsonobj( bsonelement( e ).value() );
+            f.child->array = e[0] == Array;
+        }
+        return f.child.get();
+    }
+
+    /** walks path to the node holding its last field, whose name goes in *leaf.
+        @param create make missing objects on the way, and throw where one isn't an object
+        @return 0 if !create and there's no such node
+    */
+    bsonoverlay::Node * bsonoverlay::parent(StringData path, bool create, StringData* leaf) {
+        Node *n = _root.get();
+        size_t dot;
+        while( ( dot = path.find( '.' ) ) != std::string::npos ) {
+            StringData name = path.substr( 0, dot );
+            path = path.substr( dot + 1 );
+            checkName( name );
+            int off;
+            FieldIt i = find( *n, name, &off );
+            Field *f;
+            if ( i != n->fields.end() ) {
+                f = &*i;
+            }
+            else if ( off >= 0 ) {
+                f = &edit( *n, off );
+            }
+            else {
+                if ( !create )
+                    return 0;
+                checkAppend( *n, name );
+                f = &add( *n, name, n->fields.end(), n->obj.objsize() - 1 );
+                f->value = makeValue( Object, bsonobj().objdata(), 5 );
+            }
+            if ( !isContainer( f->element( n->obj ) ) ) {
+                massert( 18111, "bsonoverlay: can't set a field inside a non-object", !create );
+                return 0;
+            }
+            n = childOf( *n, *f );
+        }
+        checkName( path );
+        *leaf = path;
+        return n;
+    }
+
+    void bsonoverlay::set(const StringData& path, const bsonelement& v) {
+        // copied first: v may be one of ours
+        std::string value = makeValue( v );
+        StringData name;
+        Node *n = parent( path, true, &name );
+        int off;
+        FieldIt i = find( *n, name, &off );
+        if ( i == n->fields.end() && off < 0 )
+            checkAppend( *n, name );
+        Field& f = i != n->fields.end() ? *i :
+                   off >= 0 ? edit( *n, off ) :
+                   add( *n, name, n->fields.end(), n->obj.objsize() - 1 );
+        f.child.reset();
+        f.value.swap( value );
+    }
+
+    void bsonoverlay::insert(const StringData& path, const bsonelement& v, const StringData& before) {
+        std::string value = makeValue( v );
+        StringData name;
+        Node *n = parent( path, true, &name );
+        int off;
+        massert( 18112, "bsonoverlay: insert of a field that exists",
+                 find( *n, name, &off ) == n->fields.end() && off < 0 );
+        checkAppend( *n, name );
+        massert( 18120, "bsonoverlay: can't insert, remove or rename an array element",
+                 !n->array || before.empty() );
+
+        FieldIt pos = n->fields.end();
+        off = n->obj.objsize() - 1;
+        if ( !before.empty() ) {
+            int beforeOff;
+            FieldIt i = find( *n, before, &beforeOff );
+            if ( i != n->fields.end() ) {
+                pos = i;
+                off = i->offset;
+            }
+            else if ( beforeOff >= 0 ) {
+                pos = slot( *n, beforeOff );
+                off = beforeOff;
+            }
+        }
+        add( *n, name, pos, off ).value.swap( value );
+    }
+
+    bool bsonoverlay::unset(const StringData& path) {
+        StringData name;
+        Node *n = parent( path, false, &name );
+        if ( n == 0 )
+            return false;
+        int off;
+        if ( find( *n, name, &off ) == n->fields.end() && off < 0 )
+            return false;
+        massert( 18120, "bsonoverlay: can't insert, remove or rename an array element", !n->array );
+        return remove( *n, name );
+    }
+
+    bool bsonoverlay::rename(const StringData& path, const StringData& newName) {
+        checkName( newName );
+        StringData name;
+        Node *n = parent( path, false, &name );
+        if ( n == 0 )
+            return false;
+        int off;
+        FieldIt i = find( *n, name, &off );
+        if ( i == n->fields.end() && off < 0 )
+            return false;
+        if ( name == newName )
+            return true;
+        massert( 18120, "bsonoverlay: can't insert, remove or rename an array element", !n->array );
+        remove( *n, newName );
+        Field& f = i != n->fields.end() ? *i : edit( *n, off );
+        f.name = newName.toString();
+        return true;
+    }
+
+    bsonelement bsonoverlay::getIn(Node& n, StringData path) const {
+        size_t dot = path.find( '.' );
+        StringData name = path.substr( 0, dot );
+        int off;
+        FieldIt i = find( n, name, &off );
+        if ( i == n.fields.end() ) {
+            if ( off < 0 )
+                return bsonelement();
+            bsonelement e( n.obj.objdata() + off );
+            if ( dot == std::string::npos )
+                return e;
+            return e.isObject() ? e.object().getFieldDotted( path.substr( dot + 1 ) ) : bsonelement();
+        }
+
+        if ( dot == std::string::npos ) {
+            if ( !i->child || i->child->fields.empty() )
+                return bsonelement( i->element( n.obj ) );
+            _got.reset();
+            _got.appendChar( i->element( n.obj )[0] );
+            _got.appendChar( 0 );
+            write( *i->child, _got );
+            return bsonelement( _got.buf() );
+        }
+        if ( i->child )
+            return getIn( *i->child, path.substr( dot + 1 ) );
+        bsonelement e( i->element( n.obj ) );
+        return e.isObject() ? e.object().getFieldDotted( path.substr( dot + 1 ) ) : bsonelement();
+    }
+
+    bsonelement bsonoverlay::get(const StringData& path) const {
+        return getIn( *_root, path );
+    }
+
+    /** writes n's elements: unedited runs of the original are copied whole */
+    void bsonoverlay::writeElements(const Node& n, BufBuilder& b) {
+        const char *base = n.obj.objdata();
+        int pos = 4;
+        for( std::list<Field>::const_iterator i = n.fields.begin(); i != n.fields.end(); ++i ) {
+            const Field& f = *i;
+            if ( f.offset > pos ) {
+                b.appendBuf( base + pos, f.offset - pos );
+                pos = f.offset;
+            }
+            if ( !f.added )
+                pos = f.offset + f.size;
+            if ( f.removed )
+                continue;
+            bsonelement e( f.element( n.obj ) );
+            b.appendChar( (char) e.type() );
+            b.appendStr( f.name );
+            if ( f.child && !f.child->fields.empty() )
+                write( *f.child, b );
+            else
+                b.appendBuf( e.value(), e.valuesize() );
+        }
+        b.appendBuf( base + pos, n.obj.objsize() - 1 - pos );
+    }
+
+    /** writes n as an object: size, elements, EOO */
+    void bsonoverlay::write(const Node& n, BufBuilder& b) {
+        int start = b.len();
+        b.skip( 4 );
+        writeElements( n, b );
+        b.appendChar( EOO );
+        *( (int*) ( b.buf() + start ) ) = endian_int( b.len() - start );
+    }
+
+    void bsonoverlay::appendElements(bsonobjbuilder& b) const {
+        writeElements( *_root, b.bb() );
+    }
+
+    bsonobj bsonoverlay::obj(bsonobjbuilder& b) const {
+        appendElements( b );
+        return b.obj();
+    }
+
+}
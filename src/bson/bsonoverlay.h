@@ -0,0 +1,146 @@
+// bsonoverlay.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include "bsonobj.h"
+
+namespace _bson {
+
+    class bsonobjbuilder;
+
+    /** A mutable view of a bsonobj: edits are recorded on top of the original, which is
+        not touched or copied, and applied when the document is written out.
+
+        Each edited field is found once, when it is edited, and remembered by its offset in
+        the original.  Writing the result copies everything between edited fields with one
+        memcpy per run, so changing a few fields of a large document costs about one copy of
+        it -- not a walk of every element through bsonobjbuilder.  Edits inside embedded
+        objects are overlays of their own, nested the same way.  The offsets of elements
+        passed over looking for a field are kept, so a batch of edits walks each object at
+        most once.  With duplicate field names, the first is the one edited.
+
+        Paths are dotted, "a.b.c"; array elements are named by index, "tags.2".  Arrays keep
+        their indexes 0, 1, 2, ... as written out -- renumbering would mean walking each
+        edited array rather than copying it in runs -- so in an array unset() and rename()
+        throw, and a new element can only be added at the end, as the next index.
+
+        example:
+          bsonoverlay o( doc );
+          o.set( "stats.count", n );        // n a bsonelement
+          o.unset( "tmp" );
+          o.rename( "nm", "name" );
+          bsonobjbuilder b;
+          bsonobj updated = o.obj( b );
+
+        doc must stay valid, and unchanged, while the overlay is in use.  Values passed in
+        are copied.
+    */
+    class bsonoverlay {
+    public:
+        explicit bsonoverlay(const bsonobj& doc);
+        ~bsonoverlay();
+
+        /** sets the field at path to v's value (v's name is ignored).  An existing field keeps
+            its place; a new one goes at the end of its parent.  Missing parents are made, as
+            empty objects.  Throws if something on the path isn't an object or array.
+        */
+        void set(const StringData& path, const bsonelement& v);
+
+        /** adds a new field at path, before the field named before in the same parent, or at
+            the end if before is empty or not there.  Throws if the field exists.  In an array
+            the field must be the next index, and before empty.
+        */
+        void insert(const StringData& path, const bsonelement& v,
+                    const StringData& before = StringData(""));
+
+        /** removes the field at path.  Throws if it's an array element.
+            @return false if there was none
+        */
+        bool unset(const StringData& path);
+
+        /** renames the field at path to newName, in place.  A field already called newName
+            is removed.  Throws if the field is an array element.
+            @return false if there was no field at path
+        */
+        bool rename(const StringData& path, const StringData& newName);
+
+        /** @return the field at path as it stands, eoo() if there is none.  Use its value
+            only: its field name may be out of date.  Valid until the next edit.
+        */
+        bsonelement get(const StringData& path) const;
+
+        /** appends the elements of the edited document to b */
+        void appendElements(bsonobjbuilder& b) const;
+
+        /** @return the edited document, built in b */
+        bsonobj obj(bsonobjbuilder& b) const;
+
+    private:
+        bsonoverlay(const bsonoverlay&);
+        bsonoverlay& operator=(const bsonoverlay&);
+
+        struct Node;
+
+        /** an edited field, or a new one */
+        struct Field {
+            int offset;                 // of the original element; for a new field, of the
+                                        // element it goes before (the EOO for the end)
+            int size;                   // of the original element; 0 for a new field
+            bool added;
+            bool removed;
+            std::string name;           // current name
+            std::string value;          // replacement: type, empty name, value; or empty
+            std::unique_ptr<Node> child;    // edits inside the value, if it's an object
+            Field() : offset(0), size(0), added(false), removed(false) { }
+            /** @return the element holding the value, original or replacement */
+            const char * element(const bsonobj& base) const {
+                return value.empty() ? base.objdata() + offset : value.data();
+            }
+        };
+
+        struct Node {
+            bsonobj obj;                // the original, or a replacement's value
+            std::list<Field> fields;    // in output order; list, as children point into them
+            std::vector<int> offsets;   // of obj's elements, as far as looked for one
+            int scanned;                // offset of the first element not in offsets
+            bool array;                 // obj is an array's value
+            Node() : scanned(4), array(false) { }
+        };
+
+        typedef std::list<Field>::iterator FieldIt;
+
+        static FieldIt find(Node& n, const StringData& name, int* offset);
+        static FieldIt slot(Node& n, int offset);
+        static int lookup(Node& n, const StringData& name);
+        static Field& edit(Node& n, int offset);
+        static Field& add(Node& n, const StringData& name, FieldIt pos, int offset);
+        static bool remove(Node& n, const StringData& name);
+        static void checkAppend(Node& n, const StringData& name);
+        static Node * childOf(const Node& n, Field& f);
+        Node * parent(StringData path, bool create, StringData* leaf);
+        bsonelement getIn(Node& n, StringData path) const;
+        static void write(const Node& n, BufBuilder& b);
+        static void writeElements(const Node& n, BufBuilder& b);
+
+        std::unique_ptr<Node> _root;
+        mutable BufBuilder _got;    // get()'s result, when it has to be built
+    };
+
+}
@@ -0,0 +1,331 @@
+// bsonupdate.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include "bsonupdate.h"
+#include "bsonobjbuilder.h"
+#include "bsonobjiterator.h"
+
+namespace _bson {
+
+    namespace {
+        void badUpdate(const std::string& msg) {
+            msgasserted( 18114, "bsonupdate: " + msg );
+        }
+
+        void cantApply(const std::string& msg) {
+            msgasserted( 18116, "bsonupdate: " + msg );
+        }
+
+        /** appends e's value named name */
+        void appendAs(BufBuilder& b, const bsonelement& e, const StringData& name) {
+            b.appendChar( (char) e.type() );
+            b.appendStr( name );
+            b.appendBuf( e.value(), e.valuesize() );
+        }
+
+        void appendInc(BufBuilder& b, const StringData& name, const bsonelement& x,
+                       const bsonelement& by) {
+            if ( x.type() == NumberDouble || by.type() == NumberDouble ) {
+                b.appendChar( (char) NumberDouble );
+                b.appendStr( name );
+                b.appendNum( x.numberDouble() + by.numberDouble() );
+                return;
+            }
+            long long l = x.numberLong(), r = by.numberLong();
+            if ( ( r > 0 && l > LLONG_MAX - r ) || ( r < 0 && l < LLONG_MIN - r ) )
+                cantApply( "$inc of " + name.toString() + " overflows" );
+            long long sum = l + r;
+            if ( x.type() == NumberInt && by.type() == NumberInt && sum >= INT_MIN && sum <= INT_MAX ) {
+                b.appendChar( (char) NumberInt );
+                b.appendStr( name );
+                b.appendNum( (int) sum );
+            }
+            else {
+                b.appendChar( (char) NumberLong );
+                b.appendStr( name );
+                b.appendNum( sum );
+            }
+        }
+
+        /** appends the values of arr, or v if each is false, numbered from n */
+        void appendPushed(BufBuilder& b, const bsonelement& v, bool each, int n) {
+            if ( !each ) {
+                appendAs( b, v, bsonobjbuilder::numStr( n ) );
+                return;
+            }
+            bsonobj arr = v.object();
+            for( bsonelemiterator i = arr.begin(); i != arr.end(); ++i )
+                appendAs( b, *i, bsonobjbuilder::numStr( n++ ) );
+        }
+    }
+
+    bsonupdate::bsonupdate(const bsonobj& update) :
+        _updateData( update.objdata(), update.objsize() ), _update( _updateData.data() ) {
+        for( bsonelemiterator i = _update.begin(); i != _update.end(); ++i ) {
+            const bsonelement& opElem = *i;
+            StringData opName = opElem.fieldNameStringData();
+            Op op = opName == "$set" ? Set :
+                    opName == "$unset" ? Unset :
+                    opName == "$inc" ? Inc :
+                    opName == "$min" ? Min :
+                    opName == "$max" ? Max :
+                    opName == "$push" ? Push :
+                    opName == "$rename" ? RenameFrom : None;
+            if ( op == None )
+                badUpdate( "unknown operator " + opName.toString() );
+            if ( opElem.type() != Object )
+                badUpdate( opName.toString() + " needs an object" );
+
+            bsonobj args = opElem.object();
+            for( bsonelemiterator j = args.begin(); j != args.end(); ++j ) {
+                const bsonelement& arg = *j;
+                StringData path = arg.fieldNameStringData();
+                if ( op == Inc && !arg.isNumber() )
+                    badUpdate( "$inc of " + path.toString() + " by a non-number" );
+                if ( op == RenameFrom ) {
+                    if ( arg.type() != String )
+                        badUpdate( "$rename of " + path.toString() + " to a non-string" );
+                    int r = (int) _renames.size();
+                    _renames.push_back( path.toString() );
+                    add( path, RenameFrom, arg, r );
+                    add( StringData( arg.valuestr(), arg.valuestrsize() - 1 ), RenameTo, arg, r );
+                    continue;
+                }
+                add( path, op, arg, -1 );
+            }
+        }
+    }
+
+    void bsonupdate::add(const StringData& path, Op op, const bsonelement& arg, int rename) {
+        Node *n = &_root;
+        StringData rest = path;
+        while( 1 ) {
+            size_t dot = rest.find( '.' );
+            StringData name = rest.substr( 0, dot );
+            if ( name.empty() )
+                badUpdate( "empty field name in " + path.toString() );
+            if ( n->op != None )
+                msgasserted( 18115, "bsonupdate: conflicting updates of " + path.toString() );
+
+            std::vector<Node>::iterator i = n->children.begin();
+            while( i != n->children.end() && StringData( i->name ) < name )
+                ++i;
+            if ( i == n->children.end() || StringData( i->name ) != name ) {
+                i = n->children.insert( i, Node() );
+                i->name = name.toString();
+            }
+            n = &*i;
+            if ( dot == std::string::npos )
+                break;
+            rest = rest.substr( dot + 1 );
+        }
+        if ( n->op != None || !n->children.empty() )
+            msgasserted( 18115, "bsonupdate: conflicting updates of " + path.toString() );
+
+        n->op = op;
+        n->arg = arg;
+        n->rename = rename;
+        if ( op == Push && arg.type() == Object ) {
+            bsonelement e = arg.object().firstElement();
+            if ( e.fieldNameStringData() == "$each" ) {
+                if ( e.type() != Array )
+                    badUpdate( "$each needs an array" );
+                n->arg = e;
+                n->each = true;
+            }
+        }
+    }
+
+    /** @return true if n, with no field to start from, makes anything */
+    bool bsonupdate::makes(const Node& n, const bsonelement* sources) const {
+        switch( n.op ) {
+        case None:
+            for( size_t i = 0; i < n.children.size(); i++ )
+                if ( makes( n.children[i], sources ) )
+                    return true;
+            return false;
+        case Unset:
+        case RenameFrom:
+            return false;
+        case RenameTo:
+            return !sources[n.rename].eoo();
+        default:
+            return true;
+        }
+    }
+
+    /** appends the field for c, given the field e it updates, 0 if there is none */
+    void bsonupdate::applyOne(const Node& c, const bsonelement* e, const bsonelement* sources,
+                              BufBuilder& b) const {
+        StringData name( c.name );
+        switch( c.op ) {
+        case None:
+            if ( e && e->isObject() ) {
+                b.appendChar( (char) e->type() );
+                b.appendStr( name );
+                applyObject( e->object(), e->type() == Array, c, sources, b );
+            }
+            else if ( makes( c, sources ) ) {
+                if ( e )
+                    cantApply( "can't make a field inside " + c.name + ", which isn't an object" );
+                b.appendChar( (char) Object );
+                b.appendStr( name );
+                applyObject( bsonobj(), false, c, sources, b );
+            }
+            else if ( e ) {
+                b.appendBuf( e->rawdata(), e->size() );
+            }
+            break;
+        case Set:
+            appendAs( b, c.arg, name );
+            break;
+        case Unset:
+        case RenameFrom:
+            break;
+        case RenameTo: {
+            const bsonelement& source = sources[c.rename];
+            if ( !source.eoo() )
+                appendAs( b, source, name );
+            else if ( e )
+                b.appendBuf( e->rawdata(), e->size() );
+            break;
+        }
+        case Inc:
+            if ( !e )
+                appendAs( b, c.arg, name );
+            else if ( e->isNumber() )
+                appendInc( b, name, *e, c.arg );
+            else
+                cantApply( "$inc of " + c.name + ", which isn't a number" );
+            break;
+        case Min:
+        case Max: {
+            int x = e ? c.arg.woCompare( *e, false ) : 0;
+            if ( !e || ( c.op == Min ? x < 0 : x > 0 ) )
+                appendAs( b, c.arg, name );
+            else
+                b.appendBuf( e->rawdata(), e->size() );
+            break;
+        }
+        case Push: {
+            if ( e && e->type() != Array )
+                cantApply( "$push to " + c.name + ", which isn't an array" );
+            b.appendChar( (char) Array );
+            b.appendStr( name );
+            int start = b.len();
+            b.skip( 4 );
+            int n = 0;
+            if ( e ) {
+                bsonobj arr = e->object();
+                for( bsonelemiterator i = arr.begin(); i != arr.end(); ++i )
+                    n++;
+                b.appendBuf( arr.objdata() + 4, arr.objsize() - 5 );
+            }
+            appendPushed( b, c.arg, c.each, n );
+            b.appendChar( EOO );
+            *( (int*) ( b.buf() + start ) ) = endian_int( b.len() - start );
+            break;
+        }
+        }
+    }
+
+    /** appends the elements of in, updated by n's children */
+    void bsonupdate::applyIn(const bsonobj& in, bool isArray, const Node& n,
+                             const bsonelement* sources, BufBuilder& b) const {
+        const std::vector<Node>& children = n.children;
+        size_t nc = children.size();
+        char smallDone[32];
+        std::vector<char> bigDone;
+        char *done = smallDone;
+        if ( nc > sizeof(smallDone) ) {
+            bigDone.resize( nc );
+            done = &bigDone[0];
+        }
+        memset( done, 0, nc );
+
+        const char *run = in.objdata() + 4;     // untouched fields not yet copied
+        size_t left = nc;
+        const char *p = run;
+        while( *p != EOO && left ) {
+            bsonelement e( p );
+            StringData name = e.fieldNameStringData();
+            size_t c = 0;
+            if ( nc <= 4 ) {
+                while( c < nc && StringData( children[c].name ) != name )
+                    c++;
+            }
+            else {
+                size_t lo = 0, hi = nc;
+                while( lo < hi ) {
+                    size_t mid = ( lo + hi ) / 2;
+                    if ( StringData( children[mid].name ) < name )
+                        lo = mid + 1;
+                    else
+                        hi = mid;
+                }
+                c = lo < nc && StringData( children[lo].name ) == name ? lo : nc;
+            }
+            int size = e.size();
+            if ( c < nc && !done[c] ) {
+                done[c] = 1;
+                left--;
+                b.appendBuf( run, p - run );
+                applyOne( children[c], &e, sources, b );
+                run = p + size;
+            }
+            p += size;
+        }
+        // the rest is copied whole
+        const char *end = in.objdata() + in.objsize() - 1;
+        b.appendBuf( run, end - run );
+
+        for( size_t c = 0; c < nc; c++ ) {
+            if ( done[c] )
+                continue;
+            if ( isArray && makes( children[c], sources ) )
+                cantApply( "can't add field " + children[c].name + " to an array" );
+            applyOne( children[c], 0, sources, b );
+        }
+    }
+
+    void bsonupdate::applyObject(const bsonobj& in, bool isArray, const Node& n,
+                                 const bsonelement* sources, BufBuilder& b) const {
+        int start = b.len();
+        b.skip( 4 );
+        applyIn( in, isArray, n, sources, b );
+        b.appendChar( EOO );
+        *( (int*) ( b.buf() + start ) ) = endian_int( b.len() - start );
+    }
+
+    bsonobj bsonupdate::apply(const bsonobj& doc, bsonobjbuilder& b) const {
+        // $rename's values, found first, as they may be after where they go
+        bsonelement smallSources[8];
+        std::vector<bsonelement> bigSources;
+        bsonelement *sources = smallSources;
+        if ( _renames.size() > 8 ) {
+            bigSources.resize( _renames.size() );
+            sources = &bigSources[0];
+        }
+        for( size_t i = 0; i < _renames.size(); i++ )
+            sources[i] = doc.getFieldDotted( _renames[i] );
+
+        applyIn( doc, false, _root, sources, b.bb() );
+        return b.obj();
+    }
+
+}
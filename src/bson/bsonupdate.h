@@ -0,0 +1,100 @@
+// bsonupdate.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "bsonobj.h"
+
+namespace _bson {
+
+    class bsonobjbuilder;
+
+    /** A MongoDB style update -- { $set : { "a.b" : 1 }, $inc : { n : 1 } } -- compiled once
+        and applied to any number of documents.
+
+        Operators:
+          $set    : { path : value }
+          $unset  : { path : anything }
+          $inc    : { path : number }       int, long or double; int + int that overflows
+                                            is a long
+          $min    : { path : value }        set if value is less than the field (by
+                                            woCompare) or there is no field; $max likewise
+          $max    : { path : value }
+          $push   : { path : value }        appends to an array, made if there is none
+                    { path : { $each : [ values ] } }
+          $rename : { path : "new.path" }
+
+        The update is compiled into a tree of field names, so a document is updated in one
+        pass: fields the update doesn't touch are copied to the output in runs, a memcpy per
+        run, and embedded objects are only walked into if there's an update inside them.
+        Fields that are new go at the end of their object, in name order.  Paths that don't
+        exist are made, as objects.
+
+        example:
+          bsonupdate u( fromjson( "{ $inc : { n : 1 }, $set : { 'st.ok' : true } }" ) );
+          ...
+          bsonobjbuilder b( doc.objsize() + 64 );
+          bsonobj updated = u.apply( doc, b );
+
+        The constructor throws for an unknown operator, a bad argument, or two operators on
+        the same field (or on a field and one inside it).  apply() throws if the update
+        doesn't fit the document: a field to be made inside a field that isn't an object,
+        $inc of something not a number, or $push to something not an array.
+
+        apply() may be called from several threads at once.  A bsonupdate can't be copied:
+        the compiled tree points into its own copy of the update.  Hold it by pointer to
+        share it or keep it in a container.
+    */
+    class bsonupdate {
+    public:
+        explicit bsonupdate(const bsonobj& update);
+
+        /** builds doc with the update applied into b.  @return b.obj() */
+        bsonobj apply(const bsonobj& doc, bsonobjbuilder& b) const;
+
+    private:
+        bsonupdate(const bsonupdate&);
+        void operator=(const bsonupdate&);
+
+        enum Op { None, Set, Unset, Inc, Min, Max, Push, RenameFrom, RenameTo };
+
+        struct Node {
+            std::string name;
+            Op op;
+            bsonelement arg;            // in _update.  for $push with $each, the array
+            bool each;
+            int rename;                 // RenameFrom / RenameTo: index in _renames
+            std::vector<Node> children; // by name
+            Node() : op(None), each(false), rename(-1) { }
+        };
+
+        void add(const StringData& path, Op op, const bsonelement& arg, int rename);
+        bool makes(const Node& n, const bsonelement* sources) const;
+        void applyIn(const bsonobj& in, bool isArray, const Node& n, const bsonelement* sources,
+                     BufBuilder& b) const;
+        void applyObject(const bsonobj& in, bool isArray, const Node& n, const bsonelement* sources,
+                         BufBuilder& b) const;
+        void applyOne(const Node& c, const bsonelement* e, const bsonelement* sources,
+                      BufBuilder& b) const;
+
+        std::string _updateData;
+        bsonobj _update;
+        Node _root;
+        std::vector<std::string> _renames;     // $rename sources
+    };
+
+}
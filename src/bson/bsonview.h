@@ -0,0 +1,163 @@
+// bsonview.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <cstring>
+#include "bsonobj.h"
+#include "bsonobjiterator.h"
+#include "bson_validate.h"
+#include "status_with.h"
+
+namespace _bson {
+
+    /** access policies for bsonview */
+
+    /** bounds check every element against the end of its document, throwing
+        MsgAssertionException if one runs past it.  For data from outside.
+    */
+    struct checkedaccess { enum { checked = 1 }; };
+
+    /** check nothing: no bounds tests and no path that throws.  For documents known to be
+        well formed -- built by bsonobjbuilder, or passed by validateBSON().
+    */
+    struct trustedaccess { enum { checked = 0 }; };
+
+    /** A read only view of a BSON document, with how much element access checks chosen at
+        compile time by Access (checkedaccess or trustedaccess).  Like bsonobj it points at
+        the data and owns nothing; the data must stay in scope while the view is used.
+
+        With trustedaccess iteration and getField() inline to table lookups and strlen, with
+        nothing left of the checks -- use trustedView() to get one for data from outside, it
+        validates once up front.  With checkedaccess each element is sized by
+        iter::checkedElementSize() before it's looked at.
+
+        example:
+          StatusWith<trustedbsonview> v = trustedView( data, len );
+          if ( !v.isOK() )
+              return v.getStatus();
+          for( bsonelement e : v.getValue() )
+              ...
+    */
+    template <class Access>
+    class bsonview {
+    public:
+        typedef _bsonelemiterator<Access::checked != 0> iterator;
+
+        /** {} */
+        bsonview() : _data(emptyDoc()) { }
+
+        /** @param len the bytes available at data.  With checkedaccess the document's size
+            is checked against it (massert 18118); with trustedaccess it isn't used.
+        */
+        bsonview(const char *data, size_t len) : _data(data) {
+            if ( Access::checked ) {
+                massert( 18118, "bsonview: bad document size",
+                         len >= 5 && readInt( data ) >= 5 && (size_t) readInt( data ) <= len &&
+                         data[readInt( data ) - 1] == EOO );
+            }
+        }
+
+        explicit bsonview(const bsonobj& o) : _data(o.objdata()) { }
+
+        const char* objdata() const { return _data; }
+        int objsize() const { return readInt( _data ); }
+        bool isEmpty() const { return objsize() <= 5; }
+
+        /** a bsonobj over the same data */
+        bsonobj obj() const { return bsonobj( _data ); }
+
+        iterator begin() const { return iterator( _data + 4, _data + objsize() - 1 ); }
+        iterator end() const {
+            const char *theend = _data + objsize() - 1;
+            return iterator( theend, theend );
+        }
+
+        /** @return the first field named name, or EOO if there isn't one */
+        bsonelement getField(const StringData& name) const {
+            const char *p = _data + 4;
+            const char *theend = _data + objsize() - 1;
+            int want = (int) name.size() + 1;
+            while( p < theend ) {
+                int fnSize = 0;
+                int esize;
+                if ( Access::checked ) {
+                    esize = iter::checkedElementSize( p, (int) ( theend - p ), fnSize );
+                    if ( esize < 0 )
+                        iter::elementSizeError( esize, p );
+                }
+                else {
+                    esize = iter::trustedElementSize( p, fnSize );
+                }
+                if ( fnSize == want && ( want == 1 || p[1] == name.rawData()[0] ) &&
+                     memcmp( p + 1, name.rawData(), want - 1 ) == 0 ) {
+                    bsonelement e( p );
+                    e.fieldNameSize_ = fnSize;
+                    e.totalSize = esize;
+                    return e;
+                }
+                p += esize;
+            }
+            return bsonelement();
+        }
+
+        bsonelement operator[](const StringData& name) const { return getField( name ); }
+
+        bool hasField(const StringData& name) const { return !getField( name ).eoo(); }
+
+        int nFields() const {
+            int n = 0;
+            for( iterator i = begin(); i != end(); ++i )
+                n++;
+            return n;
+        }
+
+        /** the embedded document or array in e, with the same policy.  With checkedaccess
+            e must be an Object or Array of at least 5 bytes, ending in EOO (massert 18119);
+            that it fits in its parent was checked when e was.
+        */
+        bsonview object(const bsonelement& e) const {
+            const char *v = e.value();
+            if ( Access::checked ) {
+                massert( 18119, "bsonview: not an embedded document",
+                         ( e.type() == Object || e.type() == Array ) &&
+                         readInt( v ) >= 5 && v[readInt( v ) - 1] == EOO );
+            }
+            bsonview d;
+            d._data = v;
+            return d;
+        }
+
+    private:
+        static const char* emptyDoc() { return "\x05\0\0\0\0"; }
+
+        const char *_data;
+    };
+
+    typedef bsonview<checkedaccess> checkedbsonview;
+    typedef bsonview<trustedaccess> trustedbsonview;
+
+    /** validates [data, data+len) with validateBSON() and, if it's good, returns a
+        trustedbsonview of it.  ValidateStructure is all the view needs to be safe.
+    */
+    inline StatusWith<trustedbsonview> trustedView(const char *data, size_t len,
+                                                   BSONValidateLevel level = ValidateStructure) {
+        Status s = validateBSON( data, len, level );
+        if ( !s.isOK() )
+            return StatusWith<trustedbsonview>( s );
+        return StatusWith<trustedbsonview>( trustedbsonview( data, len ) );
+    }
+
+}
@@ -0,0 +1,435 @@
+// digest.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cstring>
+#include "digest.h"
+#include "hex.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BSON_SHA_NI 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SHA_NI_TARGET
+#else
+#include <cpuid.h>
+#define SHA_NI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
+namespace _bson {
+
+    namespace {
+
+        inline unsigned loadLE32(const unsigned char *p) {
+            return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (unsigned) p[3] << 24 );
+        }
+
+        inline unsigned loadBE32(const unsigned char *p) {
+            return ( (unsigned) p[0] << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3];
+        }
+
+        inline void storeLE32(unsigned char *p, unsigned x) {
+            p[0] = (unsigned char) x;
+            p[1] = (unsigned char) ( x >> 8 );
+            p[2] = (unsigned char) ( x >> 16 );
+            p[3] = (unsigned char) ( x >> 24 );
+        }
+
+        inline void storeBE32(unsigned char *p, unsigned x) {
+            p[0] = (unsigned char) ( x >> 24 );
+            p[1] = (unsigned char) ( x >> 16 );
+            p[2] = (unsigned char) ( x >> 8 );
+            p[3] = (unsigned char) x;
+        }
+
+        inline unsigned rotr(unsigned x, int n) { return ( x >> n ) | ( x << ( 32 - n ) ); }
+
+        /* MD5 (RFC 1321) */
+
+#define MD5_F(x, y, z) ( (z) ^ ( (x) & ( (y) ^ (z) ) ) )
+#define MD5_G(x, y, z) ( (y) ^ ( (z) & ( (x) ^ (y) ) ) )
+#define MD5_H(x, y, z) ( (x) ^ (y) ^ (z) )
+#define MD5_I(x, y, z) ( (y) ^ ( (x) | ~(z) ) )
+#define MD5_STEP(f, a, b, c, d, x, t, s) \
+        (a) += f( (b), (c), (d) ) + (x) + (t); \
+        (a) = ( ( (a) << (s) ) | ( (a) >> ( 32 - (s) ) ) ) + (b)
+
+        void md5Blocks(unsigned state[4], const unsigned char *p, size_t nBlocks) {
+            unsigned a = state[0], b = state[1], c = state[2], d = state[3];
+            for( ; nBlocks; nBlocks--, p += 64 ) {
+                unsigned x[16];
+                for( int i = 0; i < 16; i++ )
+                    x[i] = loadLE32( p + 4 * i );
+                unsigned aa = a, bb = b, cc = c, dd = d;
+
+                MD5_STEP( MD5_F, a, b, c, d, x[ 0], 0xd76aa478,  7 );
+                MD5_STEP( MD5_F, d, a, b, c, x[ 1], 0xe8c7b756, 12 );
+                MD5_STEP( MD5_F, c, d, a, b, x[ 2], 0x242070db, 17 );
+                MD5_STEP( MD5_F, b, c, d, a, x[ 3], 0xc1bdceee, 22 );
+                MD5_STEP( MD5_F, a, b, c, d, x[ 4], 0xf57c0faf,  7 );
+                MD5_STEP( MD5_F, d, a, b, c, x[ 5], 0x4787c62a, 12 );
+                MD5_STEP( MD5_F, c, d, a, b, x[ 6], 0xa8304613, 17 );
+                MD5_STEP( MD5_F, b, c, d, a, x[ 7], 0xfd469501, 22 );
+                MD5_STEP( MD5_F, a, b, c, d, x[ 8], 0x698098d8,  7 );
+                MD5_STEP( MD5_F, d, a, b, c, x[ 9], 0x8b44f7af, 12 );
+                MD5_STEP( MD5_F, c, d, a, b, x[10], 0xffff5bb1, 17 );
+                MD5_STEP( MD5_F, b, c, d, a, x[11], 0x895cd7be, 22 );
+                MD5_STEP( MD5_F, a, b, c, d, x[12], 0x6b901122,  7 );
+                MD5_STEP( MD5_F, d, a, b, c, x[13], 0xfd987193, 12 );
+                MD5_STEP( MD5_F, c, d, a, b, x[14], 0xa679438e, 17 );
+                MD5_STEP( MD5_F, b, c, d, a, x[15], 0x49b40821, 22 );
+
+                MD5_STEP( MD5_G, a, b, c, d, x[ 1], 0xf61e2562,  5 );
+                MD5_STEP( MD5_G, d, a, b, c, x[ 6], 0xc040b340,  9 );
+                MD5_STEP( MD5_G, c, d, a, b, x[11], 0x265e5a51, 14 );
+                MD5_STEP( MD5_G, b, c, d, a, x[ 0], 0xe9b6c7aa, 20 );
+                MD5_STEP( MD5_G, a, b, c, d, x[ 5], 0xd62f105d,  5 );
+                MD5_STEP( MD5_G, d, a, b, c, x[10], 0x02441453,  9 );
+                MD5_STEP( MD5_G, c, d, a, b, x[15], 0xd8a1e681, 14 );
+                MD5_STEP( MD5_G, b, c, d, a, x[ 4], 0xe7d3fbc8, 20 );
+                MD5_STEP( MD5_G, a, b, c, d, x[ 9], 0x21e1cde6,  5 );
+                MD5_STEP( MD5_G, d, a, b, c, x[14], 0xc33707d6,  9 );
+                MD5_STEP( MD5_G, c, d, a, b, x[ 3], 0xf4d50d87, 14 );
+                MD5_STEP( MD5_G, b, c, d, a, x[ 8], 0x455a14ed, 20 );
+                MD5_STEP( MD5_G, a, b, c, d, x[13], 0xa9e3e905,  5 );
+                MD5_STEP( MD5_G, d, a, b, c, x[ 2], 0xfcefa3f8,  9 );
+                MD5_STEP( MD5_G, c, d, a, b, x[ 7], 0x676f02d9, 14 );
+                MD5_STEP( MD5_G, b, c, d, a, x[12], 0x8d2a4c8a, 20 );
+
+                MD5_STEP( MD5_H, a, b, c, d, x[ 5], 0xfffa3942,  4 );
+                MD5_STEP( MD5_H, d, a, b, c, x[ 8], 0x8771f681, 11 );
+                MD5_STEP( MD5_H, c, d, a, b, x[11], 0x6d9d6122, 16 );
+                MD5_STEP( MD5_H, b, c, d, a, x[14], 0xfde5380c, 23 );
+                MD5_STEP( MD5_H, a, b, c, d, x[ 1], 0xa4beea44,  4 );
+                MD5_STEP( MD5_H, d, a, b, c, x[ 4], 0x4bdecfa9, 11 );
+                MD5_STEP( MD5_H, c, d, a, b, x[ 7], 0xf6bb4b60, 16 );
+                MD5_STEP( MD5_H, b, c, d, a, x[10], 0xbebfbc70, 23 );
+                MD5_STEP( MD5_H, a, b, c, d, x[13], 0x289b7ec6,  4 );
+                MD5_STEP( MD5_H, d, a, b, c, x[ 0], 0xeaa127fa, 11 );
+                MD5_STEP( MD5_H, c, d, a, b, x[ 3], 0xd4ef3085, 16 );
+                MD5_STEP( MD5_H, b, c, d, a, x[ 6], 0x04881d05, 23 );
+                MD5_STEP( MD5_H, a, b, c, d, x[ 9], 0xd9d4d039,  4 );
+                MD5_STEP( MD5_H, d, a, b, c, x[12], 0xe6db99e5, 11 );
+                MD5_STEP( MD5_H, c, d, a, b, x[15], 0x1fa27cf8, 16 );
+                MD5_STEP( MD5_H, b, c, d, a, x[ 2], 0xc4ac5665, 23 );
+
+                MD5_STEP( MD5_I, a, b, c, d, x[ 0], 0xf4292244,  6 );
+                MD5_STEP( MD5_I, d, a, b, c, x[ 7], 0x432aff97, 10 );
+                MD5_STEP( MD5_I, c, d, a, b, x[14], 0xab9423a7, 15 );
+                MD5_STEP( MD5_I, b, c, d, a, x[ 5], 0xfc93a039, 21 );
+                MD5_STEP( MD5_I, a, b, c, d, x[12], 0x655b59c3,  6 );
+                MD5_STEP( MD5_I, d, a, b, c, x[ 3], 0x8f0ccc92, 10 );
+                MD5_STEP( MD5_I, c, d, a, b, x[10], 0xffeff47d, 15 );
+                MD5_STEP( MD5_I, b, c, d, a, x[ 1], 0x85845dd1, 21 );
+                MD5_STEP( MD5_I, a, b, c, d, x[ 8], 0x6fa87e4f,  6 );
+                MD5_STEP( MD5_I, d, a, b, c, x[15], 0xfe2ce6e0, 10 );
+                MD5_STEP( MD5_I, c, d, a, b, x[ 6], 0xa3014314, 15 );
+                MD5_STEP( MD5_I, b, c, d, a, x[13], 0x4e0811a1, 21 );
+                MD5_STEP( MD5_I, a, b, c, d, x[ 4], 0xf7537e82,  6 );
+                MD5_STEP( MD5_I, d, a, b, c, x[11], 0xbd3af235, 10 );
+                MD5_STEP( MD5_I, c, d, a, b, x[ 2], 0x2ad7d2bb, 15 );
+                MD5_STEP( MD5_I, b, c, d, a, x[ 9], 0xeb86d391, 21 );
+
+                a += aa;
+                b += bb;
+                c += cc;
+                d += dd;
+            }
+            state[0] = a; state[1] = b; state[2] = c; state[3] = d;
+        }
+
+#undef MD5_F
+#undef MD5_G
+#undef MD5_H
+#undef MD5_I
+#undef MD5_STEP
+
+        const unsigned md5Init[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+        /* SHA-256 (FIPS 180-4) */
+
+        const unsigned sha256K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+            0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+            0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+            0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+            0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+            0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+            0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+            0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+            0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        const unsigned sha256Init[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+
+        void sha256BlocksPortable(unsigned state[8], const unsigned char *p, size_t nBlocks) {
+            for( ; nBlocks; nBlocks--, p += 64 ) {
+                unsigned w[64];
+                for( int i = 0; i < 16; i++ )
+                    w[i] = loadBE32( p + 4 * i );
+                for( int i = 16; i < 64; i++ ) {
+                    unsigned s0 = rotr( w[i - 15], 7 ) ^ rotr( w[i - 15], 18 ) ^ ( w[i - 15] >> 3 );
+                    unsigned s1 = rotr( w[i - 2], 17 ) ^ rotr( w[i - 2], 19 ) ^ ( w[i - 2] >> 10 );
+                    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+                }
+                unsigned a = state[0], b = state[1], c = state[2], d = state[3];
+                unsigned e = state[4], f = state[5], g = state[6], h = state[7];
+                for( int i = 0; i < 64; i++ ) {
+                    unsigned t1 = h + ( rotr( e, 6 ) ^ rotr( e, 11 ) ^ rotr( e, 25 ) ) +
+                                  ( g ^ ( e & ( f ^ g ) ) ) + sha256K[i] + w[i];
+                    unsigned t2 = ( rotr( a, 2 ) ^ rotr( a, 13 ) ^ rotr( a, 22 ) ) +
+                                  ( ( a & b ) | ( c & ( a | b ) ) );
+                    h = g;
+                    g = f;
+                    f = e;
+                    e = d + t1;
+                    d = c;
+                    c = b;
+                    b = a;
+                    a = t1 + t2;
+                }
+                state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+                state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+            }
+        }
+
+#if defined(BSON_SHA_NI)
+        /** the same with the SHA extensions: two rounds per sha256rnds2, the message
+            schedule four words at a time with sha256msg1/sha256msg2
+        */
+        SHA_NI_TARGET
+        void sha256BlocksShaNi(unsigned state[8], const unsigned char *p, size_t nBlocks) {
+            const __m128i byteSwap = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL );
+
+            // the instructions want the state as ABEF and CDGH
+            __m128i tmp = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *) &state[0] ), 0xB1 );
+            __m128i state1 = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *) &state[4] ), 0x1B );
+            __m128i state0 = _mm_alignr_epi8( tmp, state1, 8 );
+            state1 = _mm_blend_epi16( state1, tmp, 0xF0 );
+
+            for( ; nBlocks; nBlocks--, p += 64 ) {
+                __m128i abefSave = state0;
+                __m128i cdghSave = state1;
+                __m128i w[4];   // message words 4g..4g+3 of group g are in w[g % 4]
+                for( int g = 0; g < 16; g++ ) {
+                    __m128i& cur = w[g & 3];
+                    if ( g < 4 )
+                        cur = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( p + 16 * g ) ), byteSwap );
+                    __m128i msg = _mm_add_epi32( cur, _mm_loadu_si128( (const __m128i *) &sha256K[4 * g] ) );
+                    state1 = _mm_sha256rnds2_epu32( state1, state0, msg );
+                    if ( g >= 3 && g < 15 ) {
+                        // finish the schedule for group g + 1
+                        __m128i& next = w[( g + 1 ) & 3];
+                        next = _mm_add_epi32( next, _mm_alignr_epi8( cur, w[( g + 3 ) & 3], 4 ) );
+                        next = _mm_sha256msg2_epu32( next, cur );
+                    }
+                    msg = _mm_shuffle_epi32( msg, 0x0E );
+                    state0 = _mm_sha256rnds2_epu32( state0, state1, msg );
+                    if ( g >= 1 && g < 13 ) {
+                        // start it for group g + 3
+                        __m128i& prev = w[( g + 3 ) & 3];
+                        prev = _mm_sha256msg1_epu32( prev, cur );
+                    }
+                }
+                state0 = _mm_add_epi32( state0, abefSave );
+                state1 = _mm_add_epi32( state1, cdghSave );
+            }
+
+            tmp = _mm_shuffle_epi32( state0, 0x1B );
+            state1 = _mm_shuffle_epi32( state1, 0xB1 );
+            state0 = _mm_blend_epi16( tmp, state1, 0xF0 );
+            state1 = _mm_alignr_epi8( state1, tmp, 8 );
+            _mm_storeu_si128( (__m128i *) &state[0], state0 );
+            _mm_storeu_si128( (__m128i *) &state[4], state1 );
+        }
+
+        bool haveShaNi() {
+            unsigned r1[4] = { 0, 0, 0, 0 }, r7[4] = { 0, 0, 0, 0 };
+#if defined(_MSC_VER)
+            int x[4];
+            __cpuid( x, 0 );
+            if ( x[0] < 7 )
+                return false;
+            __cpuid( x, 1 );
+            r1[2] = x[2];
+            __cpuidex( x, 7, 0 );
+            r7[1] = x[1];
+#else
+            if ( __get_cpuid_max( 0, 0 ) < 7 )
+                return false;
+            __cpuid( 1, r1[0], r1[1], r1[2], r1[3] );
+            __cpuid_count( 7, 0, r7[0], r7[1], r7[2], r7[3] );
+#endif
+            bool ssse3 = ( r1[2] >> 9 ) & 1;
+            bool sse41 = ( r1[2] >> 19 ) & 1;
+            bool sha = ( r7[1] >> 29 ) & 1;
+            return ssse3 && sse41 && sha;
+        }
+#endif
+
+        typedef void (*Sha256Blocks)(unsigned state[8], const unsigned char *p, size_t nBlocks);
+
+        Sha256Blocks pickSha256() {
+#if defined(BSON_SHA_NI)
+            if ( haveShaNi() )
+                return sha256BlocksShaNi;
+#endif
+            return sha256BlocksPortable;
+        }
+
+        /** the implementation for this CPU, picked on first use */
+        Sha256Blocks sha256Blocks() {
+            static const Sha256Blocks f = pickSha256();
+            return f;
+        }
+
+        /** the final block or two: the tail of the input, 0x80, zeros, and the length in
+            bits -- little endian for MD5, big endian for SHA-256
+        */
+        template <class Blocks, class State>
+        void finishBlocks(Blocks blocks, State state, const unsigned char *tail, size_t tailLen,
+                          unsigned long long total, bool bigEndian) {
+            unsigned char buf[128];
+            memcpy( buf, tail, tailLen );
+            buf[tailLen] = 0x80;
+            size_t n = tailLen < 56 ? 64 : 128;
+            memset( buf + tailLen + 1, 0, n - tailLen - 1 );
+            unsigned long long bits = total * 8;
+            for( int i = 0; i < 8; i++ )
+                buf[n - 8 + i] = (unsigned char) ( bits >> ( bigEndian ? 56 - 8 * i : 8 * i ) );
+            blocks( state, buf, n / 64 );
+        }
+
+        inline void md5Oneshot(const unsigned char *p, size_t len, md5digest& out) {
+            unsigned st[4] = { md5Init[0], md5Init[1], md5Init[2], md5Init[3] };
+            md5Blocks( st, p, len / 64 );
+            finishBlocks( md5Blocks, st, p + ( len & ~(size_t) 63 ), len & 63, len, false );
+            for( int i = 0; i < 4; i++ )
+                storeLE32( out.bytes + 4 * i, st[i] );
+        }
+
+        inline void sha256Oneshot(Sha256Blocks blocks, const unsigned char *p, size_t len,
+                                  sha256digest& out) {
+            unsigned st[8];
+            memcpy( st, sha256Init, sizeof(st) );
+            blocks( st, p, len / 64 );
+            finishBlocks( blocks, st, p + ( len & ~(size_t) 63 ), len & 63, len, true );
+            for( int i = 0; i < 8; i++ )
+                storeBE32( out.bytes + 4 * i, st[i] );
+        }
+
+        /** buffers input for a blocks function: whole blocks go straight through */
+        template <class Blocks, class State>
+        void feed(Blocks blocks, State state, unsigned char *buf, unsigned long long& total,
+                  const unsigned char *p, size_t len) {
+            size_t have = (size_t) ( total & 63 );
+            total += len;
+            if ( have ) {
+                size_t n = 64 - have;
+                if ( len < n ) {
+                    memcpy( buf + have, p, len );
+                    return;
+                }
+                memcpy( buf + have, p, n );
+                blocks( state, buf, 1 );
+                p += n;
+                len -= n;
+            }
+            blocks( state, p, len / 64 );
+            memcpy( buf, p + ( len & ~(size_t) 63 ), len & 63 );
+        }
+
+    }
+
+    std::string md5digest::toString() const { return toHexLower( bytes, 16 ); }
+    std::string sha256digest::toString() const { return toHexLower( bytes, 32 ); }
+
+    md5digest md5(const void *data, size_t len) {
+        md5digest d;
+        md5Oneshot( static_cast<const unsigned char *>( data ), len, d );
+        return d;
+    }
+
+    sha256digest sha256(const void *data, size_t len) {
+        sha256digest d;
+        sha256Oneshot( sha256Blocks(), static_cast<const unsigned char *>( data ), len, d );
+        return d;
+    }
+
+    void md5Batch(const std::vector<bsonobj>& docs, std::vector<md5digest>& out) {
+        out.resize( docs.size() );
+        for( size_t i = 0; i < docs.size(); i++ )
+            md5Oneshot( (const unsigned char *) docs[i].objdata(), docs[i].objsize(), out[i] );
+    }
+
+    void sha256Batch(const std::vector<bsonobj>& docs, std::vector<sha256digest>& out) {
+        out.resize( docs.size() );
+        Sha256Blocks blocks = sha256Blocks();
+        for( size_t i = 0; i < docs.size(); i++ )
+            sha256Oneshot( blocks, (const unsigned char *) docs[i].objdata(), docs[i].objsize(), out[i] );
+    }
+
+    md5stream::md5stream() : _total(0) {
+        memcpy( _state, md5Init, sizeof(_state) );
+    }
+
+    void md5stream::update(const void *data, size_t len) {
+        feed( md5Blocks, _state, _buf, _total, static_cast<const unsigned char *>( data ), len );
+    }
+
+    md5digest md5stream::finish() {
+        finishBlocks( md5Blocks, _state, _buf, (size_t) ( _total & 63 ), _total, false );
+        md5digest d;
+        for( int i = 0; i < 4; i++ )
+            storeLE32( d.bytes + 4 * i, _state[i] );
+        return d;
+    }
+
+    sha256stream::sha256stream() : _total(0) {
+        memcpy( _state, sha256Init, sizeof(_state) );
+    }
+
+    void sha256stream::update(const void *data, size_t len) {
+        feed( sha256Blocks(), _state, _buf, _total, static_cast<const unsigned char *>( data ), len );
+    }
+
+    sha256digest sha256stream::finish() {
+        finishBlocks( sha256Blocks(), _state, _buf, (size_t) ( _total & 63 ), _total, true );
+        sha256digest d;
+        for( int i = 0; i < 8; i++ )
+            storeBE32( d.bytes + 4 * i, _state[i] );
+        return d;
+    }
+
+    std::string bsonobj::md5() const {
+        return _bson::md5( objdata(), objsize() ).toString();
+    }
+
+    std::string bsonobj::sha256() const {
+        return _bson::sha256( objdata(), objsize() ).toString();
+    }
+
+}
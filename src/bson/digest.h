@@ -0,0 +1,102 @@
+// digest.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "bsonobj.h"
+
+namespace _bson {
+
+    /* MD5 and SHA-256 content digests, for deduplicating documents and checking copies of
+       them.  Self contained.  SHA-256 uses the x86 SHA extensions when the CPU has them
+       (checked once, at run time) and portable code otherwise.
+
+       Each digest comes three ways:
+         md5(p, len) / sha256(p, len)       one buffer
+         md5stream / sha256stream           input arriving in pieces -- a document being
+                                            read, a whole BSON sequence file (see digestFile)
+         md5Batch() / sha256Batch()         many documents in one call: the implementation
+                                            is picked once for all of them, and each is
+                                            hashed in place, with no copy into a stream
+                                            buffer
+    */
+
+    struct md5digest {
+        unsigned char bytes[16];
+        /** @return lower case hex */
+        std::string toString() const;
+        bool operator==(const md5digest& r) const { return memcmp( bytes, r.bytes, 16 ) == 0; }
+        bool operator!=(const md5digest& r) const { return !operator==( r ); }
+    };
+
+    struct sha256digest {
+        unsigned char bytes[32];
+        /** @return lower case hex */
+        std::string toString() const;
+        bool operator==(const sha256digest& r) const { return memcmp( bytes, r.bytes, 32 ) == 0; }
+        bool operator!=(const sha256digest& r) const { return !operator==( r ); }
+    };
+
+    md5digest md5(const void *data, size_t len);
+    sha256digest sha256(const void *data, size_t len);
+
+    /** digests of each of docs' bytes, into out[0, docs.size()) */
+    void md5Batch(const std::vector<bsonobj>& docs, std::vector<md5digest>& out);
+    void sha256Batch(const std::vector<bsonobj>& docs, std::vector<sha256digest>& out);
+
+    /** MD5 of input fed in pieces; the same as md5() of all of it. */
+    class md5stream {
+    public:
+        md5stream();
+        void update(const void *data, size_t len);
+        void update(const bsonobj& o) { update( o.objdata(), o.objsize() ); }
+        /** @return the digest.  The stream can't be fed after. */
+        md5digest finish();
+    private:
+        unsigned _state[4];
+        unsigned long long _total;
+        unsigned char _buf[64];
+    };
+
+    /** SHA-256 of input fed in pieces; the same as sha256() of all of it. */
+    class sha256stream {
+    public:
+        sha256stream();
+        void update(const void *data, size_t len);
+        void update(const bsonobj& o) { update( o.objdata(), o.objsize() ); }
+        /** @return the digest.  The stream can't be fed after. */
+        sha256digest finish();
+    private:
+        unsigned _state[8];
+        unsigned long long _total;
+        unsigned char _buf[64];
+    };
+
+    /** feeds f, from where it is to its end, to s -- an md5stream or sha256stream.
+        @return false on a read error
+    */
+    template <class Stream>
+    bool digestFile(FILE *f, Stream& s) {
+        std::vector<char> buf( 256 * 1024 );
+        size_t n;
+        while( ( n = fread( &buf[0], 1, buf.size(), f ) ) > 0 )
+            s.update( &buf[0], n );
+        return !ferror( f );
+    }
+
+}
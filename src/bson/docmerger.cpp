@@ -0,0 +1,143 @@
+// docmerger.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cstring>
+#include "docmerger.h"
+#include "bsonobjbuilder.h"
+#include "hash.h"
+
+namespace _bson {
+
+    namespace {
+        void appendRun(BufBuilder& b, const char *run, const char *end) {
+            if ( run )
+                b.appendBuf( run, end - run );
+        }
+    }
+
+    /** adds the field at p to l: a new entry, or to the entry for its name.  @return its size */
+    int docmerger::add(Level& l, const char *p) {
+        bsonelement e( p );
+        StringData name = e.fieldNameStringData();
+        unsigned h = (unsigned) hash64( name.rawData(), name.size() );
+        bool isObject = e.type() == Object;
+
+        size_t mask = l.table.size() - 1;
+        size_t i = h & mask;
+        for( ; l.table[i]; i = ( i + 1 ) & mask ) {
+            Entry& x = l.entries[l.table[i] - 1];
+            if ( x.hash != h || x.name != name )
+                continue;
+            Link link = { p, e.size(), -1 };
+            if ( x.closed )
+                return link.size;
+            if ( x.objects && isObject ) {
+                // merged with the ones before it, whichever wins
+                l.links[x.last].next = (int) l.links.size();
+                x.last = (int) l.links.size();
+                l.links.push_back( link );
+            }
+            else if ( _precedence == LastWins ) {
+                x.first = x.last = (int) l.links.size();
+                x.objects = isObject;
+                l.links.push_back( link );
+            }
+            else {
+                // FirstWins and not an object: objects after this one lose to it, so they
+                // don't get merged in
+                x.closed = true;
+            }
+            return link.size;
+        }
+
+        Entry x = { name, h, (int) l.links.size(), (int) l.links.size(), isObject, false };
+        Link link = { p, e.size(), -1 };
+        l.table[i] = (int) l.entries.size() + 1;
+        l.entries.push_back( x );
+        l.links.push_back( link );
+
+        if ( l.entries.size() * 2 > l.table.size() ) {
+            // grow, rehashing from the stored hashes
+            std::vector<int>& t = l.table;
+            t.assign( t.size() * 2, 0 );
+            mask = t.size() - 1;
+            for( size_t k = 0; k < l.entries.size(); k++ ) {
+                size_t j = l.entries[k].hash & mask;
+                while( t[j] )
+                    j = ( j + 1 ) & mask;
+                t[j] = (int) k + 1;
+            }
+        }
+        return link.size;
+    }
+
+    /** appends the fields of docs[0, n) merged to b */
+    void docmerger::mergeLevel(const bsonobj *docs, int n, size_t depth, BufBuilder& b) {
+        if ( _levels.size() <= depth )
+            _levels.resize( depth + 1 );
+        Level& l = _levels[depth];
+        l.entries.clear();
+        l.links.clear();
+        l.table.assign( l.table.empty() ? 16 : l.table.size(), 0 );
+
+        for( int k = 0; k < n; k++ ) {
+            const char *p = docs[k].objdata() + 4;
+            while( *p != EOO )
+                p += add( l, p );
+        }
+
+        // fields taken whole go out in runs: a document's fields that are next to each
+        // other in it, and in the output, are one copy
+        const char *run = 0, *runEnd = 0;
+        for( size_t k = 0; k < l.entries.size(); k++ ) {
+            const Entry& x = l.entries[k];
+            const Link& first = l.links[x.first];
+            if ( first.next < 0 ) {
+                if ( first.elem != runEnd ) {
+                    appendRun( b, run, runEnd );
+                    run = first.elem;
+                }
+                runEnd = first.elem + first.size;
+                continue;
+            }
+
+            appendRun( b, run, runEnd );
+            run = runEnd = 0;
+
+            l.sub.clear();
+            for( int i = x.first; i >= 0; i = l.links[i].next )
+                l.sub.push_back( bsonelement( l.links[i].elem ).object() );
+            b.appendChar( (char) Object );
+            b.appendStr( x.name );
+            int start = b.len();
+            b.skip( 4 );
+            // the next depth has a Level of its own, so l.sub stays as it is
+            mergeLevel( &l.sub[0], (int) l.sub.size(), depth + 1, b );
+            b.appendChar( EOO );
+            *( (int*) ( b.buf() + start ) ) = endian_int( b.len() - start );
+        }
+        appendRun( b, run, runEnd );
+    }
+
+    void docmerger::appendMerged(const bsonobj *docs, int n, bsonobjbuilder& b) {
+        mergeLevel( docs, n, 0, b.bb() );
+    }
+
+    bsonobj docmerger::merge(const bsonobj *docs, int n, bsonobjbuilder& b) {
+        appendMerged( docs, n, b );
+        return b.obj();
+    }
+
+}
@@ -0,0 +1,102 @@
+// docmerger.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <deque>
+#include <vector>
+#include "bsonobj.h"
+
+namespace _bson {
+
+    class bsonobjbuilder;
+
+    /** Deep merge of any number of documents -- defaults, then overrides, then the request.
+
+        A field in one document only is taken as it is.  A field in several is taken from
+        the one with precedence, except that objects are merged: if the field is an object
+        in that document and in the ones before it (in precedence), back to one where it
+        isn't an object, those objects are merged, the same way, at every depth.  Arrays
+        are values, like strings: one replaces another whole.
+
+        Fields are in the order they first appear, going through the documents in order.
+
+        Each object is merged in one pass over its fields in every document, with a small
+        open addressed hash of field names, and is written straight to the output -- objects
+        inside are merged in place, not in builders of their own.  Fields taken whole are
+        copied in runs.  The hash tables are kept for the next merge().
+
+        example:
+          docmerger m;          // later documents win
+          ...
+          bsonobj docs[] = { defaults, tenant, request };
+          bsonobjbuilder b;
+          bsonobj settings = m.merge( docs, 3, b );
+
+        A docmerger is not thread safe: give each thread its own.
+    */
+    class docmerger {
+    public:
+        enum Precedence {
+            LastWins,       // a document's fields win over those of documents before it
+            FirstWins       // ... over those of documents after it
+        };
+
+        explicit docmerger(Precedence p = LastWins) : _precedence(p) { }
+
+        /** merges docs[0, n) into b.  @return b.obj() */
+        bsonobj merge(const bsonobj *docs, int n, bsonobjbuilder& b);
+
+        bsonobj merge(const std::vector<bsonobj>& docs, bsonobjbuilder& b) {
+            return merge( docs.empty() ? 0 : &docs[0], (int) docs.size(), b );
+        }
+
+        /** appends the fields of docs[0, n) merged to b, which may have fields already.
+            Fields b has aren't looked at: the caller keeps them out of docs if need be.
+        */
+        void appendMerged(const bsonobj *docs, int n, bsonobjbuilder& b);
+
+    private:
+        struct Link {
+            const char *elem;
+            int size;
+            int next;               // in Level::links, -1 at the end
+        };
+
+        /** the documents' fields with one name */
+        struct Entry {
+            StringData name;
+            unsigned hash;
+            int first, last;        // in Level::links; in document order
+            bool objects;           // every one is an Object
+            bool closed;            // FirstWins: a later non-object ended the chain
+        };
+
+        /** what merging one object needs.  Kept, by depth, for reuse. */
+        struct Level {
+            std::vector<Entry> entries;     // in order of first appearance
+            std::vector<Link> links;
+            std::vector<int> table;         // entry + 1, 0 if empty; size a power of 2
+            std::vector<bsonobj> sub;       // objects to merge at the next depth
+        };
+
+        int add(Level& l, const char *p);
+        void mergeLevel(const bsonobj *docs, int n, size_t depth, BufBuilder& b);
+
+        Precedence _precedence;
+        std::deque<Level> _levels;      // a deque, as deeper levels are added during a merge
+    };
+
+}
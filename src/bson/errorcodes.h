@@ -7,7 +7,10 @@ namespace _bson {
 enum ErrorCodes {
     Ok = 0,
     BadValue = 2,
-    FailedToParse = 9
+    NoSuchKey = 4,
+    FailedToParse = 9,
+    TypeMismatch = 14,
+    InvalidBSON = 22
     };
 
 }
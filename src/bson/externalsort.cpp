@@ -0,0 +1,489 @@
+// externalsort.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <thread>
+#include "externalsort.h"
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+namespace _bson {
+
+    namespace {
+
+        enum { IOBuffer = 256 * 1024 };     // bytes buffered for each temp file read or written
+
+        /** buffers writes to a temp file, which is unbuffered itself */
+        class FileWriter {
+        public:
+            explicit FileWriter(FILE *f) : _f(f) { _buf.reserve( IOBuffer ); }
+            void write(const char *p, size_t n) {
+                if ( _buf.size() + n > IOBuffer )
+                    flush();
+                if ( n >= IOBuffer )
+                    put( p, n );
+                else
+                    _buf.insert( _buf.end(), p, p + n );
+            }
+            /** writes what's buffered and rewinds the file, for reading */
+            void finish() {
+                flush();
+                massert( 18106, "externalsorter: error writing temp file",
+                         fflush( _f ) == 0 && fseek( _f, 0, SEEK_SET ) == 0 );
+            }
+        private:
+            void flush() {
+                if ( !_buf.empty() )
+                    put( &_buf[0], _buf.size() );
+                _buf.clear();
+            }
+            void put(const char *p, size_t n) {
+                massert( 18106, "externalsorter: error writing temp file",
+                         fwrite( p, 1, n, _f ) == n );
+            }
+            FILE *_f;
+            std::vector<char> _buf;
+        };
+
+        /** makes room in v for n more, growing it by at most room bytes past that.  Left to
+            itself a vector doubles, which could take a run to twice its share of memory.
+        */
+        template <class T>
+        void reserveFor(std::vector<T>& v, size_t n, size_t room) {
+            if ( v.size() + n <= v.capacity() )
+                return;
+            size_t want = std::max( v.capacity() * 2, v.size() + n );
+            v.reserve( std::min( want, v.size() + n + room / sizeof(T) ) );
+        }
+
+    }
+
+    struct externalsorter::Run {
+        struct Entry {
+            size_t doc;     // offset in docs
+            size_t key;     // offset in keys
+            int keyLen;
+        };
+
+        std::vector<char> docs;     // the documents, back to back
+        std::vector<char> keys;     // their key strings, back to back
+        std::vector<Entry> entries;
+        long long nDocs;
+        int level;                  // times its documents have been through a merge
+
+        FILE *file;                 // set once spilled
+        std::thread worker;
+        std::exception_ptr error;
+
+        Run() : nDocs(0), level(0), file(0) { }
+        ~Run() {
+            if ( file )
+                fclose( file );
+        }
+
+        /** memory held, counting what the vectors have allocated rather than used */
+        size_t bytes() const {
+            return docs.capacity() + keys.capacity() + entries.capacity() * sizeof(Entry);
+        }
+
+        void sort() {
+            const char *k = keys.empty() ? 0 : &keys[0];
+            std::stable_sort( entries.begin(), entries.end(), [k](const Entry& a, const Entry& b) {
+                int x = memcmp( k + a.key, k + b.key, std::min( a.keyLen, b.keyLen ) );
+                return x ? x < 0 : a.keyLen < b.keyLen;
+            } );
+        }
+
+        /** sorts, writes the documents in order to a temp file and frees the memory */
+        void spill(const std::string& tempDir) {
+            sort();
+            file = openTempFile( tempDir );
+            FileWriter w( file );
+            for( size_t i = 0; i < entries.size(); i++ ) {
+                const char *d = &docs[entries[i].doc];
+                w.write( d, (size_t) bsonobj( d ).objsize() );
+            }
+            w.finish();
+            std::vector<char>().swap( docs );
+            std::vector<char>().swap( keys );
+            std::vector<Entry>().swap( entries );
+        }
+
+        static FILE* openTempFile(const std::string& dir) {
+            FILE *f = 0;
+            if ( dir.empty() ) {
+                f = tmpfile();
+            }
+            else {
+#if defined(_WIN32)
+                char *name = _tempnam( dir.c_str(), "bsonsort" );
+                if ( name ) {
+                    f = fopen( name, "w+bD" ); // D: delete on close
+                    free( name );
+                }
+#else
+                std::string name = dir + "/bsonsort.XXXXXX";
+                std::vector<char> buf( name.begin(), name.end() );
+                buf.push_back( 0 );
+                int fd = mkstemp( &buf[0] );
+                if ( fd >= 0 ) {
+                    unlink( &buf[0] );
+                    f = fdopen( fd, "w+b" );
+                    if ( f == 0 )
+                        close( fd );
+                }
+#endif
+            }
+            massert( 18105, "externalsorter: can't create temp file", f != 0 );
+            // FileWriter and FileSource buffer, only while the file is in use; a stdio
+            // buffer would stay allocated for as long as the file is open
+            setvbuf( f, 0, _IONBF, 0 );
+            return f;
+        }
+    };
+
+    namespace {
+
+        /** the documents of one run, in order, with their key strings */
+        class Source {
+        public:
+            virtual ~Source() { }
+            /** moves to the next document.  @return false at the end */
+            virtual bool advance() = 0;
+            bsonobj doc;
+            const char *key;
+            int keyLen;
+        };
+
+        class MemorySource : public Source {
+        public:
+            MemorySource(const std::shared_ptr<externalsorter::Run>& r) : _r(r), _i(0) { }
+            virtual bool advance() {
+                if ( _i >= _r->entries.size() )
+                    return false;
+                const externalsorter::Run::Entry& e = _r->entries[_i++];
+                doc = bsonobj( &_r->docs[e.doc] );
+                key = &_r->keys[e.key];
+                keyLen = e.keyLen;
+                return true;
+            }
+        private:
+            std::shared_ptr<externalsorter::Run> _r;
+            size_t _i;
+        };
+
+        class FileSource : public Source {
+        public:
+            FileSource(const std::shared_ptr<externalsorter::Run>& r, const sortkeymaker& keys)
+                : _r(r), _keys(keys), _left(r->nDocs), _buf(IOBuffer), _pos(0), _end(0),
+                  _key(256) { }
+            virtual bool advance() {
+                if ( _left == 0 ) {
+                    // done with the run: close its file, if this was the last reference,
+                    // and free the buffers
+                    _r.reset();
+                    std::vector<char>().swap( _buf );
+                    std::vector<char>().swap( _doc );
+                    return false;
+                }
+                _left--;
+                _doc.resize( 4 );
+                read( &_doc[0], 4 );
+                int size = readInt( &_doc[0] );
+                massert( 18107, "externalsorter: temp file is corrupt", size >= 5 );
+                _doc.resize( size );
+                read( &_doc[4], size - 4 );
+                doc = bsonobj( &_doc[0] );
+                _key.reset();
+                _keys.append( doc, _key );
+                key = _key.buf();
+                keyLen = _key.len();
+                return true;
+            }
+        private:
+            void read(char *p, size_t n) {
+                while( n > 0 ) {
+                    if ( _pos == _end ) {
+                        _end = fread( &_buf[0], 1, _buf.size(), _r->file );
+                        _pos = 0;
+                        massert( 18107, "externalsorter: error reading temp file", _end > 0 );
+                    }
+                    size_t k = std::min( n, _end - _pos );
+                    memcpy( p, &_buf[_pos], k );
+                    _pos += k;
+                    p += k;
+                    n -= k;
+                }
+            }
+            std::shared_ptr<externalsorter::Run> _r;
+            const sortkeymaker& _keys;
+            long long _left;
+            std::vector<char> _buf;
+            size_t _pos, _end;          // of what's left to read in _buf
+            std::vector<char> _doc;
+            BufBuilder _key;
+        };
+
+        /** k-way merge of sources with a loser tree: one key comparison per level of the
+            tree for each document, and a run that comes first in input order wins ties.
+        */
+        class MergeIterator : public sortediterator {
+        public:
+            MergeIterator(const sortkeymaker& keys, long long total)
+                : _keys(keys), _total(total), _returned(0), _started(false) { }
+
+            const sortkeymaker& keys() const { return _keys; }
+
+            void addSource(Source *s) { _sources.push_back( std::unique_ptr<Source>( s ) ); }
+
+            virtual bool more() { return _returned < _total; }
+
+            virtual bsonobj next() {
+                massert( 18108, "externalsorter: no more documents", more() );
+                if ( !_started ) {
+                    _started = true;
+                    for( size_t i = 0; i < _sources.size(); i++ )
+                        _live.push_back( _sources[i]->advance() );
+                    build();
+                }
+                else {
+                    int w = _tree[0];
+                    _live[w] = _sources[w]->advance();
+                    replay( w );
+                }
+                _returned++;
+                return _sources[_tree[0]]->doc;
+            }
+
+        private:
+            /** @return true if source a's document goes before b's */
+            bool before(int a, int b) const {
+                if ( !_live[a] )
+                    return false;
+                if ( !_live[b] )
+                    return true;
+                const Source& x = *_sources[a];
+                const Source& y = *_sources[b];
+                int c = memcmp( x.key, y.key, std::min( x.keyLen, y.keyLen ) );
+                if ( c == 0 )
+                    c = x.keyLen - y.keyLen;
+                return c ? c < 0 : a < b;
+            }
+
+            /* _tree[1..k-1] hold the loser at each internal node, _tree[0] the winner.
+               Leaf i is node k + i.
+            */
+            void build() {
+                int k = (int) _sources.size();
+                _tree.assign( std::max( k, 1 ), 0 );
+                std::vector<int> winner( 2 * k );
+                for( int i = 0; i < k; i++ )
+                    winner[k + i] = i;
+                for( int n = k - 1; n >= 1; n-- ) {
+                    int l = winner[2 * n], r = winner[2 * n + 1];
+                    if ( before( r, l ) ) {
+                        winner[n] = r;
+                        _tree[n] = l;
+                    }
+                    else {
+                        winner[n] = l;
+                        _tree[n] = r;
+                    }
+                }
+                _tree[0] = k > 1 ? winner[1] : 0;
+            }
+
+            /** source w's document changed; play it back up to the root */
+            void replay(int w) {
+                int k = (int) _sources.size();
+                for( int n = ( w + k ) / 2; n >= 1; n /= 2 ) {
+                    if ( before( _tree[n], w ) )
+                        std::swap( _tree[n], w );
+                }
+                _tree[0] = w;
+            }
+
+            sortkeymaker _keys;
+            std::vector< std::unique_ptr<Source> > _sources;
+            std::vector<char> _live;
+            std::vector<int> _tree;
+            long long _total;
+            long long _returned;
+            bool _started;
+        };
+
+    }
+
+    externalsorter::externalsorter(const bsonobj& sortKey, size_t maxMemory, int threads,
+                                   bool useDotted, const std::string& tempDir)
+        : _keys(sortKey, useDotted), _tempDir(tempDir), _inFlight(0), _spilled(0), _done(false) {
+        _threads = threads > 0 ? threads : (int) std::thread::hardware_concurrency();
+        if ( _threads < 1 )
+            _threads = 1;
+        // a merge takes a buffer per run and one for its output; let merges have up to a
+        // quarter of the budget
+        _fanIn = std::min( (size_t) MaxFanIn, std::max( (size_t) 2, maxMemory / 4 / IOBuffer ) );
+        // what's left is for the run being filled plus up to _threads being spilled, each
+        // with a write buffer.  With a budget of only a few buffers the runs get at least
+        // half of it, and the buffers go over.
+        size_t io = std::min( ( _fanIn + 1 + _threads ) * IOBuffer, maxMemory / 2 );
+        _runLimit = ( maxMemory - io ) / ( _threads + 1 );
+        newRun();
+    }
+
+    externalsorter::~externalsorter() {
+        for( size_t i = 0; i < _runs.size(); i++ ) {
+            if ( _runs[i]->worker.joinable() )
+                _runs[i]->worker.join();
+        }
+    }
+
+    void externalsorter::newRun() {
+        _run = std::make_shared<Run>();
+    }
+
+    void externalsorter::add(const bsonobj& doc) {
+        massert( 18108, "externalsorter: add() after done()", !_done );
+        Run& r = *_run;
+        _scratch.reset();
+        _keys.append( doc, _scratch );
+        size_t room = r.bytes() < _runLimit ? ( _runLimit - r.bytes() ) / 3 : 0;
+        reserveFor( r.docs, doc.objsize(), room );
+        reserveFor( r.keys, _scratch.len(), room );
+        reserveFor( r.entries, 1, room );
+        Run::Entry e;
+        e.doc = r.docs.size();
+        r.docs.insert( r.docs.end(), doc.objdata(), doc.objdata() + doc.objsize() );
+        e.key = r.keys.size();
+        e.keyLen = _scratch.len();
+        r.keys.insert( r.keys.end(), _scratch.buf(), _scratch.buf() + _scratch.len() );
+        r.entries.push_back( e );
+        r.nDocs++;
+        if ( r.bytes() >= _runLimit )
+            spill();
+    }
+
+    /** hands the current run to a background thread to be sorted and written out */
+    void externalsorter::spill() {
+        while ( _inFlight >= _threads )
+            finishOldest();
+        std::shared_ptr<Run> r = _run;
+        std::string dir = _tempDir;
+        r->worker = std::thread( [r, dir]() {
+            try {
+                r->spill( dir );
+            }
+            catch ( ... ) {
+                r->error = std::current_exception();
+            }
+        } );
+        _runs.push_back( r );
+        _inFlight++;
+        _spilled++;
+        newRun();
+    }
+
+    /** waits for the oldest run still being spilled */
+    void externalsorter::finishOldest() {
+        for( size_t i = 0; i < _runs.size(); i++ ) {
+            Run& r = *_runs[i];
+            if ( r.worker.joinable() ) {
+                r.worker.join();
+                _inFlight--;
+                if ( r.error )
+                    std::rethrow_exception( r.error );
+                mergeSpilled();
+                return;
+            }
+        }
+    }
+
+    /** keeps down the number of spill files open: once the last _fanIn runs of those done
+        spilling are of one level, they are merged into one run of the next.  So there are
+        fewer than _fanIn runs of each level, and each document is written once per level.
+        The runs merged are next to each other, which keeps the sort stable.
+    */
+    void externalsorter::mergeSpilled() {
+        for( ;; ) {
+            size_t joined = 0;
+            while( joined < _runs.size() && !_runs[joined]->worker.joinable() )
+                joined++;
+            if ( joined < _fanIn )
+                return;
+            size_t first = joined - _fanIn;
+            // levels don't go up along _runs, so the ends having the same is enough
+            if ( _runs[first]->level != _runs[joined - 1]->level )
+                return;
+            mergeRuns( first, _fanIn );
+        }
+    }
+
+    /** merges the n spilled runs from _runs[first] into one spilled run, in their place.  Each
+        one's file is closed as soon as it has been read.
+    */
+    void externalsorter::mergeRuns(size_t first, size_t n) {
+        std::shared_ptr<Run> out = std::make_shared<Run>();
+        for( size_t i = first; i < first + n; i++ ) {
+            out->nDocs += _runs[i]->nDocs;
+            out->level = std::max( out->level, _runs[i]->level + 1 );
+        }
+        MergeIterator m( _keys, out->nDocs );
+        for( size_t i = first; i < first + n; i++ )
+            m.addSource( new FileSource( _runs[i], m.keys() ) );
+        _runs.erase( _runs.begin() + first, _runs.begin() + first + n );
+
+        out->file = Run::openTempFile( _tempDir );
+        FileWriter w( out->file );
+        while( m.more() ) {
+            bsonobj d = m.next();
+            w.write( d.objdata(), d.objsize() );
+        }
+        w.finish();
+        _runs.insert( _runs.begin() + first, out );
+    }
+
+    std::unique_ptr<sortediterator> externalsorter::done() {
+        massert( 18108, "externalsorter: done() called twice", !_done );
+        _done = true;
+        // the last run stays in memory and is sorted here while the others finish
+        _run->sort();
+        while ( _inFlight > 0 )
+            finishOldest();
+
+        // at most _fanIn sources, the run in memory one of them
+        while( _runs.size() >= _fanIn )
+            mergeRuns( _runs.size() - _fanIn, _fanIn );
+
+        long long total = _run->nDocs;
+        for( size_t i = 0; i < _runs.size(); i++ )
+            total += _runs[i]->nDocs;
+
+        MergeIterator *m = new MergeIterator( _keys, total );
+        std::unique_ptr<sortediterator> it( m );
+        for( size_t i = 0; i < _runs.size(); i++ )
+            m->addSource( new FileSource( _runs[i], m->keys() ) );
+        m->addSource( new MemorySource( _run ) );
+        _runs.clear();
+        _run.reset();
+        return it;
+    }
+
+}
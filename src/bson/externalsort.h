@@ -0,0 +1,116 @@
+// externalsort.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "bsonobj.h"
+#include "keystring.h"
+
+namespace _bson {
+
+    /** Hands out the documents of a finished sort in order.  See externalsorter::done(). */
+    class sortediterator {
+    public:
+        virtual ~sortediterator() { }
+        virtual bool more() = 0;
+        /** @return the next document.  It is only valid until the next call to next(). */
+        virtual bsonobj next() = 0;
+    };
+
+    /** Sorts a stream of documents that may not fit in memory, in the order of
+        bsonobj::woSortOrder(r, sortKey, useDotted).  The sort is stable.
+
+        Documents are copied into a run as they are added.  When a run reaches its share of
+        the memory budget it is handed to a background thread, which sorts it by key string
+        (see sortkeymaker) and spills it to a temporary file as a plain sequence of BSON
+        documents.  done() sorts the last run and k-way merges all of them with a loser tree.
+        If everything fit in one run nothing touches the disk.
+
+        A merge reads at most MaxFanIn runs, fewer if the memory budget is small, so open
+        files and merge buffers stay bounded however much is sorted.  Past that, runs are
+        merged into bigger spilled runs as they accumulate -- MaxFanIn runs of one size make
+        one of the next -- and each run's file is closed once it has been merged.  A document
+        is rewritten once for each such level: once for about MaxFanIn runs, twice for the
+        square of that.
+
+        example:
+          externalsorter s( sortKey, 512 * 1024 * 1024 );
+          while( in.more() )
+              s.add( in.next() );
+          std::unique_ptr<sortediterator> i = s.done();
+          while( i->more() )
+              out.write( i->next() );
+
+        Temporary files are unlinked as soon as they are created (or deleted on close, on
+        Windows) so nothing is left behind if the process dies.  Not thread safe: add() from
+        one thread.  Link with -lpthread.
+    */
+    class externalsorter {
+    public:
+        /**
+         * @param maxMemory approximate bytes of documents, keys, bookkeeping and I/O buffers
+         *        to hold in memory at once, across all runs being sorted and merged (plus a
+         *        document for each run being merged)
+         * @param threads number of runs that may be sorted and spilled in the background at
+         *        once; 0 for the number of hardware threads
+         * @param tempDir directory for spill files; empty for the system default
+         */
+        externalsorter(const bsonobj& sortKey, size_t maxMemory = 100 * 1024 * 1024,
+                       int threads = 0, bool useDotted = false,
+                       const std::string& tempDir = "");
+        ~externalsorter();
+
+        /** copies doc into the sorter; may block while earlier runs are spilled */
+        void add(const bsonobj& doc);
+
+        /** @return an iterator over everything added, in order.  Call once, after the last
+            add().  The iterator does not refer to the sorter, which may be destroyed.
+        */
+        std::unique_ptr<sortediterator> done();
+
+        /** @return number of runs written to disk so far */
+        int runsSpilled() const { return _spilled; }
+
+        struct Run;
+
+        enum { MaxFanIn = 128 };    // most runs merged at once
+
+    private:
+        externalsorter(const externalsorter&);
+        void operator=(const externalsorter&);
+
+        void newRun();
+        void spill();
+        void finishOldest();
+        void mergeSpilled();
+        void mergeRuns(size_t first, size_t n);
+
+        sortkeymaker _keys;
+        size_t _runLimit;
+        size_t _fanIn;
+        int _threads;
+        std::string _tempDir;
+        std::shared_ptr<Run> _run;                    // the run being filled
+        std::vector< std::shared_ptr<Run> > _runs;    // finished or spilling, in input order
+        int _inFlight;                                // _runs still being spilled
+        int _spilled;
+        bool _done;
+        BufBuilder _scratch;
+    };
+
+}
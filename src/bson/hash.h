@@ -0,0 +1,193 @@
+// hash.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include "endian.h"
+
+namespace _bson {
+
+    /* Fast non-cryptographic 64 bit hashing: XXH64.  Bulk input goes 32 bytes a step through
+       four independent multiply-rotate lanes, the tail 8, 4 and then 1 byte at a time, and
+       the result is avalanched.  Results are the same as the reference XXH64 and don't
+       depend on the host's byte order, so they may be stored or sent elsewhere.
+
+       Not for use where an attacker chooses the input and a collision would hurt: use a
+       cryptographic hash there.
+    */
+
+    namespace hashdetail {
+
+        const unsigned long long P1 = 0x9E3779B185EBCA87ULL;
+        const unsigned long long P2 = 0xC2B2AE3D27D4EB4FULL;
+        const unsigned long long P3 = 0x165667B19E3779F9ULL;
+        const unsigned long long P4 = 0x85EBCA77C2B2AE63ULL;
+        const unsigned long long P5 = 0x27D4EB2F165667C5ULL;
+
+        inline unsigned long long rotl(unsigned long long x, int r) {
+            return ( x << r ) | ( x >> ( 64 - r ) );
+        }
+
+        inline unsigned long long load64(const unsigned char *p) {
+            unsigned long long x;
+            memcpy( &x, p, 8 );
+            return (unsigned long long) endian_ll( (long long) x );
+        }
+
+        inline unsigned long long load32(const unsigned char *p) {
+            unsigned x;
+            memcpy( &x, p, 4 );
+            return endian( x );
+        }
+
+        inline unsigned long long step(unsigned long long acc, unsigned long long input) {
+            acc += input * P2;
+            acc = rotl( acc, 31 );
+            return acc * P1;
+        }
+
+        inline unsigned long long mergeRound(unsigned long long acc, unsigned long long v) {
+            acc ^= step( 0, v );
+            return acc * P1 + P4;
+        }
+
+        /** final mix, so every bit of h affects every bit of the result */
+        inline unsigned long long avalanche(unsigned long long h) {
+            h ^= h >> 33;
+            h *= P2;
+            h ^= h >> 29;
+            h *= P3;
+            h ^= h >> 32;
+            return h;
+        }
+
+        /** runs whole 32 byte stripes of p through the lanes v.  @return bytes consumed */
+        inline size_t stripes(unsigned long long v[4], const unsigned char *p, size_t len) {
+            const unsigned char *s = p;
+            const unsigned char *end = p + ( len & ~(size_t) 31 );
+            unsigned long long a = v[0], b = v[1], c = v[2], d = v[3];
+            for( ; s < end; s += 32 ) {
+                a = step( a, load64( s ) );
+                b = step( b, load64( s + 8 ) );
+                c = step( c, load64( s + 16 ) );
+                d = step( d, load64( s + 24 ) );
+            }
+            v[0] = a; v[1] = b; v[2] = c; v[3] = d;
+            return s - p;
+        }
+
+        inline void initLanes(unsigned long long v[4], unsigned long long seed) {
+            v[0] = seed + P1 + P2;
+            v[1] = seed + P2;
+            v[2] = seed;
+            v[3] = seed - P1;
+        }
+
+        /** folds the lanes (if total >= 32), then the tail p[0, len) < 32 bytes */
+        inline unsigned long long finish(const unsigned long long v[4], unsigned long long seed,
+                                         unsigned long long total, const unsigned char *p, size_t len) {
+            unsigned long long h;
+            if ( total >= 32 ) {
+                h = rotl( v[0], 1 ) + rotl( v[1], 7 ) + rotl( v[2], 12 ) + rotl( v[3], 18 );
+                for( int i = 0; i < 4; i++ )
+                    h = mergeRound( h, v[i] );
+            }
+            else {
+                h = seed + P5;
+            }
+            h += total;
+            for( ; len >= 8; p += 8, len -= 8 ) {
+                h ^= step( 0, load64( p ) );
+                h = rotl( h, 27 ) * P1 + P4;
+            }
+            if ( len >= 4 ) {
+                h ^= load32( p ) * P1;
+                h = rotl( h, 23 ) * P2 + P3;
+                p += 4;
+                len -= 4;
+            }
+            for( ; len; p++, len-- ) {
+                h ^= *p * P5;
+                h = rotl( h, 11 ) * P1;
+            }
+            return avalanche( h );
+        }
+
+    }
+
+    /** @return the 64 bit hash of data[0, len) */
+    inline unsigned long long hash64(const void *data, size_t len, unsigned long long seed = 0) {
+        const unsigned char *p = static_cast<const unsigned char *>( data );
+        unsigned long long v[4];
+        hashdetail::initLanes( v, seed );
+        size_t n = len >= 32 ? hashdetail::stripes( v, p, len ) : 0;
+        return hashdetail::finish( v, seed, len, p + n, len - n );
+    }
+
+    /** hash64() of input that arrives in pieces.  Feeding the bytes in any split gives the
+        same result as one hash64() call over all of them.
+
+        example:
+          hash64stream h;
+          while( ... )
+              h.update( buf, n );
+          unsigned long long x = h.digest();
+    */
+    class hash64stream {
+    public:
+        explicit hash64stream(unsigned long long seed = 0) : _seed(seed), _total(0), _bufLen(0) {
+            hashdetail::initLanes( _v, seed );
+        }
+
+        void update(const void *data, size_t len) {
+            const unsigned char *p = static_cast<const unsigned char *>( data );
+            _total += len;
+            if ( _bufLen ) {
+                size_t n = 32 - _bufLen;
+                if ( len < n ) {
+                    memcpy( _buf + _bufLen, p, len );
+                    _bufLen += (unsigned) len;
+                    return;
+                }
+                memcpy( _buf + _bufLen, p, n );
+                hashdetail::stripes( _v, _buf, 32 );
+                p += n;
+                len -= n;
+                _bufLen = 0;
+            }
+            size_t n = hashdetail::stripes( _v, p, len );
+            memcpy( _buf, p + n, len - n );
+            _bufLen = (unsigned) ( len - n );
+        }
+
+        /** @return hash of everything fed so far.  More may be fed after. */
+        unsigned long long digest() const {
+            return hashdetail::finish( _v, _seed, _total, _buf, _bufLen );
+        }
+
+        /** @return bytes fed so far */
+        unsigned long long length() const { return _total; }
+
+    private:
+        unsigned long long _v[4];
+        unsigned long long _seed;
+        unsigned long long _total;
+        unsigned char _buf[32];     // a partial stripe
+        unsigned _bufLen;
+    };
+
+}
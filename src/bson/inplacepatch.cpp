@@ -0,0 +1,230 @@
+// inplacepatch.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include "inplacepatch.h"
+
+namespace _bson {
+
+    namespace {
+        /** path order a field name at a time: '.' sorts before any other character, so
+            paths with the same first n names are together, and "a" comes before "a.b"
+        */
+        bool pathLess(const std::string& a, const std::string& b) {
+            size_t n = std::min( a.size(), b.size() );
+            for( size_t i = 0; i < n; i++ ) {
+                if ( a[i] == b[i] )
+                    continue;
+                if ( a[i] == '.' )
+                    return true;
+                if ( b[i] == '.' )
+                    return false;
+                return (unsigned char) a[i] < (unsigned char) b[i];
+            }
+            return a.size() < b.size();
+        }
+
+        /** @return the field name in path starting at pos */
+        StringData nameAt(const std::string& path, size_t pos) {
+            size_t dot = path.find( '.', pos );
+            return StringData( path.data() + pos, ( dot == std::string::npos ? path.size() : dot ) - pos );
+        }
+    }
+
+    inplacepatch& inplacepatch::add(const StringData& path, Op op, BSONType type,
+                                    const void *value, int len) {
+        Patch p;
+        p.path = path.toString();
+        p.op = op;
+        p.type = type;
+        p.len = len;
+        memcpy( p.value, value, len );
+        std::vector<Patch>::iterator i = _patches.begin();
+        // after any for the same path, so they apply in order
+        while( i != _patches.end() && !pathLess( p.path, i->path ) )
+            ++i;
+        _patches.insert( i, p );
+        return *this;
+    }
+
+    inplacepatch& inplacepatch::setInt(const StringData& path, int x) {
+        x = endian_int( x );
+        return add( path, Set, NumberInt, &x, 4 );
+    }
+
+    inplacepatch& inplacepatch::setLong(const StringData& path, long long x) {
+        x = endian_ll( x );
+        return add( path, Set, NumberLong, &x, 8 );
+    }
+
+    inplacepatch& inplacepatch::setDouble(const StringData& path, double x) {
+        x = endian_d( x );
+        return add( path, Set, NumberDouble, &x, 8 );
+    }
+
+    inplacepatch& inplacepatch::setBool(const StringData& path, bool x) {
+        char b = x ? 1 : 0;
+        return add( path, Set, Bool, &b, 1 );
+    }
+
+    inplacepatch& inplacepatch::setDate(const StringData& path, Date_t x) {
+        long long ms = endian_ll( (long long) x.millis );
+        return add( path, Set, Date, &ms, 8 );
+    }
+
+    inplacepatch& inplacepatch::setTimestamp(const StringData& path, unsigned long long x) {
+        long long t = endian_ll( (long long) x );
+        return add( path, Set, Timestamp, &t, 8 );
+    }
+
+    inplacepatch& inplacepatch::setOID(const StringData& path, const OID& x) {
+        return add( path, Set, jstOID, x.getData(), OID::kOIDSize );
+    }
+
+    inplacepatch& inplacepatch::inc(const StringData& path, long long by) {
+        return add( path, Inc, EOO, &by, 8 );
+    }
+
+    inplacepatch& inplacepatch::incDouble(const StringData& path, double by) {
+        return add( path, IncDouble, EOO, &by, 8 );
+    }
+
+    /** applies p to the value of a field of type type.  @return false if it doesn't fit */
+    bool inplacepatch::applyOne(const Patch& p, char *value, BSONType type) {
+        if ( p.op == Set ) {
+            if ( type != p.type )
+                return false;
+            memcpy( value, p.value, p.len );
+            return true;
+        }
+
+        if ( p.op == IncDouble ) {
+            if ( type != NumberDouble )
+                return false;
+            double by, x;
+            memcpy( &by, p.value, 8 );
+            memcpy( &x, value, 8 );
+            x = endian_d( endian_d( x ) + by );
+            memcpy( value, &x, 8 );
+            return true;
+        }
+
+        long long by;
+        memcpy( &by, p.value, 8 );
+        switch( type ) {
+        case NumberInt: {
+            int x;
+            memcpy( &x, value, 4 );
+            long long r = (long long) endian_int( x ) + by;
+            if ( r < INT_MIN || r > INT_MAX )
+                return false;
+            x = endian_int( (int) r );
+            memcpy( value, &x, 4 );
+            return true;
+        }
+        case NumberLong: {
+            long long x;
+            memcpy( &x, value, 8 );
+            // unsigned, so overflow wraps rather than being undefined
+            x = endian_ll( (long long) ( (unsigned long long) endian_ll( x ) + (unsigned long long) by ) );
+            memcpy( value, &x, 8 );
+            return true;
+        }
+        case NumberDouble: {
+            double x;
+            memcpy( &x, value, 8 );
+            x = endian_d( endian_d( x ) + (double) by );
+            memcpy( value, &x, 8 );
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    /** the patches for one field name in an object */
+    struct inplacepatch::Group {
+        StringData name;
+        const Patch *begin, *end;
+        bool found;             // only the first field of a name counts
+
+        static bool less(const Group& g, const StringData& name) { return g.name < name; }
+    };
+
+    /** applies [begin, end) to the object at obj.  The patches' paths are the same up to
+        pos, which is where the names of fields in obj start in them.
+        @return the number that applied
+    */
+    int inplacepatch::applyIn(char *obj, const Patch *begin, const Patch *end, size_t pos) {
+        Group smallGroups[16];
+        std::vector<Group> bigGroups;
+        Group *groups = smallGroups;
+        if ( end - begin > 16 ) {
+            bigGroups.resize( end - begin );
+            groups = &bigGroups[0];
+        }
+        int nGroups = 0;
+        for( const Patch *p = begin; p != end; ) {
+            Group& g = groups[nGroups++];
+            g.name = nameAt( p->path, pos );
+            g.begin = p;
+            while( p != end && nameAt( p->path, pos ) == g.name )
+                ++p;
+            g.end = p;
+            g.found = false;
+        }
+
+        int applied = 0;
+        int left = nGroups;
+        for( char *p = obj + 4; *p != EOO && left > 0; ) {
+            bsonelement e( p );
+            StringData name = e.fieldNameStringData();
+            Group *g;
+            if ( nGroups <= 4 ) {
+                g = groups;
+                while( g != groups + nGroups && g->name != name )
+                    ++g;
+            }
+            else {
+                g = std::lower_bound( groups, groups + nGroups, name, Group::less );
+                if ( g != groups + nGroups && g->name != name )
+                    g = groups + nGroups;
+            }
+            if ( g != groups + nGroups && !g->found ) {
+                g->found = true;
+                left--;
+                size_t next = pos + name.size();
+                // those ending here come first, then those for fields inside this one
+                const Patch *q = g->begin;
+                for( ; q != g->end && q->path.size() == next; ++q )
+                    applied += applyOne( *q, const_cast<char *>( e.value() ), e.type() );
+                if ( q != g->end && e.isObject() )
+                    applied += applyIn( const_cast<char *>( e.value() ), q, g->end, next + 1 );
+            }
+            p += e.size();
+        }
+        return applied;
+    }
+
+    int inplacepatch::apply(const bsonobj& doc) const {
+        if ( _patches.empty() )
+            return 0;
+        const Patch *b = &_patches[0];
+        return applyIn( const_cast<char *>( doc.objdata() ), b, b + _patches.size(), 0 );
+    }
+
+}
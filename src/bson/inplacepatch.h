@@ -0,0 +1,93 @@
+// inplacepatch.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "bsonobj.h"
+#include "oid.h"
+#include "time_support.h"
+
+namespace _bson {
+
+    /** Changes to fixed size values -- NumberInt, NumberLong, NumberDouble, Bool, Date,
+        Timestamp, OID -- made by overwriting the value bytes where they are, in the
+        document's own buffer.  The document isn't rebuilt, or copied, and no bytes move:
+        the cost is finding the fields.
+
+        A patch only applies if the field exists and already has the patch's type, as a
+        value of another type may have another size.  inc() is the exception: it adds to
+        an int, long or double, keeping the type (an int that would overflow is left alone).
+
+        The patches are kept in path order, so apply() finds all of them in one walk of the
+        document, and stops walking each object once everything in it has been found.  Build
+        the patch once and apply it to any number of documents.
+
+        example:
+          inplacepatch p;
+          p.inc( "stats.hits", 1 ).setDate( "stats.last", now );
+          ...
+          p.apply( doc );       // doc's buffer is changed
+
+        apply() writes to the buffer of the bsonobj given it, though bsonobj is otherwise
+        read only.  The buffer must be the caller's to change -- for example that of a
+        bsonobjbuilder, or one read from a file -- and not shared with other readers.
+    */
+    class inplacepatch {
+    public:
+        inplacepatch& setInt(const StringData& path, int x);
+        inplacepatch& setLong(const StringData& path, long long x);
+        inplacepatch& setDouble(const StringData& path, double x);
+        inplacepatch& setBool(const StringData& path, bool x);
+        inplacepatch& setDate(const StringData& path, Date_t x);
+        inplacepatch& setTimestamp(const StringData& path, unsigned long long x);
+        inplacepatch& setOID(const StringData& path, const OID& x);
+
+        /** adds by to an int, long or double field */
+        inplacepatch& inc(const StringData& path, long long by);
+        /** adds by to a double field */
+        inplacepatch& incDouble(const StringData& path, double by);
+
+        /** applies the patches to doc, in place.  Patches for the same path apply in the
+            order they were made.  @return the number that applied
+        */
+        int apply(const bsonobj& doc) const;
+
+        int size() const { return (int) _patches.size(); }
+        bool empty() const { return _patches.empty(); }
+        void clear() { _patches.clear(); }
+
+    private:
+        enum Op { Set, Inc, IncDouble };
+
+        struct Patch {
+            std::string path;
+            Op op;
+            BSONType type;          // what the field must be, for Set
+            int len;
+            char value[12];         // little endian, as in the document
+        };
+
+        struct Group;
+
+        inplacepatch& add(const StringData& path, Op op, BSONType type, const void *value, int len);
+        static bool applyOne(const Patch& p, char *value, BSONType type);
+        static int applyIn(char *obj, const Patch *begin, const Patch *end, size_t pos);
+
+        std::vector<Patch> _patches;    // by path, a field name at a time
+    };
+
+}
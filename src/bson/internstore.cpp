@@ -0,0 +1,189 @@
+// internstore.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cstring>
+#include "internstore.h"
+#include "bsonobjbuilder.h"
+#include "bsonobjiterator.h"
+#include "bson_validate.h"
+
+namespace _bson {
+
+    internstore::internstore() { }
+
+    internstore::~internstore() {
+        for( int i = 0; i < NShards; i++ ) {
+            Shard& s = _shards[i];
+            for( size_t c = 0; c < s.chunks.size(); c++ )
+                delete[] s.chunks[c];
+            for( int k = 0; k < NSegments; k++ )
+                delete[] s.segments[k].load();
+        }
+    }
+
+    /** copies o into s's chunks.  Called with s.m held. */
+    const char * internstore::store(Shard& s, const bsonobj& o) {
+        size_t sz = o.objsize();
+        if ( sz > s.left ) {
+            size_t n = std::max( sz, (size_t) ChunkSize );
+            s.chunks.push_back( new char[n] );
+            // the unused end of the previous chunk is overhead now
+            s.stats.overhead += s.left;
+            s.cur = s.chunks.back();
+            s.left = n;
+        }
+        char *p = s.cur;
+        memcpy( p, o.objdata(), sz );
+        s.cur += sz;
+        s.left -= sz;
+        return p;
+    }
+
+    internstore::handle internstore::intern(const bsonobj& o) {
+        unsigned long long h = o.hash64();
+        unsigned shard = (unsigned) ( h >> ( 64 - ShardBits ) );
+        Shard& s = _shards[shard];
+        std::lock_guard<std::mutex> lk( s.m );
+        s.stats.lookups++;
+        s.stats.bytesIn += o.objsize();
+
+        typedef std::unordered_multimap<unsigned long long, handle>::const_iterator It;
+        std::pair<It, It> r = s.index.equal_range( h );
+        for( It i = r.first; i != r.second; ++i ) {
+            if ( get( i->second ).binaryEqual( o ) )
+                return i->second;
+        }
+
+        massert( 18110, "internstore is full", s.n < ( 1u << ( 32 - ShardBits ) ) );
+        unsigned i = s.n + SegBase;
+        int seg = msb( i ) - SegBaseBits;
+        const char **slots = s.segments[seg].load( std::memory_order_relaxed );
+        if ( slots == 0 ) {
+            size_t n = (size_t) 1 << ( seg + SegBaseBits );
+            slots = new const char *[n];
+            s.stats.overhead += n * sizeof(const char *);
+            s.segments[seg].store( slots, std::memory_order_release );
+        }
+        slots[i - ( 1u << ( seg + SegBaseBits ) )] = store( s, o );
+        handle x = ( s.n << ShardBits ) | shard;
+        s.n.store( s.n + 1, std::memory_order_release );   // has() may be reading it
+        s.index.insert( std::make_pair( h, x ) );
+        s.stats.distinct++;
+        s.stats.bytesStored += o.objsize();
+        // node, bucket and slot per entry, near enough
+        s.stats.overhead += sizeof(std::pair<unsigned long long, handle>) + 3 * sizeof(void *);
+        return x;
+    }
+
+    void internstore::appendRef(bsonobjbuilder& b, const StringData& fieldName, handle h,
+                                BSONType type) const {
+        char ref[5];
+        ref[0] = (char) type;
+        unsigned x = endian( h );
+        memcpy( ref + 1, &x, 4 );
+        b.appendBinData( fieldName, 5, (BinDataType) RefSubtype, ref );
+    }
+
+    bool internstore::isRef(const bsonelement& e) {
+        return e.type() == BinData && e.valuesize() == 4 + 1 + 5 &&
+               (unsigned char) e.value()[4] == RefSubtype;
+    }
+
+    void internstore::compactInto(const bsonobj& o, bsonobjbuilder& b, int minSize) {
+        for( bsonelemiterator i = o.begin(); i != o.end(); ++i ) {
+            const bsonelement& e = *i;
+            if ( e.isObject() && e.valuesize() >= minSize ) {
+                // children first, so what they share is kept once too
+                bsonobjbuilder sub( e.valuesize() );
+                compactInto( e.object(), sub, minSize );
+                appendRef( b, e.fieldNameStringData(), intern( sub.done() ), e.type() );
+            }
+            else {
+                b.append( e );
+            }
+        }
+    }
+
+    bsonobj internstore::compact(const bsonobj& doc, bsonobjbuilder& b, int minSize) {
+        compactInto( doc, b, minSize );
+        return b.obj();
+    }
+
+    namespace {
+        /** @return true if e is a reference to an object in store, setting h and type to
+            what it refers to.  Handles from elsewhere aren't: get() can't be given them.
+        */
+        bool refTo(const internstore& store, const bsonelement& e, internstore::handle& h,
+                   char& type) {
+            if ( !internstore::isRef( e ) )
+                return false;
+            const char *ref = e.value() + 5;
+            type = ref[0];
+            memcpy( &h, ref + 1, 4 );
+            h = endian( h );
+            return ( type == Object || type == Array ) && store.has( h );
+        }
+
+        /** @param depth of o below the document being expanded, references counted as
+                   nesting.  Bounded, as a reference can name an object that refers back to
+                   it: compact() and intern() copy BinData of RefSubtype from their input.
+        */
+        void expandInto(const internstore& store, const bsonobj& o, bsonobjbuilder& b,
+                        int depth) {
+            massert( 18122, "internstore: references nested too deep, or in a cycle",
+                     depth <= BSONValidateMaxDepth );
+            for( bsonelemiterator i = o.begin(); i != o.end(); ++i ) {
+                const bsonelement& e = *i;
+                internstore::handle h;
+                char type;
+                if ( refTo( store, e, h, type ) ) {
+                    bsonobjbuilder sub( type == Array ? b.subarrayStart( e.fieldNameStringData() )
+                                                      : b.subobjStart( e.fieldNameStringData() ) );
+                    expandInto( store, store.get( h ), sub, depth + 1 );
+                    sub.done();
+                }
+                else if ( e.isObject() ) {
+                    bsonobjbuilder sub( e.type() == Array ? b.subarrayStart( e.fieldNameStringData() )
+                                                          : b.subobjStart( e.fieldNameStringData() ) );
+                    expandInto( store, e.object(), sub, depth + 1 );
+                    sub.done();
+                }
+                else {
+                    b.append( e );
+                }
+            }
+        }
+    }
+
+    bsonobj internstore::expand(const bsonobj& compacted, bsonobjbuilder& b) const {
+        expandInto( *this, compacted, b, 0 );
+        return b.obj();
+    }
+
+    internstore::Stats internstore::stats() const {
+        Stats t;
+        for( int i = 0; i < NShards; i++ ) {
+            const Shard& s = _shards[i];
+            std::lock_guard<std::mutex> lk( s.m );
+            t.lookups += s.stats.lookups;
+            t.distinct += s.stats.distinct;
+            t.bytesIn += s.stats.bytesIn;
+            t.bytesStored += s.stats.bytesStored;
+            t.overhead += s.stats.overhead;
+        }
+        return t;
+    }
+
+}
@@ -0,0 +1,181 @@
+// internstore.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "bsonobj.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace _bson {
+
+    class bsonobjbuilder;
+
+    /** Holds one copy of each distinct object given to it -- hash consing -- for documents
+        that repeat the same large embedded objects (device descriptors, schemas) over and
+        over.
+
+        Objects are found by hash64() and confirmed with binaryEqual().  Each gets a handle,
+        a 32 bit number.  A builder can put a reference to an interned object in a document
+        in place of the object itself -- appendRef(), or compact() for a whole document --
+        and expand() puts the objects back when the document leaves memory.
+
+        A reference is a BinData element of subtype RefSubtype holding the object's type and
+        handle, 10 bytes of value whatever the size of the object.  compact() interns bottom
+        up: the large children of an object are interned first and the object is interned
+        in its compacted form, so objects that differ in one field still share everything
+        else.
+
+        example:
+          internstore store;
+          ...
+          bsonobjbuilder b;
+          bsonobj small = store.compact( event, b );   // keep this
+          ...
+          bsonobjbuilder e;
+          bsonobj full = store.expand( small, e );     // binaryEqual to event
+
+        intern(), get() and the rest may be called from any number of threads at once.
+        get() takes no lock; intern() locks one of 16 shards, picked by hash.  Interned
+        objects stay in memory, at fixed addresses, until the store is destroyed.
+    */
+    class internstore {
+    public:
+        typedef unsigned handle;
+
+        /** BinData subtype of references.  A user defined subtype: don't use it for BinData
+            of your own in documents that get expanded.
+        */
+        static const int RefSubtype = 0xf0;
+
+        internstore();
+        ~internstore();
+
+        /** @return the handle of the store's copy of o, which is made if there isn't one */
+        handle intern(const bsonobj& o);
+
+        /** @return true if h is a handle this store has given out */
+        bool has(handle h) const {
+            return ( h >> ShardBits ) <
+                   _shards[h & ( NShards - 1 )].n.load( std::memory_order_acquire );
+        }
+
+        /** @return the object interned as h, which must be a handle of this store (see
+            has()).  Valid as long as the store.
+        */
+        bsonobj get(handle h) const {
+            unsigned shard = h & ( NShards - 1 );
+            unsigned i = ( h >> ShardBits ) + SegBase;
+            int seg = msb( i ) - SegBaseBits;
+            const char * const *s = _shards[shard].segments[seg].load( std::memory_order_acquire );
+            return bsonobj( s[i - ( 1u << ( seg + SegBaseBits ) )] );
+        }
+
+        /** appends a reference to the object interned as h under fieldName.
+            @param type Object or Array: what the reference expands to
+        */
+        void appendRef(bsonobjbuilder& b, const StringData& fieldName, handle h,
+                       BSONType type = Object) const;
+
+        /** appends a reference to o, interning it */
+        void appendInterned(bsonobjbuilder& b, const StringData& fieldName, const bsonobj& o,
+                            BSONType type = Object) {
+            appendRef( b, fieldName, intern( o ), type );
+        }
+
+        /** builds doc into b with each embedded object or array of minSize bytes or more
+            replaced by a reference.  @return b.obj()
+        */
+        bsonobj compact(const bsonobj& doc, bsonobjbuilder& b, int minSize = 64);
+
+        /** builds compacted into b with every reference, at any depth, replaced by the
+            object it refers to.  BinData of RefSubtype whose handle this store never gave
+            out, or whose type isn't Object or Array, is copied as it is, so a reference
+            made by another store may name an object of this one.  Objects can refer to
+            each other in a cycle, as intern() and compact() take references from their
+            input as they are; expand() throws (massert 18122) past BSONValidateMaxDepth
+            levels of nesting, references included, rather than follow one.
+            @return b.obj()
+        */
+        bsonobj expand(const bsonobj& compacted, bsonobjbuilder& b) const;
+
+        /** @return true if e is a reference made by appendRef() */
+        static bool isRef(const bsonelement& e);
+
+        struct Stats {
+            unsigned long long lookups;     // intern() calls, compact()'s included
+            unsigned long long distinct;    // objects stored
+            unsigned long long bytesIn;     // size of everything intern() was given
+            unsigned long long bytesStored; // size of the distinct objects
+            unsigned long long overhead;    // index and allocation bytes beyond bytesStored
+            Stats() : lookups(0), distinct(0), bytesIn(0), bytesStored(0), overhead(0) { }
+            /** bytes in for each byte kept */
+            double dedupRatio() const { return bytesStored ? (double) bytesIn / bytesStored : 1.0; }
+            /** memory saved by keeping one copy, net of the store's own overhead */
+            long long bytesSaved() const { return (long long) bytesIn - (long long) ( bytesStored + overhead ); }
+        };
+
+        /** @return totals so far.  Counts from concurrent intern() calls may or may not be
+            included.
+        */
+        Stats stats() const;
+
+    private:
+        internstore(const internstore&);
+        internstore& operator=(const internstore&);
+
+        enum { ShardBits = 4, NShards = 1 << ShardBits,
+               SegBaseBits = 10, SegBase = 1 << SegBaseBits,   // segment k holds 2^(k+10)
+               NSegments = 32 - ShardBits - SegBaseBits + 1,
+               ChunkSize = 1024 * 1024 };
+
+        static int msb(unsigned x) {
+#if defined(_MSC_VER)
+            unsigned long i;
+            _BitScanReverse( &i, x );
+            return (int) i;
+#else
+            return 31 - __builtin_clz( x );
+#endif
+        }
+
+        struct Shard {
+            mutable std::mutex m;
+            std::unordered_multimap<unsigned long long, handle> index;    // hash64 -> handle
+            std::atomic<const char **> segments[NSegments];
+            std::atomic<unsigned> n;        // objects in this shard; set after their slots
+            std::vector<char *> chunks;     // where the objects are
+            char *cur;
+            size_t left;
+            Stats stats;
+            Shard() : n(0), cur(0), left(0) {
+                for( int i = 0; i < NSegments; i++ )
+                    segments[i].store( 0 );
+            }
+        };
+
+        const char * store(Shard& s, const bsonobj& o);
+        void compactInto(const bsonobj& o, bsonobjbuilder& b, int minSize);
+
+        Shard _shards[NShards];
+    };
+
+}
@@ -23,6 +23,7 @@
 #include "bsonobjbuilder.h"
 #include "hex.h"
 #include "parse_number.h"
+#include "utf8.h"
 
 using namespace std;
 
@@ -75,12 +76,18 @@ namespace _bson {
                  *SINGLEQUOTE = "'",
                  *DOUBLEQUOTE = "\"";
 
-    JParse::JParse(istream& i) : _in(i), _offset(0) {}
+    JParse::JParse(istream& i, bool messages) : _in(i), _offset(0), _messages(messages) {}
 //        : _buf(str), _input(str), _input_end(str + strlen(str)) {}
 
-    Status JParse::parseError(const StringData& msg) {
+    Status JParse::parseError(const char *msg) {
+        if ( !_messages )
+            return Status::literal(FailedToParse, msg);
+        return parseError(std::string(msg));
+    }
+
+    Status JParse::parseError(const std::string& msg) {
         std::ostringstream ossmsg;
-        ossmsg << msg.toString();
+        ossmsg << msg;
         ossmsg << " line:" << line;
         ossmsg << ", file_offset:" << offset() << ", doc_number:" << doc_number;
         return Status(FailedToParse, ossmsg.str());
@@ -387,9 +394,13 @@ namespace _bson {
             return ret;
         }
         if (id.size() != 24) {
+            if (!_messages)
+                return parseError("Expected 24 hex digits");
             return parseError("Expected 24 hex digits: " + id);
         }
         if (!isHexString(id)) {
+            if (!_messages)
+                return parseError("Expected hex digits");
             return parseError("Expected hex digits: " + id);
         }
         builder.append(fieldName, OID(id));
@@ -822,9 +833,13 @@ namespace _bson {
             return parseError("Expected ')'");
         }
         if (id.size() != 24) {
+            if (!_messages)
+                return parseError("Expected 24 hex digits");
             return parseError("Expected 24 hex digits: " + id);
         }
         if (!isHexString(id)) {
+            if (!_messages)
+                return parseError("Expected hex digits");
             return parseError("Expected hex digits: " + id);
         }
         builder.append(fieldName, OID(id));
@@ -959,6 +974,8 @@ namespace _bson {
         std::size_t i;
         for (i = 0; i < opt.size(); i++) {
             if (!match(opt[i], JOPTIONS)) {
+                if (!_messages)
+                    return parseError("Bad regex option");
                 return parseError(string("Bad regex option: ") + opt[i]);
             }
         }
@@ -1077,6 +1094,7 @@ namespace _bson {
         if (eof()) {
             return parseError("Unexpected end of input");
         }
+        size_t start = result->size();
         while (1) {
             if (eof())
                 break;
@@ -1107,22 +1125,41 @@ namespace _bson {
                     case 'r':  result->push_back('\r'); break;
                     case 't':  result->push_back('\t'); break;
                     case 'u': { //expect 4 hexdigits
-                        // TODO: handle UTF-16 surrogate characters
                         getc();
-                        stringstream ss;
-                        ss << getc() << getc() << getc() << peek();
-                        string s = ss.str();
-                            if (!isHexString(s)) {
-                                return parseError("Expected 4 hex digits");
+                        unsigned cp;
+                        Status ret = hexEscape(&cp);
+                        if (ret != Status::OK()) {
+                            return ret;
+                        }
+                        if (cp >= 0xD800 && cp <= 0xDBFF) {
+                            // a high surrogate: with the low one after it, a code
+                            // point past U+FFFF
+                            getc();
+                            if (peek() != '\\') {
+                                return parseError("Expected a low surrogate");
+                            }
+                            getc();
+                            if (peek() != 'u') {
+                                return parseError("Expected a low surrogate");
                             }
-                            unsigned char first = fromHex(s);
-                            unsigned char second = fromHex(s.c_str() + 2);
-                            const std::string& utf8str = encodeUTF8(first, second);
-                            for (unsigned int i = 0; i < utf8str.size(); i++) {
-                                result->push_back(utf8str[i]);
+                            getc();
+                            unsigned low;
+                            ret = hexEscape(&low);
+                            if (ret != Status::OK()) {
+                                return ret;
                             }
-                            break;
+                            if (low < 0xDC00 || low > 0xDFFF) {
+                                return parseError("Expected a low surrogate");
+                            }
+                            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        }
+                        else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                            return parseError("Low surrogate without a high surrogate");
                         }
+                        char utf8[4];
+                        result->append(utf8, encodeUTF8(cp, utf8));
+                        break;
+                    }
                     // Vertical tab character.  Not in JSON spec but allowed in
                     // our implementation according to test suite.
                     case 'v':  result->push_back('\v'); break;
@@ -1147,26 +1184,25 @@ namespace _bson {
             }
         }
         if (!eof()) {
+            if (!isValidUTF8(result->data() + start, result->size() - start)) {
+                return parseError("Invalid UTF-8");
+            }
             return Status::OK();
         }
         return parseError("Unexpected end of input");
     }
 
-    std::string JParse::encodeUTF8(unsigned char first, unsigned char second) const {
-        std::ostringstream oss;
-        if (first == 0 && second < 0x80) {
-            oss << second;
+    Status JParse::hexEscape(unsigned* codeUnit) {
+        stringstream ss;
+        ss << getc() << getc() << getc() << peek();
+        string s = ss.str();
+        if (!isHexString(s)) {
+            return parseError("Expected 4 hex digits");
         }
-        else if (first < 0x08) {
-            oss << char( 0xc0 | (first << 2 | second >> 6) );
-            oss << char( 0x80 | (~0xc0 & second) );
-        }
-        else {
-            oss << char( 0xe0 | (first >> 4) );
-            oss << char( 0x80 | (~0xc0 & (first << 2 | second >> 6) ) );
-            oss << char( 0x80 | (~0xc0 & second) );
-        }
-        return oss.str();
+        unsigned char first = fromHex(s);
+        unsigned char second = fromHex(s.c_str() + 2);
+        *codeUnit = first << 8 | second;
+        return Status::OK();
     }
 
     inline bool JParse::peekToken(const char* token) {
@@ -1298,6 +1334,34 @@ namespace _bson {
         doc_number++;
         return builder.obj();
     }
+    StatusWith<bsonobj> tryFromjson(std::istream& i, bsonobjbuilder& builder,
+                                    unsigned long long *errorOffset, bool withMessage) {
+        if (i.eof()) {
+            return StatusWith<bsonobj>(bsonobj());
+        }
+
+        JParse jparse(i, withMessage);
+        Status ret = Status::OK();
+        try {
+            ret = jparse.object("UNUSED", builder, false);
+        }
+        catch(std::exception& e) {
+            if (!withMessage)
+                ret = Status::literal(FailedToParse, "caught exception from within JSON parser");
+            else
+                ret = Status(FailedToParse,
+                             string("caught exception from within JSON parser: ") + e.what());
+        }
+
+        if (!ret.isOK()) {
+            if (errorOffset)
+                *errorOffset = jparse.offset();
+            return StatusWith<bsonobj>(ret);
+        }
+        doc_number++;
+        return StatusWith<bsonobj>(builder.obj());
+    }
+
     /*
     bsonobj fromjson(const std::string& str, bsonobjbuilder& b) {
         return fromjson( str.c_str(), b );
@@ -17,6 +17,7 @@
 
 #include <string>
 #include <istream>
+#include "status_with.h"
 
 namespace _bson {
     class Status;
@@ -39,6 +40,17 @@ namespace _bson {
      */
      bsonobj fromjson(std::istream&, bsonobjbuilder& builder);
 
+    /**
+     * fromjson() that throws nothing: the object, or a Status of FailedToParse.  For input
+     * where bad documents are expected -- with withMessage false, the default, no string is
+     * built for an error: the Status's reason is a literal saying what was wrong ("Expected
+     * '{'") without the line and offset, and *errorOffset, if given, is set to the offset.
+     * (An ISO-8601 $date that doesn't parse still builds its message.)
+     */
+     StatusWith<bsonobj> tryFromjson(std::istream&, bsonobjbuilder& builder,
+                                     unsigned long long *errorOffset = 0,
+                                     bool withMessage = false);
+
     /** @param len will be size of JSON object in text chars. */
      //bsonobj  fromjson(const char* str, int* len=NULL);
 
@@ -50,10 +62,14 @@ namespace _bson {
     class JParse {
         std::istream& _in;
         unsigned long long _offset;
+        bool _messages;
 
         std::string get(const char *chars_wanted);
     public:
-        explicit JParse(std::istream&);
+        /** @param messages false to report errors with literals, allocating nothing; see
+            parseError()
+        */
+        explicit JParse(std::istream&, bool messages = true);
 
             /*
              * Notation: All-uppercase symbols denote non-terminals; all other
@@ -339,17 +355,16 @@ namespace _bson {
              *
              * If there is not an error, result will contain a null terminated
              * string, but there is no guarantee that it will not contain other
-             * null characters.
+             * null characters.  It is valid UTF-8: other input is an error, as
+             * is a \u escape of half a UTF-16 surrogate pair without the other.
              */
             _bson::Status chars(std::string* result, const char* terminalSet, const char* allowedSet=NULL);
 
             /**
-             * Converts the two byte Unicode code point to its UTF8 character
-             * encoding representation.  This function returns a string because
-             * UTF8 encodings for code points from 0x0000 to 0xFFFF can range
-             * from one to three characters.
+             * Reads the four hex digits of a \u escape into *codeUnit.  As with
+             * the other escapes, the last character is peeked, not read.
              */
-            std::string encodeUTF8(unsigned char first, unsigned char second) const;
+            _bson::Status hexEscape(unsigned* codeUnit);
 
             /**
              * @return true if the given token matches the next non whitespace
@@ -402,9 +417,17 @@ namespace _bson {
 
             /**
              * @return FailedToParse status with the given message and some
-             * additional context information
+             * additional context information.  If messages weren't asked for,
+             * just msg, with nothing allocated: msg must be a literal.
+             */
+            _bson::Status parseError(const char *msg);
+
+            /**
+             * parseError() for a message built at run time.  It always makes
+             * the full message, so callers should check _messages and pass a
+             * literal instead when it's false.
              */
-            _bson::Status parseError(const StringData& msg);
+            _bson::Status parseError(const std::string& msg);
         public:
             inline long long offset() { return _offset; }
 
@@ -0,0 +1,284 @@
+// keycomparator.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "keycomparator.h"
+#include "bsonobjiterator.h"
+#include "float_utils.h"
+
+namespace _bson {
+
+    namespace {
+
+        /** types compareValues() handles */
+        bool fastType(int t) {
+            switch ( t ) {
+            case NumberInt:
+            case NumberLong:
+            case NumberDouble:
+            case Date:
+            case String:
+            case jstOID:
+                return true;
+            }
+            return false;
+        }
+
+        /** @return bytes of fixed width value of type t, or 0 */
+        int fixedWidth(int t) {
+            switch ( t ) {
+            case NumberInt: return 4;
+            case NumberLong: return 8;
+            case jstOID: return 12;
+            }
+            return 0;
+        }
+
+        inline long long loadLong(const char *p) {
+            long long x;
+            memcpy( &x, p, sizeof(x) );
+            return endian_ll( x );
+        }
+
+        inline double loadDouble(const char *p) {
+            long long x = loadLong( p );
+            double d;
+            memcpy( &d, &x, sizeof(d) );
+            return d;
+        }
+
+        template <typename T>
+        inline int cmp3(T a, T b) {
+            return a < b ? -1 : ( b < a ? 1 : 0 );
+        }
+
+        /** compares two values of fast type t as compareElementValues() does.  a and b point
+            at the values; *size gets the size of each.
+        */
+        inline int compareValues(int t, const char *a, const char *b, int *aSize, int *bSize) {
+            switch ( t ) {
+            case NumberInt:
+                *aSize = *bSize = 4;
+                return cmp3( readInt( a ), readInt( b ) );
+            case NumberLong:
+            case Date:
+                *aSize = *bSize = 8;
+                return cmp3( loadLong( a ), loadLong( b ) );
+            case NumberDouble: {
+                *aSize = *bSize = 8;
+                double x = loadDouble( a ), y = loadDouble( b );
+                if ( x < y )
+                    return -1;
+                if ( x == y )
+                    return 0;
+                if ( isNaN( x ) )
+                    return isNaN( y ) ? 0 : -1;
+                return 1;
+            }
+            case jstOID:
+                *aSize = *bSize = 12;
+                return memcmp( a, b, 12 );
+            default: { // String
+                int la = readInt( a ), lb = readInt( b );  // include the terminating null
+                *aSize = 4 + la;
+                *bSize = 4 + lb;
+                int c = memcmp( a + 4, b + 4, std::min( la, lb ) );
+                return c ? c : la - lb;
+            }
+            }
+        }
+
+    }
+
+    keycomparator::keycomparator(const bsonobj& keyPattern, bool considerFieldName, bool useDotted)
+        : _considerFieldName(considerFieldName), _dotted(useDotted), _fixedSize(0), _fixedWidth(0) {
+        for( bsonelemiterator i = keyPattern.begin(); i != keyPattern.end(); ++i ) {
+            Field f;
+            f.name = i->fieldName();
+            for( size_t d = f.name.find( '.' ); d != std::string::npos; d = f.name.find( '.', d + 1 ) )
+                f.dots.push_back( d );
+            f.descending = i->number() < 0;
+            f.expected = EOO;
+            _fields.push_back( f );
+        }
+    }
+
+    void keycomparator::expectTypes(const bsonobj& sample) {
+        // a key (all names empty) has the k'th field as its k'th element; in a document the
+        // fields are looked up
+        std::vector<bsonelement> elems;
+        bool isKey = true;
+        for( bsonelemiterator i = sample.begin(); i != sample.end(); ++i ) {
+            elems.push_back( *i );
+            if ( *i->fieldName() )
+                isKey = false;
+        }
+        for( size_t k = 0; k < _fields.size(); k++ ) {
+            bsonelement v;
+            if ( !isKey )
+                v = lookup( sample, _fields[k] );
+            else if ( k < elems.size() )
+                v = elems[k];
+            _fields[k].expected = (signed char) ( !v.eoo() && fastType( v.type() ) ? v.type() : EOO );
+        }
+
+        // fixed layout: a field per element, all of the same fixed width type
+        _fixedSize = _fixedWidth = 0;
+        if ( isKey && elems.size() == _fields.size() && !_fields.empty() && !_considerFieldName ) {
+            int t = _fields[0].expected;
+            int w = fixedWidth( t );
+            for( size_t k = 1; k < _fields.size(); k++ ) {
+                if ( _fields[k].expected != t )
+                    w = 0;
+            }
+            if ( w ) {
+                _fixedWidth = 2 + w;
+                _fixedSize = 4 + (int) _fields.size() * _fixedWidth + 1;
+            }
+        }
+    }
+
+    /** compares keys laid out as _fixedSize / _fixedWidth say.  @return 2 if they aren't */
+    int keycomparator::compareFixed(const char *l, const char *r) const {
+        int t = _fields[0].expected;
+        const char *p = l + 4;
+        const char *q = r + 4;
+        for( size_t k = 0; k < _fields.size(); k++, p += _fixedWidth, q += _fixedWidth ) {
+            if ( p[0] != t || q[0] != t || p[1] || q[1] )
+                return 2;
+        }
+        p = l + 6;
+        q = r + 6;
+        for( size_t k = 0; k < _fields.size(); k++, p += _fixedWidth, q += _fixedWidth ) {
+            int x;
+            switch ( t ) {
+            case NumberInt:
+                x = cmp3( readInt( p ), readInt( q ) );
+                break;
+            case NumberLong:
+                x = cmp3( loadLong( p ), loadLong( q ) );
+                break;
+            default:
+                x = memcmp( p, q, 12 );
+                break;
+            }
+            if ( x )
+                return _fields[k].descending ? -x : x;
+        }
+        return 0;
+    }
+
+    int keycomparator::compare(const bsonobj& l, const bsonobj& r) const {
+        if ( l.isEmpty() )
+            return r.isEmpty() ? 0 : -1;
+        if ( r.isEmpty() )
+            return 1;
+
+        if ( _fixedSize && l.objsize() == _fixedSize && r.objsize() == _fixedSize ) {
+            int x = compareFixed( l.objdata(), r.objdata() );
+            if ( x != 2 )
+                return x;
+        }
+
+        const char *p = l.objdata() + 4;
+        const char *q = r.objdata() + 4;
+        for( size_t k = 0; ; k++ ) {
+            int lt = *p;
+            int rt = *q;
+            if ( lt == EOO )
+                return rt == EOO ? 0 : -1;
+            if ( rt == EOO )
+                return 1;
+
+            bool descending = k < _fields.size() && _fields[k].descending;
+            int x;
+            if ( lt == rt && k < _fields.size() && lt == _fields[k].expected ) {
+                const char *pv = p + 1;
+                const char *qv = q + 1;
+                if ( _considerFieldName ) {
+                    x = strcmp( pv, qv );
+                    if ( x )
+                        return descending ? -x : x;
+                }
+                pv += strlen( pv ) + 1;
+                qv += strlen( qv ) + 1;
+                int ps, qs;
+                x = compareValues( lt, pv, qv, &ps, &qs );
+                p = pv + ps;
+                q = qv + qs;
+            }
+            else {
+                bsonelement a( p );
+                bsonelement b( q );
+                x = a.woCompare( b, _considerFieldName );
+                p += a.size();
+                q += b.size();
+            }
+            if ( x )
+                return descending ? -x : x;
+        }
+    }
+
+    /** the field as getFieldDotted() finds it, without re-splitting the name */
+    bsonelement keycomparator::lookup(const bsonobj& doc, const Field& f) const {
+        if ( !_dotted || f.dots.empty() )
+            return doc.getField( f.name );
+        bsonobj cur = doc;
+        size_t start = 0;
+        for( size_t d = 0; ; d++ ) {
+            bsonelement e = cur.getField( StringData( f.name.c_str() + start, f.name.size() - start ) );
+            if ( !e.eoo() || d == f.dots.size() )
+                return e;
+            cur = cur.getObjectField( StringData( f.name.c_str() + start, f.dots[d] - start ) );
+            if ( cur.isEmpty() )
+                return bsonelement();
+            start = f.dots[d] + 1;
+        }
+    }
+
+    int keycomparator::compareDocuments(const bsonobj& l, const bsonobj& r) const {
+        if ( l.isEmpty() )
+            return r.isEmpty() ? 0 : -1;
+        if ( r.isEmpty() )
+            return 1;
+        uassert( 10060, "woSortOrder needs a non-empty sortKey", !_fields.empty() );
+
+        // { "" : null } -- missing fields sort as null
+        static const char nullObj[] = { 7, 0, 0, 0, jstNULL, 0, 0 };
+
+        for( size_t k = 0; k < _fields.size(); k++ ) {
+            const Field& f = _fields[k];
+            bsonelement a = lookup( l, f );
+            bsonelement b = lookup( r, f );
+            int x;
+            if ( !a.eoo() && a.type() == f.expected && b.type() == f.expected ) {
+                int as, bs;
+                x = compareValues( f.expected, a.value(), b.value(), &as, &bs );
+            }
+            else {
+                if ( a.eoo() )
+                    a = bsonobj( nullObj ).firstElement();
+                if ( b.eoo() )
+                    b = bsonobj( nullObj ).firstElement();
+                x = a.woCompare( b, false );
+            }
+            if ( x )
+                return f.descending ? -x : x;
+        }
+        return 0;
+    }
+
+}
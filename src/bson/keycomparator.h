@@ -0,0 +1,87 @@
+// keycomparator.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "bsonobj.h"
+
+namespace _bson {
+
+    /** A comparator compiled once from a key pattern such as { a : 1, b : -1 }.
+
+        compare(l, r) gives the order of l.woCompare(r, keyPattern, considerFieldName) for
+        keys; compareDocuments(l, r) the order of l.woSortOrder(r, keyPattern, useDotted) for
+        whole documents.  Unlike Ordering there is no limit on the number of fields.
+
+        The directions and the split up field paths are worked out once, here, rather than
+        by walking the pattern with a third iterator on every comparison.  After
+        expectTypes() each field also has an expected type; a pair of values that both have
+        it are compared straight from the bytes -- ints, longs, doubles and dates as numbers,
+        strings and OIDs with memcmp -- with no bsonelement built, and anything else falls
+        back to bsonelement::woCompare().  Keys whose fields are all NumberInt, all
+        NumberLong or all OID with empty names (the usual index key) sit at fixed offsets;
+        those are compared without walking the elements at all.
+
+        example:
+          keycomparator c( keyPattern );   // e.g. { ts : -1, _id : 1 }
+          c.expectTypes( keys[0] );
+          std::sort( keys.begin(), keys.end(), c );
+
+        const methods are thread safe.
+    */
+    class keycomparator {
+    public:
+        explicit keycomparator(const bsonobj& keyPattern, bool considerFieldName = false,
+                               bool useDotted = true);
+
+        /** Sets the expected type of each field from the values of sample -- a key for
+            compare() or a document for compareDocuments().  Fields sample lacks are not
+            specialized.
+        */
+        void expectTypes(const bsonobj& sample);
+
+        /** @return <0, 0, >0 as l.woCompare(r, keyPattern, considerFieldName).  Key fields
+            past the end of the pattern are ascending.
+        */
+        int compare(const bsonobj& l, const bsonobj& r) const;
+
+        /** @return <0, 0, >0 as l.woSortOrder(r, keyPattern, useDotted) */
+        int compareDocuments(const bsonobj& l, const bsonobj& r) const;
+
+        bool operator()(const bsonobj& l, const bsonobj& r) const { return compare( l, r ) < 0; }
+
+        int nFields() const { return (int) _fields.size(); }
+
+    private:
+        struct Field {
+            std::string name;
+            std::vector<size_t> dots;   // positions of the '.'s in name
+            bool descending;
+            signed char expected;       // a BSONType, or EOO if not specialized
+        };
+
+        bsonelement lookup(const bsonobj& doc, const Field& f) const;
+        int compareFixed(const char *l, const char *r) const;
+
+        std::vector<Field> _fields;
+        bool _considerFieldName;
+        bool _dotted;
+        int _fixedSize;         // objsize of a fixed layout key, or 0 if there is none
+        int _fixedWidth;        // bytes per element in a fixed layout key
+    };
+
+}
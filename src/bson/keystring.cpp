@@ -0,0 +1,635 @@
+// keystring.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "keystring.h"
+#include "bsonobjbuilder.h"
+#include "bsonobjiterator.h"
+#include "float_utils.h"
+
+namespace _bson {
+
+    namespace {
+
+        /* Layout.  A key is its values one after another then End.  A value is
+             tag -- canonicalizeBSONType() + TagBias, so 9 (MinKey) .. 137 (MaxKey)
+             the encoding of the value for its canonical type
+           and all of a descending value's bytes are inverted, which puts ascending tags in
+           [9, 137] and descending ones in [118, 246].  End is below both so a key that is a
+           prefix of another sorts first, as woCompare has it.
+
+           Values of embedded objects are preceded by their field name, as a cstring, and an
+           object ends with End.  Strings are terminated by 0x00 with zero bytes inside them
+           escaped as 0x00 0xff; nothing that can follow a terminator is 0xff, so a string
+           sorts before any string it is a prefix of.
+        */
+        enum { End = 4, TagBias = 10 };
+
+        /* a number is a class byte, and for Negative / Positive the magnitude as a binary
+           exponent (2 bytes, biased) and the bits after the leading one (8 bytes) -- that
+           covers every double and every long long exactly.  Negative magnitudes are inverted.
+        */
+        enum NumberClass { NaNClass = 1, NegInfinity, Negative, Zero, Positive, PosInfinity };
+        enum { ExponentBias = 0x8000 };
+
+        /* typeBits holds one byte per value, the BSON type, in the order the values are
+           written.  NegativeZero is or'd in for a NumberDouble -0.0.
+        */
+        enum { NegativeZero = 0x80 };
+
+        inline int highBit(unsigned long long x) {
+#if defined(__GNUC__)
+            return 63 - __builtin_clzll( x );
+#else
+            int n = 0;
+            while ( x >>= 1 )
+                n++;
+            return n;
+#endif
+        }
+
+        inline void appendBigEndian(BufBuilder& b, unsigned long long x, int bytes) {
+            char *p = b.grow( bytes );
+            for( int i = bytes - 1; i >= 0; i-- ) {
+                p[i] = (char) x;
+                x >>= 8;
+            }
+        }
+
+        void appendMagnitude(BufBuilder& b, bool negative, int exponent, unsigned long long frac) {
+            unsigned long long e = exponent + ExponentBias;
+            if ( negative ) {
+                e = ~e;
+                frac = ~frac;
+            }
+            b.appendUChar( negative ? Negative : Positive );
+            appendBigEndian( b, e, 2 );
+            appendBigEndian( b, frac, 8 );
+        }
+
+        void appendInteger(BufBuilder& b, long long x) {
+            if ( x == 0 ) {
+                b.appendUChar( Zero );
+                return;
+            }
+            bool negative = x < 0;
+            unsigned long long u = negative ? 0 - (unsigned long long) x : (unsigned long long) x;
+            int p = highBit( u );
+            appendMagnitude( b, negative, p, p ? u << ( 64 - p ) : 0 );
+        }
+
+        void appendDouble(BufBuilder& b, double d) {
+            if ( isNaN( d ) ) {
+                b.appendUChar( NaNClass );
+                return;
+            }
+            if ( d == 0 ) {
+                b.appendUChar( Zero );
+                return;
+            }
+            if ( d == std::numeric_limits<double>::infinity() ) {
+                b.appendUChar( PosInfinity );
+                return;
+            }
+            if ( d == -std::numeric_limits<double>::infinity() ) {
+                b.appendUChar( NegInfinity );
+                return;
+            }
+            unsigned long long bits;
+            memcpy( &bits, &d, sizeof(bits) );
+            int biased = (int) ( ( bits >> 52 ) & 0x7ff );
+            unsigned long long mantissa = bits & ( ( 1ULL << 52 ) - 1 );
+            if ( biased ) {
+                appendMagnitude( b, d < 0, biased - 1023, mantissa << 12 );
+            }
+            else {
+                // subnormal
+                int p = highBit( mantissa );
+                appendMagnitude( b, d < 0, p - 1074, p ? mantissa << ( 64 - p ) : 0 );
+            }
+        }
+
+        /** appends s, which may contain zero bytes, and a terminator */
+        void appendEscaped(BufBuilder& b, const char *s, int len) {
+            const char *end = s + len;
+            while ( s < end ) {
+                const char *z = (const char *) memchr( s, 0, end - s );
+                if ( z == 0 ) {
+                    b.appendBuf( s, end - s );
+                    break;
+                }
+                b.appendBuf( s, z - s );
+                b.appendUChar( 0 );
+                b.appendUChar( 0xff );
+                s = z + 1;
+            }
+            b.appendUChar( 0 );
+        }
+
+        void appendObject(BufBuilder& b, BufBuilder* typeBits, const bsonobj& obj);
+
+        /** tag, field name if withName, value */
+        void appendElement(BufBuilder& b, BufBuilder* typeBits, const bsonelement& e, bool withName) {
+            BSONType t = e.type();
+            b.appendUChar( (unsigned char) ( canonicalizeBSONType( t ) + TagBias ) );
+            if ( withName )
+                b.appendStr( StringData( e.fieldName(), e.fieldNameSize() - 1 ) );
+            if ( typeBits ) {
+                unsigned char x = (unsigned char) t;
+                if ( t == NumberDouble && e._numberDouble() == 0 && std::signbit( e._numberDouble() ) )
+                    x |= NegativeZero;
+                typeBits->appendUChar( x );
+            }
+
+            switch ( t ) {
+            case MinKey:
+            case MaxKey:
+            case EOO:
+            case Undefined:
+            case jstNULL:
+                break;
+            case NumberDouble:
+                appendDouble( b, e._numberDouble() );
+                break;
+            case NumberInt:
+                appendInteger( b, e._numberInt() );
+                break;
+            case NumberLong:
+                appendInteger( b, e._numberLong() );
+                break;
+            case String:
+            case Symbol:
+            case Code:
+                appendEscaped( b, e.valuestr(), e.valuestrsize() - 1 );
+                break;
+            case Object:
+            case Array:
+                appendObject( b, typeBits, e.object() );
+                break;
+            case BinData: {
+                int len;
+                const char *data = e.binData( len );
+                appendBigEndian( b, (unsigned) len, 4 );
+                b.appendUChar( (unsigned char) e.binDataType() );
+                b.appendBuf( data, len );
+                break;
+            }
+            case jstOID:
+                b.appendBuf( e.value(), 12 );
+                break;
+            case Bool:
+                b.appendUChar( (unsigned char) ( *e.value() ^ 0x80 ) );
+                break;
+            case Date: {
+                // signed, as compareElementValues() compares Dates: a byte for the sign, so
+                // negative Dates come first, then the bits.  A Date and a Timestamp of the
+                // same value get the same bytes.
+                unsigned long long x = e.date().millis;
+                b.appendUChar( (long long) x < 0 ? 0 : 1 );
+                appendBigEndian( b, x, 8 );
+                break;
+            }
+            case Timestamp:
+                // unsigned, as compareElementValues() compares Timestamps
+                b.appendUChar( 1 );
+                appendBigEndian( b, e.date().millis, 8 );
+                break;
+            case RegEx:
+                b.appendStr( e.regex() );
+                b.appendStr( e.regexFlags() );
+                break;
+            case DBRef:
+                appendBigEndian( b, (unsigned) e.valuesize(), 4 );
+                b.appendBuf( e.value(), e.valuesize() );
+                break;
+            case CodeWScope: {
+                // code, then the scope's bytes.  woCompare strcmp()s the scope, which stops at
+                // its first zero byte; this orders by the whole of it.
+                appendEscaped( b, e.codeWScopeCode(), e.codeWScopeCodeLen() - 1 );
+                bsonobj scope( e.codeWScopeScopeData() );
+                appendBigEndian( b, (unsigned) scope.objsize(), 4 );
+                b.appendBuf( scope.objdata(), scope.objsize() );
+                break;
+            }
+            default:
+                verify( false );
+            }
+        }
+
+        /** inverts the bytes of b from start on -- for a descending value */
+        void invertFrom(BufBuilder& b, int start) {
+            char *p = b.buf();
+            for( int j = start; j < b.len(); j++ )
+                p[j] = ~p[j];
+        }
+
+        void appendObject(BufBuilder& b, BufBuilder* typeBits, const bsonobj& obj) {
+            for( bsonelemiterator i = obj.begin(); i != obj.end(); ++i )
+                appendElement( b, typeBits, *i, true );
+            b.appendUChar( End );
+        }
+
+        /** reads a key string, un-inverting descending values */
+        class Reader {
+        public:
+            Reader(const StringData& s) : _p( (const unsigned char *) s.rawData() ),
+                                          _end( _p + s.size() ), invert(0) { }
+            bool atEnd() const { return _p == _end; }
+            unsigned char peek() const {
+                need( 1 );
+                return *_p ^ invert;
+            }
+            unsigned char byte() {
+                need( 1 );
+                return *_p++ ^ invert;
+            }
+            unsigned long long bigEndian(int bytes) {
+                need( bytes );
+                unsigned long long x = 0;
+                for( int i = 0; i < bytes; i++ )
+                    x = ( x << 8 ) | (unsigned char) ( _p[i] ^ invert );
+                _p += bytes;
+                return x;
+            }
+            void copyTo(BufBuilder& b, int n) {
+                need( n );
+                char *out = b.grow( n );
+                for( int i = 0; i < n; i++ )
+                    out[i] = (char) ( _p[i] ^ invert );
+                _p += n;
+            }
+            /** copies a cstring, and its terminator */
+            void copyCString(BufBuilder& b) {
+                unsigned char c;
+                do {
+                    c = byte();
+                    b.appendUChar( c );
+                } while ( c );
+            }
+            /** copies a string written by appendEscaped(), and a terminator */
+            void copyEscaped(BufBuilder& b) {
+                while ( 1 ) {
+                    unsigned char c = byte();
+                    if ( c == 0 ) {
+                        if ( _p == _end || peek() != 0xff )
+                            break;
+                        _p++;
+                    }
+                    b.appendUChar( c );
+                }
+                b.appendUChar( 0 );
+            }
+
+        private:
+            void need(int n) const {
+                massert( 18103, "malformed key string", n <= _end - _p );
+            }
+            const unsigned char *_p;
+            const unsigned char *_end;
+        public:
+            unsigned char invert; // 0xff while in a descending value
+        };
+
+        /** hands out the types recorded by appendKeyString(), if there are any */
+        class TypeBitsReader {
+        public:
+            TypeBitsReader(const StringData& s) : _p( s.rawData() ), _end( s.rawData() + s.size() ),
+                                                  _present( s.size() > 0 ) { }
+            bool present() const { return _present; }
+            /** @return the next type, checked against the canonical type the key string has */
+            BSONType next(int canonical, bool* negativeZero) {
+                massert( 18104, "key string type bits don't match", _p < _end );
+                unsigned char x = (unsigned char) *_p++;
+                BSONType t;
+                *negativeZero = false;
+                if ( x == (unsigned char) MinKey || x == (unsigned char) MaxKey ) {
+                    t = (BSONType) (signed char) x;
+                }
+                else {
+                    t = (BSONType) ( x & ~NegativeZero );
+                    *negativeZero = ( x & NegativeZero ) != 0;
+                    massert( 18104, "key string type bits don't match", t <= JSTypeMax );
+                }
+                massert( 18104, "key string type bits don't match",
+                         canonicalizeBSONType( t ) == canonical );
+                return t;
+            }
+            bool atEnd() const { return _p == _end; }
+        private:
+            const char *_p;
+            const char *_end;
+            bool _present;
+        };
+
+        /** type to decode a canonical type as when there are no type bits */
+        BSONType defaultType(int canonical) {
+            switch ( canonical ) {
+            case -1: return MinKey;
+            case 0: return Undefined;
+            case 5: return jstNULL;
+            case 10: return NumberDouble; // refined by readNumber()
+            case 15: return String;
+            case 20: return Object;
+            case 25: return Array;
+            case 30: return BinData;
+            case 35: return jstOID;
+            case 40: return Bool;
+            case 45: return Date;
+            case 50: return RegEx;
+            case 55: return DBRef;
+            case 60: return Code;
+            case 65: return CodeWScope;
+            case 127: return MaxKey;
+            }
+            msgasserted( 18103, "malformed key string" );
+            return EOO;
+        }
+
+        inline void storeInt(BufBuilder& b, int ofs, int x) {
+            x = endian_int( x );
+            memcpy( b.buf() + ofs, &x, 4 );
+        }
+
+        /** reads a number written by appendInteger() / appendDouble() and appends its value.
+            @param t the type to append it as, or EOO to pick one
+            @return the type appended
+        */
+        BSONType readNumber(Reader& r, BufBuilder& b, BSONType t, bool negativeZero) {
+            unsigned char c = r.byte();
+            double d = 0;
+            bool negative = false;
+            int exponent = 0;
+            unsigned long long m = 0; // magnitude is m * 2^(exponent-63)
+            switch ( c ) {
+            case NaNClass:
+                d = std::numeric_limits<double>::quiet_NaN();
+                break;
+            case NegInfinity:
+                d = -std::numeric_limits<double>::infinity();
+                break;
+            case PosInfinity:
+                d = std::numeric_limits<double>::infinity();
+                break;
+            case Zero:
+                d = negativeZero ? -0.0 : 0.0;
+                break;
+            case Negative:
+            case Positive: {
+                negative = c == Negative;
+                unsigned long long e = r.bigEndian( 2 );
+                unsigned long long frac = r.bigEndian( 8 );
+                if ( negative ) {
+                    e = ~e & 0xffff;
+                    frac = ~frac;
+                }
+                exponent = (int) e - ExponentBias;
+                m = ( 1ULL << 63 ) | ( frac >> 1 );
+                d = ldexp( (double) m, exponent - 63 );
+                if ( negative )
+                    d = -d;
+                break;
+            }
+            default:
+                msgasserted( 18103, "malformed key string" );
+            }
+
+            bool finite = c == Zero || c == Negative || c == Positive;
+            bool integral = c == Zero ||
+                            ( finite && exponent >= 0 && exponent < 63 && ( m << ( exponent + 1 ) ) == 0 ) ||
+                            ( negative && exponent == 63 && m == ( 1ULL << 63 ) ); // -2^63
+            long long x = 0;
+            if ( integral && c != Zero ) {
+                unsigned long long u = m >> ( 63 - exponent );
+                x = negative ? (long long) ( 0 - u ) : (long long) u;
+            }
+
+            if ( t == EOO ) {
+                if ( !integral )
+                    t = NumberDouble;
+                else if ( x >= std::numeric_limits<int>::min() && x <= std::numeric_limits<int>::max() )
+                    t = NumberInt;
+                else
+                    t = NumberLong;
+            }
+
+            if ( t == NumberDouble ) {
+                b.appendNum( d );
+            }
+            else {
+                massert( 18103, "malformed key string", integral );
+                if ( t == NumberInt ) {
+                    massert( 18103, "malformed key string",
+                             x >= std::numeric_limits<int>::min() && x <= std::numeric_limits<int>::max() );
+                    b.appendNum( (int) x );
+                }
+                else {
+                    b.appendNum( x );
+                }
+            }
+            return t;
+        }
+
+        void readObjectBody(Reader& r, TypeBitsReader& tb, BufBuilder& b);
+
+        /** reads the value following tag and appends it to b as an element named by the
+            cstring at r (withName) or "".
+        */
+        void readElement(Reader& r, TypeBitsReader& tb, BufBuilder& b, unsigned char tag, bool withName) {
+            int canonical = (int) tag - TagBias;
+            BSONType t = defaultType( canonical );
+            bool negativeZero = false;
+            if ( tb.present() )
+                t = tb.next( canonical, &negativeZero );
+            else if ( canonical == 10 ) {
+                t = EOO; // readNumber() picks
+            }
+
+            int typeOfs = b.len();
+            b.appendUChar( (unsigned char) t );
+            if ( withName )
+                r.copyCString( b );
+            else
+                b.appendUChar( 0 );
+
+            switch ( t ) {
+            case MinKey:
+            case MaxKey:
+            case Undefined:
+            case jstNULL:
+                break;
+            case EOO:
+            case NumberDouble:
+            case NumberInt:
+            case NumberLong:
+                t = readNumber( r, b, t, negativeZero );
+                b.buf()[typeOfs] = (char) t;
+                break;
+            case String:
+            case Symbol:
+            case Code: {
+                int ofs = b.len();
+                b.skip( 4 );
+                r.copyEscaped( b );
+                storeInt( b, ofs, b.len() - ofs - 4 );
+                break;
+            }
+            case Object:
+            case Array:
+                readObjectBody( r, tb, b );
+                break;
+            case BinData: {
+                int len = (int) r.bigEndian( 4 );
+                massert( 18103, "malformed key string", len >= 0 );
+                b.appendNum( len );
+                r.copyTo( b, 1 + len );
+                break;
+            }
+            case jstOID:
+                r.copyTo( b, 12 );
+                break;
+            case Bool:
+                b.appendUChar( (unsigned char) ( r.byte() ^ 0x80 ) );
+                break;
+            case Date:
+            case Timestamp:
+                // the sign byte; the bits follow as they are either way
+                massert( 18103, "malformed key string", r.byte() <= 1 );
+                b.appendNum( r.bigEndian( 8 ) );
+                break;
+            case RegEx:
+                r.copyCString( b );
+                r.copyCString( b );
+                break;
+            case DBRef: {
+                int len = (int) r.bigEndian( 4 );
+                massert( 18103, "malformed key string", len >= 0 );
+                r.copyTo( b, len );
+                break;
+            }
+            case CodeWScope: {
+                int ofs = b.len();
+                b.skip( 8 );
+                r.copyEscaped( b );
+                storeInt( b, ofs + 4, b.len() - ofs - 8 );
+                int len = (int) r.bigEndian( 4 );
+                massert( 18103, "malformed key string", len >= 5 );
+                r.copyTo( b, len );
+                storeInt( b, ofs, b.len() - ofs );
+                break;
+            }
+            default:
+                msgasserted( 18103, "malformed key string" );
+            }
+        }
+
+        void readObjectBody(Reader& r, TypeBitsReader& tb, BufBuilder& b) {
+            int ofs = b.len();
+            b.skip( 4 );
+            while ( 1 ) {
+                unsigned char tag = r.byte();
+                if ( tag == End )
+                    break;
+                readElement( r, tb, b, tag, true );
+            }
+            b.appendUChar( EOO );
+            storeInt( b, ofs, b.len() - ofs );
+        }
+
+    }
+
+    void appendKeyString(const bsonobj& key, const Ordering& o, BufBuilder& out,
+                         BufBuilder* typeBits) {
+        unsigned mask = 1;
+        for( bsonelemiterator i = key.begin(); i != key.end(); ++i ) {
+            int start = out.len();
+            appendElement( out, typeBits, *i, false );
+            if ( o.descending( mask ) )
+                invertFrom( out, start );
+            mask <<= 1;
+        }
+        out.appendUChar( End );
+    }
+
+    sortkeymaker::sortkeymaker(const bsonobj& sortKey, bool useDotted) : _dotted(useDotted) {
+        uassert( 10060, "woSortOrder needs a non-empty sortKey", !sortKey.isEmpty() );
+        for( bsonelemiterator i = sortKey.begin(); i != sortKey.end(); ++i ) {
+            _fields.push_back( i->fieldName() );
+            _descending.push_back( i->number() < 0 );
+        }
+    }
+
+    void sortkeymaker::append(const bsonobj& doc, BufBuilder& out) const {
+        // woSortOrder puts an empty document before any other, whatever the sort key says
+        if ( doc.isEmpty() ) {
+            out.appendUChar( End );
+            return;
+        }
+        out.appendUChar( End + 1 );
+        static const char nullObj[] = { 7, 0, 0, 0, jstNULL, 0, 0 };
+        for( size_t k = 0; k < _fields.size(); k++ ) {
+            bsonelement e = _dotted ? doc.getFieldDotted( _fields[k] ) : doc.getField( _fields[k] );
+            if ( e.eoo() )
+                e = bsonobj( nullObj ).firstElement();
+            int start = out.len();
+            appendElement( out, 0, e, false );
+            if ( _descending[k] )
+                invertFrom( out, start );
+        }
+        out.appendUChar( End );
+    }
+
+    std::string sortkeymaker::make(const bsonobj& doc) const {
+        BufBuilder b( 64 );
+        append( doc, b );
+        return std::string( b.buf(), b.len() );
+    }
+
+    std::string toKeyString(const bsonobj& key, const Ordering& o, std::string* typeBits) {
+        BufBuilder b( 64 );
+        if ( typeBits ) {
+            BufBuilder tb( 16 );
+            appendKeyString( key, o, b, &tb );
+            typeBits->assign( tb.buf(), tb.len() );
+        }
+        else {
+            appendKeyString( key, o, b );
+        }
+        return std::string( b.buf(), b.len() );
+    }
+
+    void keyStringToBSON(const StringData& ks, const Ordering& o, bsonobjbuilder& b,
+                         const StringData& typeBits) {
+        Reader r( ks );
+        TypeBitsReader tb( typeBits );
+        unsigned mask = 1;
+        while ( 1 ) {
+            r.invert = 0;
+            unsigned char tag = r.byte();
+            if ( tag == End )
+                break;
+            if ( o.descending( mask ) ) {
+                r.invert = 0xff;
+                tag = (unsigned char) ~tag;
+            }
+            readElement( r, tb, b.bb(), tag, false );
+            mask <<= 1;
+        }
+        massert( 18103, "malformed key string", r.atEnd() );
+        massert( 18104, "key string type bits don't match", !tb.present() || tb.atEnd() );
+    }
+
+}
@@ -0,0 +1,88 @@
+// keystring.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "bsonobj.h"
+
+namespace _bson {
+
+    class bsonobjbuilder;
+
+    /**
+     * Key strings.  A key document such as { "" : 3, "" : "abc" } plus an Ordering encode to
+     * a byte string such that for two keys a and b
+     *
+     *   memcmp order of toKeyString(a, o) and toKeyString(b, o)
+     *     == sign of a.woCompare(b, o, false)
+     *
+     * (shorter strings first when one is a prefix of the other).  So keys can be sorted,
+     * radix sorted or looked up with plain byte comparisons.  Top level field names are not
+     * encoded -- as with index keys only the values matter.
+     *
+     * Each value is written as its canonical type (see canonicalizeBSONType()) followed by a
+     * type specific encoding; the bytes of a descending field are inverted.  Numbers are
+     * encoded by value, so 1, NumberLong(1) and 1.0 give the same bytes.  Large NumberLongs
+     * are ordered exactly, where compareElementValues() compares a long to a double as two
+     * doubles.  Dates are ordered as signed and Timestamps as unsigned 64 bit values, as
+     * compareElementValues() does; a Date and a Timestamp, which woCompare() orders by the
+     * type of the left one, are ordered by their numeric values.
+     *
+     * The BSON types of the values are written separately, to 'typeBits', and are only
+     * needed to get the exact types back with keyStringToBSON().
+     */
+    void appendKeyString(const bsonobj& key, const Ordering& o, BufBuilder& out,
+                         BufBuilder* typeBits = 0);
+
+    /** @return the key string of key -- see appendKeyString() */
+    std::string toKeyString(const bsonobj& key, const Ordering& o, std::string* typeBits = 0);
+
+    /**
+     * Decodes a key string back to BSON, appending the values to b with empty field names.
+     * If typeBits is empty, numbers come back as the smallest type that holds them (as
+     * bsonobjbuilder::appendNumber() picks), Symbols as Strings and Timestamps as Dates.
+     * NaNs always come back as the quiet NaN.
+     *
+     * Throws MsgAssertionException if ks is not a key string encoded with o.
+     */
+    void keyStringToBSON(const StringData& ks, const Ordering& o, bsonobjbuilder& b,
+                         const StringData& typeBits = StringData());
+
+    /**
+     * Makes key strings that order documents as bsonobj::woSortOrder(r, sortKey, useDotted)
+     * does, so a sort can pull each document's key out once and compare bytes from then on.
+     * Any number of sort fields is allowed.  const methods are thread safe.
+     */
+    class sortkeymaker {
+    public:
+        /** @param sortKey e.g. { lastName : 1, age : -1 }; must not be empty */
+        explicit sortkeymaker(const bsonobj& sortKey, bool useDotted = false);
+
+        /** appends the key string of doc to out */
+        void append(const bsonobj& doc, BufBuilder& out) const;
+
+        std::string make(const bsonobj& doc) const;
+
+        int nFields() const { return (int) _fields.size(); }
+
+    private:
+        std::vector<std::string> _fields;
+        std::vector<char> _descending;
+        bool _dotted;
+    };
+
+}
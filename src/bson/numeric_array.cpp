@@ -0,0 +1,390 @@
+// numeric_array.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include "numeric_array.h"
+#include "float_utils.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace _bson {
+
+    /** load a value of BSON numeric type T from v, converted to NumberType */
+    template <typename NumberType, int T>
+    static inline NumberType loadNumber(const char *v) {
+        if ( T == NumberInt )
+            return (NumberType) readInt( v );
+        long long x;
+        memcpy( &x, v, sizeof(x) );
+        x = endian_ll( x );
+        if ( T == NumberLong )
+            return (NumberType) x;
+        double d;
+        memcpy( &d, &x, sizeof(d) );
+        return (NumberType) d;
+    }
+
+    /** @return nonzero unless the element at e has type t and a keyLen byte field name */
+    static inline unsigned badFixedElement(const char *e, unsigned char t, int keyLen) {
+        unsigned bad = (unsigned char) e[0] ^ t;
+        bad |= (unsigned char) e[keyLen + 1];
+        for( int j = 1; j <= keyLen; j++ )
+            bad |= e[j] == 0;
+        return bad;
+    }
+
+    enum { Block = 8 };
+
+    /** Walks up to n consecutive elements of type T, each with a keyLen byte field name, that
+        start at p.  Elements are checked a block at a time and their values handed to
+        op.block<T>(first value, stride) -- Block values -- or, at the end of the run, to
+        op.one<T>(value).  No bsonelement is built.
+        @return the number walked -- stops at the first element that doesn't fit the layout.
+    */
+    template <int T, class Op>
+    static int walkRun(const char *p, int keyLen, int n, Op& op) {
+        const int valueOfs = keyLen + 2;
+        const int stride = valueOfs + ( T == NumberInt ? 4 : 8 );
+        int i = 0;
+        for( ; i + Block <= n; i += Block ) {
+            const char *b = p + i * stride;
+            unsigned bad = 0;
+            for( int k = 0; k < Block; k++ )
+                bad |= badFixedElement( b + k * stride, (unsigned char) T, keyLen );
+            if ( bad )
+                break;
+            op.template block<T>( b + valueOfs, stride );
+        }
+        for( ; i < n; i++ ) {
+            const char *e = p + i * stride;
+            if ( badFixedElement( e, (unsigned char) T, keyLen ) )
+                break;
+            op.template one<T>( e + valueOfs );
+        }
+        return i;
+    }
+
+    /** Walks the elements of arr in order, handing numeric values to op as walkRun() does and
+        calling op.other() for anything else.  Only the first 'limit' elements are handed to
+        op; the rest are just counted.
+        @return the number of elements in arr
+    */
+    template <class Op>
+    static int walkNumbers(const bsonobj& arr, int limit, Op& op, NumericTypeCounts& c) {
+        const char *p = arr.objdata() + 4;
+        const char *end = arr.objdata() + arr.objsize() - 1; // the EOO
+        int n = 0;
+        int keyLen = 1;      // length of the key "n"
+        int longerKey = 10;  // first index with a longer key than keyLen
+        while ( p < end ) {
+            while ( n >= longerKey ) {
+                keyLen++;
+                longerKey = longerKey > std::numeric_limits<int>::max() / 10 ?
+                            std::numeric_limits<int>::max() : longerKey * 10;
+            }
+
+            unsigned char t = (unsigned char) *p;
+            if ( n < limit && ( t == NumberDouble || t == NumberInt || t == NumberLong ) ) {
+                // fixed stride run of elements n..runEnd-1
+                int stride = keyLen + 2 + ( t == NumberInt ? 4 : 8 );
+                int runEnd = std::min( longerKey, limit );
+                long long avail = ( end - p ) / stride;
+                if ( runEnd - n > avail )
+                    runEnd = n + (int) avail;
+                int got = 0;
+                switch ( t ) {
+                case NumberDouble:
+                    got = walkRun<NumberDouble>( p, keyLen, runEnd - n, op );
+                    c.doubles += got;
+                    break;
+                case NumberInt:
+                    got = walkRun<NumberInt>( p, keyLen, runEnd - n, op );
+                    c.ints += got;
+                    break;
+                default:
+                    got = walkRun<NumberLong>( p, keyLen, runEnd - n, op );
+                    c.longs += got;
+                    break;
+                }
+                if ( got ) {
+                    p += got * stride;
+                    n += got;
+                    continue;
+                }
+            }
+
+            // one element the general way
+            int fnSize = 0;
+            int sz = iter::checkedElementSize( p, (int) ( end - p ), fnSize );
+            if ( sz < 0 )
+                iter::elementSizeError( sz, p );
+            massert( 10331, "EOO Before end of object", t != EOO );
+            const char *v = p + 1 + fnSize;
+            bool take = n < limit;
+            switch ( t ) {
+            case NumberDouble:
+                c.doubles++;
+                if ( take ) op.template one<NumberDouble>( v );
+                break;
+            case NumberInt:
+                c.ints++;
+                if ( take ) op.template one<NumberInt>( v );
+                break;
+            case NumberLong:
+                c.longs++;
+                if ( take ) op.template one<NumberLong>( v );
+                break;
+            default:
+                c.others++;
+                if ( take ) op.other();
+                break;
+            }
+            p += sz;
+            n++;
+        }
+        return n;
+    }
+
+    /** writes the values out, converted to NumberType */
+    template <typename NumberType>
+    class CopyNumbers {
+    public:
+        CopyNumbers(NumberType *out) : _out(out) { }
+        template <int T> void block(const char *v, int stride) {
+            for( int k = 0; k < Block; k++ )
+                _out[k] = loadNumber<NumberType, T>( v + k * stride );
+            _out += Block;
+        }
+        template <int T> void one(const char *v) { *_out++ = loadNumber<NumberType, T>( v ); }
+        void other() { *_out++ = 0; }
+    private:
+        NumberType *_out;
+    };
+
+    template <typename NumberType>
+    int extractNumbers(const bsonobj& arr, NumberType* out, int capacity,
+                       NumericTypeCounts* counts) {
+        NumericTypeCounts c;
+        CopyNumbers<NumberType> op( out );
+        int n = walkNumbers( arr, capacity, op, c );
+        if ( counts ) {
+            counts->doubles += c.doubles;
+            counts->ints += c.ints;
+            counts->longs += c.longs;
+            counts->others += c.others;
+        }
+        return n;
+    }
+
+    /** Accumulates sum / min / max.  Doubles and integers are kept apart so the integers stay
+        exact; finish() combines them.  NaNs are counted rather than folded into min / max.
+    */
+    class AggregateNumbers {
+    public:
+        AggregateNumbers() : _dsum(0), _dmin(std::numeric_limits<double>::infinity()),
+                             _dmax(-std::numeric_limits<double>::infinity()), _nans(0),
+                             _isum(0), _imin(std::numeric_limits<long long>::max()),
+                             _imax(std::numeric_limits<long long>::min()) {
+#if defined(__AVX2__)
+            _vints = false;
+            _vdsum = _mm256_setzero_pd();
+            _vdmin = _mm256_set1_pd( _dmin );
+            _vdmax = _mm256_set1_pd( _dmax );
+            _vnan = _mm256_setzero_pd();
+            _visum = _mm256_setzero_si256();
+            _vimin = _mm256_set1_epi32( std::numeric_limits<int>::max() );
+            _vimax = _mm256_set1_epi32( std::numeric_limits<int>::min() );
+#elif defined(__SSE2__)
+            _vdsum = _mm_setzero_pd();
+            _vdmin = _mm_set1_pd( _dmin );
+            _vdmax = _mm_set1_pd( _dmax );
+            _vnan = _mm_setzero_pd();
+#endif
+        }
+
+        template <int T> void block(const char *v, int stride) {
+#if defined(__AVX2__)
+            if ( !big && T == NumberDouble ) {
+                __m256i idx = _mm256_setr_epi64x( 0, stride, 2 * stride, 3 * stride );
+                addDoubles( _mm256_i64gather_pd( (const double *) v, idx, 1 ) );
+                addDoubles( _mm256_i64gather_pd( (const double *) ( v + 4 * stride ), idx, 1 ) );
+                return;
+            }
+            if ( !big && T == NumberInt ) {
+                __m256i idx = _mm256_mullo_epi32( _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ),
+                                                  _mm256_set1_epi32( stride ) );
+                __m256i x = _mm256_i32gather_epi32( (const int *) v, idx, 1 );
+                __m256i lo = _mm256_cvtepi32_epi64( _mm256_castsi256_si128( x ) );
+                __m256i hi = _mm256_cvtepi32_epi64( _mm256_extracti128_si256( x, 1 ) );
+                _visum = _mm256_add_epi64( _visum, _mm256_add_epi64( lo, hi ) );
+                _vimin = _mm256_min_epi32( _vimin, x );
+                _vimax = _mm256_max_epi32( _vimax, x );
+                _vints = true;
+                return;
+            }
+#elif defined(__SSE2__)
+            if ( !big && T == NumberDouble ) {
+                for( int k = 0; k < Block; k += 2 ) {
+                    __m128d x = _mm_loadh_pd( _mm_load_sd( (const double *) ( v + k * stride ) ),
+                                              (const double *) ( v + ( k + 1 ) * stride ) );
+                    _vdsum = _mm_add_pd( _vdsum, x );
+                    _vdmin = _mm_min_pd( x, _vdmin ); // a NaN x leaves the accumulator alone
+                    _vdmax = _mm_max_pd( x, _vdmax );
+                    _vnan = _mm_or_pd( _vnan, _mm_cmpunord_pd( x, x ) );
+                }
+                return;
+            }
+#endif
+            for( int k = 0; k < Block; k++ )
+                one<T>( v + k * stride );
+        }
+
+        template <int T> void one(const char *v) {
+            if ( T == NumberDouble ) {
+                double d = loadNumber<double, T>( v );
+                _dsum += d;
+                if ( d < _dmin ) _dmin = d;
+                if ( d > _dmax ) _dmax = d;
+                if ( isNaN( d ) ) _nans++;
+            }
+            else {
+                long long x = loadNumber<long long, T>( v );
+                addInt( x );
+                if ( x < _imin ) _imin = x;
+                if ( x > _imax ) _imax = x;
+            }
+        }
+
+        void other() { }
+
+        void finish(NumericSummary& r, const NumericTypeCounts& c) {
+#if defined(__AVX2__)
+            double ds[4], mn[4], mx[4], nn[4];
+            long long is[4];
+            int imn[8], imx[8];
+            _mm256_storeu_pd( ds, _vdsum );
+            _mm256_storeu_pd( mn, _vdmin );
+            _mm256_storeu_pd( mx, _vdmax );
+            _mm256_storeu_pd( nn, _vnan );
+            _mm256_storeu_si256( (__m256i *) is, _visum );
+            _mm256_storeu_si256( (__m256i *) imn, _vimin );
+            _mm256_storeu_si256( (__m256i *) imx, _vimax );
+            for( int k = 0; k < 4; k++ ) {
+                foldDouble( ds[k], mn[k], mx[k], nn[k] );
+                addInt( is[k] );
+            }
+            for( int k = 0; _vints && k < 8; k++ ) {
+                if ( imn[k] < _imin ) _imin = imn[k];
+                if ( imx[k] > _imax ) _imax = imx[k];
+            }
+#elif defined(__SSE2__)
+            double ds[2], mn[2], mx[2], nn[2];
+            _mm_storeu_pd( ds, _vdsum );
+            _mm_storeu_pd( mn, _vdmin );
+            _mm_storeu_pd( mx, _vdmax );
+            _mm_storeu_pd( nn, _vnan );
+            for( int k = 0; k < 2; k++ )
+                foldDouble( ds[k], mn[k], mx[k], nn[k] );
+#endif
+            long long nInts = (long long) c.ints + c.longs;
+            r.count = nInts + c.doubles;
+            r.others = c.others;
+            r.integral = c.doubles == 0;
+            r.intSum = _isum;
+            r.sum = _dsum + (double) _isum;
+            if ( r.count == 0 )
+                return;
+            if ( nInts ) {
+                r.intMin = _imin;
+                r.intMax = _imax;
+            }
+            if ( c.doubles == 0 ) {
+                r.min = (double) _imin;
+                r.max = (double) _imax;
+                return;
+            }
+            // as compareElementValues orders them, a NaN is less than any other number
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+            bool allNaN = _dmin > _dmax;
+            r.min = _nans ? nan : _dmin;
+            r.max = allNaN ? nan : _dmax;
+            if ( nInts ) {
+                if ( !_nans && (double) _imin < r.min )
+                    r.min = (double) _imin;
+                if ( allNaN || (double) _imax > r.max )
+                    r.max = (double) _imax;
+            }
+        }
+
+    private:
+        void addInt(long long x) {
+            // two's complement wrap on overflow rather than undefined behavior
+            _isum = (long long) ( (unsigned long long) _isum + (unsigned long long) x );
+        }
+        void foldDouble(double sum, double mn, double mx, double nan) {
+            _dsum += sum;
+            if ( mn < _dmin ) _dmin = mn;
+            if ( mx > _dmax ) _dmax = mx;
+            if ( isNaN( nan ) ) _nans++;
+        }
+#if defined(__AVX2__)
+        void addDoubles(__m256d x) {
+            _vdsum = _mm256_add_pd( _vdsum, x );
+            _vdmin = _mm256_min_pd( x, _vdmin ); // a NaN x leaves the accumulator alone
+            _vdmax = _mm256_max_pd( x, _vdmax );
+            _vnan = _mm256_or_pd( _vnan, _mm256_cmp_pd( x, x, _CMP_UNORD_Q ) );
+        }
+        __m256d _vdsum, _vdmin, _vdmax, _vnan;
+        __m256i _visum, _vimin, _vimax;
+        bool _vints; // _vimin / _vimax have seen values
+#elif defined(__SSE2__)
+        __m128d _vdsum, _vdmin, _vdmax, _vnan;
+#endif
+        double _dsum, _dmin, _dmax;
+        long long _nans;
+        long long _isum, _imin, _imax;
+    };
+
+    NumericSummary summarizeNumbers(const bsonobj& arr) {
+        NumericTypeCounts c;
+        AggregateNumbers op;
+        walkNumbers( arr, std::numeric_limits<int>::max(), op, c );
+        NumericSummary r;
+        op.finish( r, c );
+        return r;
+    }
+
+    NumericSummary summarizeNumbers(const bsonelement& arr) {
+        massert( 18102, "summarizeNumbers: element is not an array", arr.isObject() );
+        return summarizeNumbers( arr.object() );
+    }
+
+    // Definition of the various supported implementations of extractNumbers.
+
+#define DEFINE_EXTRACT_NUMBERS(NUMBER_TYPE)          \
+    template int extractNumbers<NUMBER_TYPE>(const bsonobj&, NUMBER_TYPE*, int, NumericTypeCounts*);
+
+    DEFINE_EXTRACT_NUMBERS(double)
+    DEFINE_EXTRACT_NUMBERS(long long)
+    DEFINE_EXTRACT_NUMBERS(int)
+#undef DEFINE_EXTRACT_NUMBERS
+
+}
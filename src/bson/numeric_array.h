@@ -0,0 +1,108 @@
+// numeric_array.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+#include "bsonobj.h"
+
+namespace _bson {
+
+    /** Number of elements of each type seen while decoding a numeric array. */
+    struct NumericTypeCounts {
+        int doubles;
+        int ints;
+        int longs;
+        int others; // non-numeric elements; these decode as 0
+        NumericTypeCounts() : doubles(0), ints(0), longs(0), others(0) { }
+    };
+
+    /**
+     * Decodes the values of a BSON array (or any object) into a contiguous buffer, in element
+     * order.  Numbers are converted to NumberType as bsonelement::numberDouble(), numberLong()
+     * and numberInt() would; non-numeric elements decode as 0.
+     *
+     * Runs of elements of the same fixed width type whose keys have the same length ("0".."9",
+     * "10".."99", ...) sit at a constant stride; those are checked and copied a block at a
+     * time without building a bsonelement.  Anything else is decoded per element.
+     *
+     * @param out receives at most 'capacity' values
+     * @param counts if not null, incremented with the types seen
+     * @return the number of elements in the array.  If greater than capacity only the first
+     *         'capacity' were written.
+     *
+     * Throws MsgAssertionException if the array is malformed.  Available for double,
+     * long long and int -- see numeric_array.cpp.
+     */
+    template <typename NumberType>
+    int extractNumbers(const bsonobj& arr, NumberType* out, int capacity,
+                       NumericTypeCounts* counts = 0);
+
+    /** Appends the decoded values of arr to *out.  See above. */
+    template <typename NumberType>
+    void extractNumbers(const bsonobj& arr, std::vector<NumberType>* out,
+                        NumericTypeCounts* counts = 0) {
+        size_t base = out->size();
+        // smallest numeric element is type byte + "0" + int32
+        int n = ( arr.objsize() - 5 ) / 7;
+        out->resize( base + n );
+        NumericTypeCounts c;
+        int got = extractNumbers( arr, n ? &(*out)[base] : (NumberType *) 0, n, &c );
+        if ( got > n ) {
+            // lots of small non-numeric elements; do it again with the exact size
+            out->resize( base + got );
+            c = NumericTypeCounts();
+            extractNumbers( arr, &(*out)[base], got, &c );
+        }
+        out->resize( base + got );
+        if ( counts ) {
+            counts->doubles += c.doubles;
+            counts->ints += c.ints;
+            counts->longs += c.longs;
+            counts->others += c.others;
+        }
+    }
+
+    /** Result of summarizeNumbers(). */
+    struct NumericSummary {
+        long long count;    // numeric elements
+        long long others;   // non-numeric elements; ignored
+        bool integral;      // true if there were no NumberDouble elements
+        long long intSum;   // exact sum of the NumberInt and NumberLong elements; wraps on overflow
+        double sum;         // sum of all numeric elements
+        double min, max;    // by compareElementValues order -- a NaN is less than any number
+        long long intMin, intMax; // exact min / max of the NumberInt and NumberLong elements
+        NumericSummary() : count(0), others(0), integral(true), intSum(0), sum(0),
+                           min(0), max(0), intMin(0), intMax(0) { }
+        double mean() const { return count ? sum / count : 0; }
+    };
+
+    /**
+     * Computes count, sum, min, max and mean of the numeric elements of a BSON array (or any
+     * object) in one pass over its bytes, without building bsonelements.  Numbers of mixed
+     * type are promoted as compareElementValues() and numberDouble() do: integers are exact
+     * among themselves (see intSum, intMin, intMax) and compare with doubles as doubles.
+     *
+     * Fixed stride runs (see extractNumbers()) of doubles are reduced with SSE2 -- or with AVX2
+     * gathers, as are NumberInt runs, when compiled with -mavx2.  Vector sums add in a
+     * different order than a sequential loop so 'sum' may differ in the last bits.
+     *
+     * Throws MsgAssertionException if the array is malformed.
+     */
+    NumericSummary summarizeNumbers(const bsonobj& arr);
+    /** @param arr an element of type Array */
+    NumericSummary summarizeNumbers(const bsonelement& arr);
+
+}
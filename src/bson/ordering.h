@@ -19,6 +19,8 @@
 
 namespace _bson {
 
+    class bsonobj;
+
     /** A precomputation of a BSON sort key pattern.  That is something like: 
            { a : 1, b : -1 }
         The constructor is private to make conversion more explicit so we notice where we call make().
@@ -43,22 +45,8 @@ namespace _bson {
         // for woCompare...
         unsigned descending(unsigned mask) const { return bits & mask; }
 
-        /*
-        static Ordering make(const bsonobj& obj) {
-            unsigned b = 0;
-            bsonobjiterator k(obj);
-            unsigned n = 0;
-            while( 1 ) {
-                bsonelement e = k.next();
-                if( e.eoo() )
-                    break;
-                uassert( 13103, "too many compound keys", n <= 31 );
-                if( e.number() < 0 )
-                    b |= (1 << n);
-                n++;
-            }
-            return Ordering(b);
-        }*/
+        /** @param obj a key pattern such as { a : 1, b : -1 }; at most 32 fields */
+        static Ordering make(const bsonobj& obj);
     };
 
 }
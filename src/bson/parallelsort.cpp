@@ -0,0 +1,185 @@
+// parallelsort.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include "parallelsort.h"
+#include "keystring.h"
+
+namespace _bson {
+
+    namespace {
+
+        struct Entry {
+            unsigned long long prefix;  // first 8 bytes of the key string, big endian, 0 padded
+            const char *key;
+            unsigned keyLen;
+            unsigned index;             // in the input; breaks ties so the sort is stable
+        };
+
+        inline bool operator<(const Entry& a, const Entry& b) {
+            if ( a.prefix != b.prefix )
+                return a.prefix < b.prefix;
+            unsigned n = std::min( a.keyLen, b.keyLen );
+            if ( n > 8 ) {
+                int c = memcmp( a.key + 8, b.key + 8, n - 8 );
+                if ( c )
+                    return c < 0;
+            }
+            if ( a.keyLen != b.keyLen )
+                return a.keyLen < b.keyLen;
+            return a.index < b.index;
+        }
+
+        enum { KeyChunk = 4096,         // documents per key extraction task
+               SortCutoff = 8192,       // below this std::sort on one thread
+               MergeCutoff = 16384 };   // below this std::merge on one thread
+
+        /** merges sorted [x, xe) and [y, ye) into out, splitting big merges across the pool */
+        void parallelMerge(const Entry *x, const Entry *xe, const Entry *y, const Entry *ye,
+                           Entry *out, workpool& pool) {
+            if ( ( xe - x ) + ( ye - y ) <= MergeCutoff || pool.size() == 1 ) {
+                std::merge( x, xe, y, ye, out );
+                return;
+            }
+            if ( xe - x < ye - y ) {
+                std::swap( x, y );
+                std::swap( xe, ye );
+            }
+            // entries are all distinct (index), so the halves don't depend on which side
+            // an element came from
+            const Entry *xm = x + ( xe - x ) / 2;
+            const Entry *ym = std::lower_bound( y, ye, *xm );
+            Entry *outm = out + ( xm - x ) + ( ym - y );
+            *outm = *xm;
+            workpool::group g( pool );
+            g.spawn( [=, &pool]() { parallelMerge( x, xm, y, ym, out, pool ); } );
+            parallelMerge( xm + 1, xe, ym, ye, outm + 1, pool );
+            g.wait();
+        }
+
+        /** sorts a[0, n); the result lands in a, or in tmp if toTmp */
+        void parallelMergeSort(Entry *a, Entry *tmp, size_t n, bool toTmp, workpool& pool) {
+            if ( n <= SortCutoff || pool.size() == 1 ) {
+                std::sort( a, a + n );
+                if ( toTmp )
+                    std::copy( a, a + n, tmp );
+                return;
+            }
+            size_t h = n / 2;
+            // sort the halves into the other buffer, then merge them back
+            workpool::group g( pool );
+            g.spawn( [=, &pool]() { parallelMergeSort( a, tmp, h, !toTmp, pool ); } );
+            parallelMergeSort( a + h, tmp + h, n - h, !toTmp, pool );
+            g.wait();
+            Entry *from = toTmp ? a : tmp;
+            Entry *to = toTmp ? tmp : a;
+            parallelMerge( from, from + h, from + h, from + n, to, pool );
+        }
+
+        void sortEntries(const std::vector<bsonobj>& docs, const bsonobj& sortKey, bool useDotted,
+                         workpool& pool, std::vector<size_t>& perm) {
+            massert( 18109, "too many documents to sort",
+                     docs.size() <= std::numeric_limits<unsigned>::max() );
+            sortkeymaker keys( sortKey, useDotted );
+            size_t n = docs.size();
+            std::vector<Entry> entries( n );
+            size_t nChunks = ( n + KeyChunk - 1 ) / KeyChunk;
+            std::vector< std::vector<char> > arenas( nChunks );
+
+            pool.parallelFor( nChunks, 1, [&](size_t c) {
+                size_t b = c * KeyChunk;
+                size_t e = std::min( n, b + KeyChunk );
+                BufBuilder buf( 64 * 1024 );
+                std::vector<unsigned> ofs( e - b + 1 );
+                for( size_t i = b; i < e; i++ ) {
+                    ofs[i - b] = buf.len();
+                    keys.append( docs[i], buf );
+                }
+                ofs[e - b] = buf.len();
+                std::vector<char>& arena = arenas[c];
+                arena.assign( buf.buf(), buf.buf() + buf.len() );
+                for( size_t i = b; i < e; i++ ) {
+                    Entry& x = entries[i];
+                    x.key = &arena[0] + ofs[i - b];
+                    x.keyLen = ofs[i - b + 1] - ofs[i - b];
+                    x.index = (unsigned) i;
+                    unsigned char p[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+                    memcpy( p, x.key, std::min( x.keyLen, 8u ) );
+                    x.prefix = 0;
+                    for( int k = 0; k < 8; k++ )
+                        x.prefix = ( x.prefix << 8 ) | p[k];
+                }
+            } );
+
+            if ( n ) {
+                std::vector<Entry> tmp( n );
+                parallelMergeSort( &entries[0], &tmp[0], n, false, pool );
+            }
+
+            perm.resize( n );
+            pool.parallelFor( n, 64 * 1024, [&](size_t i) { perm[i] = entries[i].index; } );
+        }
+
+        /** runs f with the caller's pool, or one made for the call */
+        template <class F>
+        void withPool(workpool* pool, const F& f) {
+            if ( pool ) {
+                f( *pool );
+                return;
+            }
+            workpool p;
+            f( p );
+        }
+
+    }
+
+    std::vector<size_t> sortPermutation(const std::vector<bsonobj>& docs, const bsonobj& sortKey,
+                                        bool useDotted, workpool* pool) {
+        std::vector<size_t> perm;
+        withPool( pool, [&](workpool& p) { sortEntries( docs, sortKey, useDotted, p, perm ); } );
+        return perm;
+    }
+
+    void parallelSort(std::vector<bsonobj>& docs, const bsonobj& sortKey,
+                      bool useDotted, workpool* pool) {
+        std::vector<size_t> perm = sortPermutation( docs, sortKey, useDotted, pool );
+        std::vector<bsonobj> sorted( docs.size() );
+        for( size_t i = 0; i < perm.size(); i++ )
+            sorted[i] = docs[perm[i]];
+        docs.swap( sorted );
+    }
+
+    void sortInto(const std::vector<bsonobj>& docs, const bsonobj& sortKey,
+                  std::vector<char>* out, bool useDotted, workpool* pool) {
+        withPool( pool, [&](workpool& p) {
+            std::vector<size_t> perm;
+            sortEntries( docs, sortKey, useDotted, p, perm );
+            std::vector<size_t> ofs( perm.size() + 1 );
+            size_t base = out->size();
+            ofs[0] = base;
+            for( size_t i = 0; i < perm.size(); i++ )
+                ofs[i + 1] = ofs[i] + docs[perm[i]].objsize();
+            out->resize( ofs[perm.size()] );
+            char *o = out->empty() ? 0 : &(*out)[0];
+            p.parallelFor( perm.size(), 1024, [&](size_t i) {
+                const bsonobj& d = docs[perm[i]];
+                memcpy( o + ofs[i], d.objdata(), d.objsize() );
+            } );
+        } );
+    }
+
+}
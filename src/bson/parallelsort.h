@@ -0,0 +1,50 @@
+// parallelsort.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+#include "bsonobj.h"
+#include "workpool.h"
+
+namespace _bson {
+
+    /* Parallel in-memory sorts of documents, in bsonobj::woSortOrder(r, sortKey, useDotted)
+       order.  All are stable.
+
+       Sorting a vector<bsonobj> with operator< or woSortOrder looks every sort field up
+       again on every comparison.  These pull each document's key string out once (see
+       sortkeymaker), in parallel, then merge sort (key, index) pairs on a workpool --
+       comparing an 8 byte key prefix first and the rest of the key string with memcmp only
+       on a tie.
+
+       pool: the pool to run on; if null a pool with a thread per core is made for the call.
+    */
+
+    /** @return p such that docs[p[0]], docs[p[1]], ... is in order */
+    std::vector<size_t> sortPermutation(const std::vector<bsonobj>& docs, const bsonobj& sortKey,
+                                        bool useDotted = false, workpool* pool = 0);
+
+    /** sorts docs, which are views, by reordering the vector */
+    void parallelSort(std::vector<bsonobj>& docs, const bsonobj& sortKey,
+                      bool useDotted = false, workpool* pool = 0);
+
+    /** copies the documents, in order, back to back into out (a BSON sequence).  The copy
+        is done in parallel too.
+    */
+    void sortInto(const std::vector<bsonobj>& docs, const bsonobj& sortKey,
+                  std::vector<char>* out, bool useDotted = false, workpool* pool = 0);
+
+}
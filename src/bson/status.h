@@ -8,10 +8,21 @@ namespace _bson {
     class Status { 
     public:
 
-        Status(ErrorCodes e, const std::string& str) : _code(e), s(str) { }
-        Status(ErrorCodes e, const std::string& str,int) : _code(e), s(str) { }
-
-        static Status OK() { return Status(Ok, ""); }
+        Status(ErrorCodes e, const std::string& str) : _code(e), _literal(0), s(str) { }
+        Status(ErrorCodes e, const std::string& str,int) : _code(e), _literal(0), s(str) { }
+
+        static Status OK() { return literal(Ok, ""); }
+
+        /** a Status whose reason is a string literal -- or anything else that outlives it.
+            Nothing is allocated: for error paths in loops, where the caller may only look
+            at code().  toString() copies the reason out if it's asked for.
+        */
+        static Status literal(ErrorCodes e, const char *reason) {
+            Status st;
+            st._code = e;
+            st._literal = reason;
+            return st;
+        }
         bool isOK() const { return _code == Ok; }
 
         bool operator==(const Status& rhs) const {
@@ -21,11 +32,17 @@ namespace _bson {
 
         ErrorCodes code() const { return _code; }
 
-        std::string codeString() const { return s;  }
-        std::string toString() const { return s;  }
+        std::string codeString() const { return toString();  }
+        std::string toString() const { return _literal ? std::string(_literal) : s;  }
         unsigned reason() const { return 0;  }
+
+        /** the reason, without copying it */
+        const char* what() const { return _literal ? _literal : s.c_str(); }
     private:
+        Status() { }
+
         ErrorCodes _code;
+        const char *_literal;   // if set, the reason; s is empty
         std::string s;
     };
 
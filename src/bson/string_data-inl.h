@@ -125,4 +125,8 @@ namespace _bson {
         return substr(thisSize - suffixSize) == suffix;
     }
 
+    inline size_t StringData::Hasher::operator() (const StringData& str) const {
+        return (size_t) hash64( str.rawData(), str.size() );
+    }
+
 }
@@ -21,6 +21,7 @@
 #include <string>
 #include <sstream>
 #include "base.h"
+#include "hash.h"
 
   namespace _bson {
 
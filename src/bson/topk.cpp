@@ -0,0 +1,153 @@
+// topk.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include "topk.h"
+
+namespace _bson {
+
+    namespace {
+
+        /** <0, 0, >0 comparing key strings */
+        inline int compareKeys(const char *a, size_t aLen, const char *b, size_t bLen) {
+            int c = memcmp( a, b, std::min( aLen, bLen ) );
+            if ( c )
+                return c;
+            return aLen < bLen ? -1 : ( aLen > bLen ? 1 : 0 );
+        }
+
+    }
+
+    topk::topk(const bsonobj& sortKey, size_t k, bool useDotted)
+        : _keys(sortKey, useDotted), _k(k), _seen(0), _scratch(256) {
+        _entries.reserve( std::min( k, (size_t) 1024 ) );
+    }
+
+    topk::topk(const sortkeymaker& keys, size_t k)
+        : _keys(keys), _k(k), _seen(0), _scratch(256) {
+        _entries.reserve( std::min( k, (size_t) 1024 ) );
+    }
+
+    /** @return true if a sorts after b -- a is the one to drop */
+    bool topk::worse(const Entry& a, const Entry& b) const {
+        int c = compareKeys( a.key.data(), a.key.size(), b.key.data(), b.key.size() );
+        return c ? c > 0 : a.seq > b.seq;
+    }
+
+    bool topk::beatsWorst(const char *key, int keyLen, unsigned long long seq) const {
+        const Entry& w = _entries[_heap[0]];
+        int c = compareKeys( key, keyLen, w.key.data(), w.key.size() );
+        return c ? c < 0 : seq < w.seq;
+    }
+
+    void topk::siftUp(size_t i) {
+        while ( i > 0 ) {
+            size_t parent = ( i - 1 ) / 2;
+            if ( !worse( _entries[_heap[i]], _entries[_heap[parent]] ) )
+                break;
+            std::swap( _heap[i], _heap[parent] );
+            i = parent;
+        }
+    }
+
+    void topk::siftDown(size_t i) {
+        size_t n = _heap.size();
+        while ( 1 ) {
+            size_t l = 2 * i + 1;
+            if ( l >= n )
+                break;
+            size_t c = l;
+            if ( l + 1 < n && worse( _entries[_heap[l + 1]], _entries[_heap[l]] ) )
+                c = l + 1;
+            if ( !worse( _entries[_heap[c]], _entries[_heap[i]] ) )
+                break;
+            std::swap( _heap[i], _heap[c] );
+            i = c;
+        }
+    }
+
+    void topk::offer(const char *key, int keyLen, const char *doc, int docLen, unsigned long long seq) {
+        if ( _k == 0 )
+            return;
+        if ( _heap.size() < _k ) {
+            Entry e;
+            e.key.assign( key, keyLen );
+            e.doc.assign( doc, docLen );
+            e.seq = seq;
+            _entries.push_back( e );
+            _heap.push_back( _entries.size() - 1 );
+            siftUp( _heap.size() - 1 );
+            return;
+        }
+        if ( !beatsWorst( key, keyLen, seq ) )
+            return;
+        // replace the worst kept, reusing its buffers
+        Entry& w = _entries[_heap[0]];
+        w.key.assign( key, keyLen );
+        w.doc.assign( doc, docLen );
+        w.seq = seq;
+        siftDown( 0 );
+    }
+
+    void topk::add(const bsonobj& doc) {
+        _scratch.reset();
+        _keys.append( doc, _scratch );
+        offer( _scratch.buf(), _scratch.len(), doc.objdata(), doc.objsize(), _seen++ );
+    }
+
+    void topk::merge(const topk& other) {
+        for( size_t i = 0; i < other._entries.size(); i++ ) {
+            const Entry& e = other._entries[i];
+            offer( e.key.data(), (int) e.key.size(), e.doc.data(), (int) e.doc.size(), _seen + e.seq );
+        }
+        _seen += other._seen;
+    }
+
+    void topk::addAll(const std::vector<bsonobj>& docs, workpool* pool) {
+        std::unique_ptr<workpool> own;
+        if ( pool == 0 ) {
+            own.reset( new workpool() );
+            pool = own.get();
+        }
+        // a topk per part, each numbering its documents from 0; merging them in order then
+        // renumbers them as if added one by one
+        size_t nParts = std::min( (size_t) pool->size(), docs.size() / 1024 + 1 );
+        size_t per = ( docs.size() + nParts - 1 ) / nParts;
+        std::vector< std::unique_ptr<topk> > parts( nParts );
+        pool->parallelFor( nParts, 1, [&](size_t p) {
+            parts[p].reset( new topk( _keys, _k ) );
+            size_t e = std::min( docs.size(), per * ( p + 1 ) );
+            for( size_t i = per * p; i < e; i++ )
+                parts[p]->add( docs[i] );
+        } );
+        for( size_t p = 0; p < nParts; p++ )
+            merge( *parts[p] );
+    }
+
+    std::vector<bsonobj> topk::sorted() const {
+        std::vector<size_t> order( _heap );
+        std::sort( order.begin(), order.end(), [this](size_t a, size_t b) {
+            return worse( _entries[b], _entries[a] );
+        } );
+        std::vector<bsonobj> v;
+        v.reserve( order.size() );
+        for( size_t i = 0; i < order.size(); i++ )
+            v.push_back( bsonobj( _entries[order[i]].doc.data() ) );
+        return v;
+    }
+
+}
@@ -0,0 +1,92 @@
+// topk.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "bsonobj.h"
+#include "keystring.h"
+#include "workpool.h"
+
+namespace _bson {
+
+    /** Keeps the first k documents of a stream in bsonobj::woSortOrder(r, sortKey, useDotted)
+        order -- "latest N", "largest N" -- in O(k) memory and O(n log k) time, instead of
+        sorting everything.
+
+        Each document's key string (see sortkeymaker) is made once and checked against the
+        worst document kept, at the top of a bounded max-heap; only documents that make the
+        cut are copied in, into the buffers of the one they replace.  Ties go to the document
+        added first, so the result is what a stable sort followed by taking k would give.
+
+        example:
+          topk latest( sortKey, 10 );   // e.g. { ts : -1 }
+          while( cursor.more() )
+              latest.add( cursor.next() );
+          std::vector<bsonobj> v = latest.sorted();
+    */
+    class topk {
+    public:
+        topk(const bsonobj& sortKey, size_t k, bool useDotted = false);
+
+        /** offers doc.  It is copied if it is kept; the caller's copy need not outlive the call. */
+        void add(const bsonobj& doc);
+
+        /** adds the documents of docs, in order, on several threads: a topk per thread, then
+            merged.  Same result as calling add() on each.
+        */
+        void addAll(const std::vector<bsonobj>& docs, workpool* pool = 0);
+
+        /** adds the documents kept by other as if they were added after everything already
+            added here.  other must have the same sort key.
+        */
+        void merge(const topk& other);
+
+        /** @return the documents kept, best first.  They belong to this topk and are valid
+            until it next changes.
+        */
+        std::vector<bsonobj> sorted() const;
+
+        size_t size() const { return _heap.size(); }
+        size_t k() const { return _k; }
+
+        /** @return number of documents added */
+        unsigned long long seen() const { return _seen; }
+
+    private:
+        struct Entry {
+            std::string key;
+            std::string doc;
+            unsigned long long seq;     // order added
+        };
+
+        topk(const sortkeymaker& keys, size_t k);
+
+        bool worse(const Entry& a, const Entry& b) const;
+        bool beatsWorst(const char *key, int keyLen, unsigned long long seq) const;
+        void offer(const char *key, int keyLen, const char *doc, int docLen, unsigned long long seq);
+        void siftDown(size_t i);
+        void siftUp(size_t i);
+
+        sortkeymaker _keys;
+        size_t _k;
+        unsigned long long _seen;
+        std::vector<Entry> _entries;
+        std::vector<size_t> _heap;  // indexes into _entries; max-heap, the worst kept on top
+        BufBuilder _scratch;
+    };
+
+}
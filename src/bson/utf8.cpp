@@ -0,0 +1,295 @@
+// utf8.cpp
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cstring>
+#include "utf8.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BSON_UTF8_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SSSE3_TARGET
+#define AVX2_TARGET
+#else
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace _bson {
+
+    bool isValidUTF8Scalar(const char *s, size_t len) {
+        const unsigned char *p = (const unsigned char *) s;
+        const unsigned char *end = p + len;
+        while( p < end ) {
+            // ASCII, the usual case, eight bytes at a time
+            while( end - p >= 8 ) {
+                unsigned long long w;
+                memcpy( &w, p, 8 );
+                if ( w & 0x8080808080808080ULL )
+                    break;
+                p += 8;
+            }
+            if ( p == end )
+                break;
+            unsigned c = *p;
+            if ( c < 0x80 ) {
+                p++;
+                continue;
+            }
+            int n;
+            unsigned cp, least;
+            if ( ( c & 0xe0 ) == 0xc0 ) {
+                n = 1; cp = c & 0x1f; least = 0x80;
+            }
+            else if ( ( c & 0xf0 ) == 0xe0 ) {
+                n = 2; cp = c & 0x0f; least = 0x800;
+            }
+            else if ( ( c & 0xf8 ) == 0xf0 ) {
+                n = 3; cp = c & 0x07; least = 0x10000;
+            }
+            else {
+                return false;
+            }
+            if ( end - p <= n )
+                return false;
+            for( int k = 1; k <= n; k++ ) {
+                if ( ( p[k] & 0xc0 ) != 0x80 )
+                    return false;
+                cp = ( cp << 6 ) | ( p[k] & 0x3f );
+            }
+            if ( cp < least || cp > 0x10ffff || ( cp >= 0xd800 && cp <= 0xdfff ) )
+                return false;
+            p += n + 1;
+        }
+        return true;
+    }
+
+#if defined(BSON_UTF8_SIMD)
+    namespace {
+
+        /* The errors a byte and the one before it can make, one bit each.  A pair is bad if
+           the bit is set in all three tables: for the high nibble of the first byte, its low
+           nibble, and the high nibble of the second.  TooLarge1000 and Overlong4 share a bit:
+           the second byte's nibble tells them apart.
+        */
+        enum {
+            TooShort = 1 << 0,      // a lead byte, or ASCII, then a continuation is missing
+            TooLong = 1 << 1,       // ASCII then a continuation
+            Overlong3 = 1 << 2,
+            TooLarge = 1 << 3,      // past U+10FFFF
+            Surrogate = 1 << 4,
+            Overlong2 = 1 << 5,
+            TooLarge1000 = 1 << 6,
+            Overlong4 = 1 << 6,
+            TwoConts = 1 << 7,      // two continuations: fine only in a 3 or 4 byte sequence
+            Carry = TooShort | TooLong | TwoConts
+        };
+
+#define BYTE_1_HIGH \
+            TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, \
+            TwoConts, TwoConts, TwoConts, TwoConts, \
+            TooShort | Overlong2, \
+            TooShort, \
+            TooShort | Overlong3 | Surrogate, \
+            TooShort | TooLarge | TooLarge1000 | Overlong4
+#define BYTE_1_LOW \
+            Carry | Overlong3 | Overlong2 | Overlong4, \
+            Carry | Overlong2, \
+            Carry, Carry, \
+            Carry | TooLarge, \
+            Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000, \
+            Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000, \
+            Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000, \
+            Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000, \
+            Carry | TooLarge | TooLarge1000 | Surrogate, \
+            Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000
+#define BYTE_2_HIGH \
+            TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, \
+            (char) ( TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge1000 | Overlong4 ), \
+            (char) ( TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge ), \
+            (char) ( TooLong | Overlong2 | TwoConts | Surrogate | TooLarge ), \
+            (char) ( TooLong | Overlong2 | TwoConts | Surrogate | TooLarge ), \
+            TooShort, TooShort, TooShort, TooShort
+// the most each of the last three bytes of a vector can be if nothing is cut off after it
+#define LAST_3_MAX (char) ( 0xf0 - 1 ), (char) ( 0xe0 - 1 ), (char) ( 0xc0 - 1 )
+
+        struct SSSE3State {
+            __m128i error, prev, prevIncomplete;
+        };
+
+        SSSE3_TARGET
+        inline void checkSSSE3(SSSE3State& s, __m128i in) {
+            if ( _mm_movemask_epi8( in ) == 0 ) {
+                // ASCII: fine, unless the vector before ended part way through a character
+                s.error = _mm_or_si128( s.error, s.prevIncomplete );
+                s.prev = in;
+                return;
+            }
+            const __m128i nibble = _mm_set1_epi8( 0x0f );
+            __m128i prev1 = _mm_alignr_epi8( in, s.prev, 15 );
+            __m128i b1High = _mm_shuffle_epi8( _mm_setr_epi8( BYTE_1_HIGH ),
+                                               _mm_and_si128( _mm_srli_epi16( prev1, 4 ), nibble ) );
+            __m128i b1Low = _mm_shuffle_epi8( _mm_setr_epi8( BYTE_1_LOW ),
+                                              _mm_and_si128( prev1, nibble ) );
+            __m128i b2High = _mm_shuffle_epi8( _mm_setr_epi8( BYTE_2_HIGH ),
+                                               _mm_and_si128( _mm_srli_epi16( in, 4 ), nibble ) );
+            __m128i special = _mm_and_si128( _mm_and_si128( b1High, b1Low ), b2High );
+
+            // a byte two after a 3 or 4 byte lead, or three after a 4 byte lead, must be a
+            // continuation: then, and only then, TwoConts is allowed
+            __m128i prev2 = _mm_alignr_epi8( in, s.prev, 14 );
+            __m128i prev3 = _mm_alignr_epi8( in, s.prev, 13 );
+            __m128i must23 = _mm_or_si128( _mm_subs_epu8( prev2, _mm_set1_epi8( 0xe0 - 0x80 ) ),
+                                           _mm_subs_epu8( prev3, _mm_set1_epi8( 0xf0 - 0x80 ) ) );
+            __m128i must23x80 = _mm_and_si128( must23, _mm_set1_epi8( (char) 0x80 ) );
+            s.error = _mm_or_si128( s.error, _mm_xor_si128( must23x80, special ) );
+
+            const __m128i max = _mm_setr_epi8( -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                               LAST_3_MAX );
+            s.prevIncomplete = _mm_subs_epu8( in, max );
+            s.prev = in;
+        }
+
+        SSSE3_TARGET
+        bool validSSSE3(const char *p, size_t len) {
+            SSSE3State s;
+            s.error = s.prev = s.prevIncomplete = _mm_setzero_si128();
+            size_t i = 0;
+            for( ; i + 16 <= len; i += 16 )
+                checkSSSE3( s, _mm_loadu_si128( (const __m128i *) ( p + i ) ) );
+            if ( i < len ) {
+                // the rest, padded with ASCII
+                char tail[16];
+                memset( tail, 0, 16 );
+                memcpy( tail, p + i, len - i );
+                checkSSSE3( s, _mm_loadu_si128( (const __m128i *) tail ) );
+            }
+            s.error = _mm_or_si128( s.error, s.prevIncomplete );
+            return _mm_movemask_epi8( _mm_cmpeq_epi8( s.error, _mm_setzero_si128() ) ) == 0xffff;
+        }
+
+        struct AVX2State {
+            __m256i error, prev, prevIncomplete;
+        };
+
+        /** the 32 bytes ending n before the end of in, the first n from prev */
+#define AVX2_PREV(in, prev, n) \
+            _mm256_alignr_epi8( in, _mm256_permute2x128_si256( prev, in, 0x21 ), 16 - (n) )
+
+        AVX2_TARGET
+        inline void checkAVX2(AVX2State& s, __m256i in) {
+            if ( _mm256_movemask_epi8( in ) == 0 ) {
+                s.error = _mm256_or_si256( s.error, s.prevIncomplete );
+                s.prev = in;
+                return;
+            }
+            const __m256i nibble = _mm256_set1_epi8( 0x0f );
+            __m256i prev1 = AVX2_PREV( in, s.prev, 1 );
+            __m256i b1High = _mm256_shuffle_epi8( _mm256_setr_epi8( BYTE_1_HIGH, BYTE_1_HIGH ),
+                                 _mm256_and_si256( _mm256_srli_epi16( prev1, 4 ), nibble ) );
+            __m256i b1Low = _mm256_shuffle_epi8(
+                                 _mm256_setr_epi8( BYTE_1_LOW, BYTE_1_LOW ),
+                                 _mm256_and_si256( prev1, nibble ) );
+            __m256i b2High = _mm256_shuffle_epi8( _mm256_setr_epi8( BYTE_2_HIGH, BYTE_2_HIGH ),
+                                 _mm256_and_si256( _mm256_srli_epi16( in, 4 ), nibble ) );
+            __m256i special = _mm256_and_si256( _mm256_and_si256( b1High, b1Low ), b2High );
+
+            __m256i prev2 = AVX2_PREV( in, s.prev, 2 );
+            __m256i prev3 = AVX2_PREV( in, s.prev, 3 );
+            __m256i must23 = _mm256_or_si256(
+                                 _mm256_subs_epu8( prev2, _mm256_set1_epi8( 0xe0 - 0x80 ) ),
+                                 _mm256_subs_epu8( prev3, _mm256_set1_epi8( 0xf0 - 0x80 ) ) );
+            __m256i must23x80 = _mm256_and_si256( must23, _mm256_set1_epi8( (char) 0x80 ) );
+            s.error = _mm256_or_si256( s.error, _mm256_xor_si256( must23x80, special ) );
+
+            const __m256i max = _mm256_setr_epi8( -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                  -1, -1, -1, -1, -1, LAST_3_MAX );
+            s.prevIncomplete = _mm256_subs_epu8( in, max );
+            s.prev = in;
+        }
+
+        AVX2_TARGET
+        bool validAVX2(const char *p, size_t len) {
+            AVX2State s;
+            s.error = s.prev = s.prevIncomplete = _mm256_setzero_si256();
+            size_t i = 0;
+            for( ; i + 32 <= len; i += 32 )
+                checkAVX2( s, _mm256_loadu_si256( (const __m256i *) ( p + i ) ) );
+            if ( i < len ) {
+                char tail[32];
+                memset( tail, 0, 32 );
+                memcpy( tail, p + i, len - i );
+                checkAVX2( s, _mm256_loadu_si256( (const __m256i *) tail ) );
+            }
+            s.error = _mm256_or_si256( s.error, s.prevIncomplete );
+            return _mm256_testz_si256( s.error, s.error ) != 0;
+        }
+
+#undef BYTE_1_HIGH
+#undef BYTE_1_LOW
+#undef BYTE_2_HIGH
+#undef LAST_3_MAX
+#undef AVX2_PREV
+
+        /** @return 2 for AVX2, 1 for SSSE3, 0 for neither */
+        int simdLevel() {
+#if defined(_MSC_VER)
+            int x[4];
+            __cpuid( x, 0 );
+            int maxLeaf = x[0];
+            __cpuid( x, 1 );
+            bool ssse3 = ( x[2] >> 9 ) & 1;
+            bool osxsave = ( x[2] >> 27 ) & 1;
+            bool avx2 = false;
+            if ( maxLeaf >= 7 && osxsave && ( _xgetbv( 0 ) & 6 ) == 6 ) {
+                __cpuidex( x, 7, 0 );
+                avx2 = ( x[1] >> 5 ) & 1;
+            }
+#else
+            __builtin_cpu_init();
+            bool ssse3 = __builtin_cpu_supports( "ssse3" );
+            bool avx2 = __builtin_cpu_supports( "avx2" );
+#endif
+            return avx2 ? 2 : ssse3 ? 1 : 0;
+        }
+
+    }
+#endif
+
+    namespace {
+        typedef bool (*UTF8Check)(const char *p, size_t len);
+
+        UTF8Check pickUTF8Check() {
+#if defined(BSON_UTF8_SIMD)
+            switch( simdLevel() ) {
+            case 2: return validAVX2;
+            case 1: return validSSSE3;
+            }
+#endif
+            return isValidUTF8Scalar;
+        }
+    }
+
+    bool isValidUTF8(const char *p, size_t len) {
+        if ( len < 16 )
+            return isValidUTF8Scalar( p, len );
+        static const UTF8Check check = pickUTF8Check();
+        return check( p, len );
+    }
+
+}
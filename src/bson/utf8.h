@@ -0,0 +1,64 @@
+// utf8.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace _bson {
+
+    /** @return true if [p, p+len) is well formed UTF-8: no overlong forms, surrogates, or
+        code points past U+10FFFF, and nothing cut short.  NUL bytes are allowed.
+
+        Input of 16 bytes or more is checked a vector at a time, with the lookup algorithm of
+        Keiser and Lemire ("Validating UTF-8 In Less Than One Instruction Per Byte"): each
+        byte's high nibble, and the nibbles of the byte before it, index three 16 entry tables
+        whose AND says which error, if any, the pair makes; a saturating subtract finds the
+        bytes that must be the third and fourth of a sequence.  AVX2 (32 bytes) or SSSE3
+        (16), whichever the CPU has, picked on first use; all-ASCII vectors are skipped
+        after one test.  Shorter input, and CPUs with neither, are checked a byte at a time.
+    */
+    bool isValidUTF8(const char *p, size_t len);
+
+    /** isValidUTF8() a byte at a time, whatever the CPU */
+    bool isValidUTF8Scalar(const char *p, size_t len);
+
+    /** writes codePoint, which must be at most 0x10ffff, to out as UTF-8.  @return the
+        number of bytes, 1 to 4
+    */
+    inline int encodeUTF8(unsigned codePoint, char out[4]) {
+        if ( codePoint < 0x80 ) {
+            out[0] = (char) codePoint;
+            return 1;
+        }
+        if ( codePoint < 0x800 ) {
+            out[0] = (char) ( 0xc0 | ( codePoint >> 6 ) );
+            out[1] = (char) ( 0x80 | ( codePoint & 0x3f ) );
+            return 2;
+        }
+        if ( codePoint < 0x10000 ) {
+            out[0] = (char) ( 0xe0 | ( codePoint >> 12 ) );
+            out[1] = (char) ( 0x80 | ( ( codePoint >> 6 ) & 0x3f ) );
+            out[2] = (char) ( 0x80 | ( codePoint & 0x3f ) );
+            return 3;
+        }
+        out[0] = (char) ( 0xf0 | ( codePoint >> 18 ) );
+        out[1] = (char) ( 0x80 | ( ( codePoint >> 12 ) & 0x3f ) );
+        out[2] = (char) ( 0x80 | ( ( codePoint >> 6 ) & 0x3f ) );
+        out[3] = (char) ( 0x80 | ( codePoint & 0x3f ) );
+        return 4;
+    }
+
+}
@@ -18,13 +18,12 @@
 #include <cmath>
 //#include <boost/lexical_cast.hpp>
 //#include <boost/static_assert.hpp>
-//#include "bson_validate.h"
+#include "bson_validate.h"
 #include "oid.h"
 //#include "optime.h"
 #include "float_utils.h"
 #include "base64.h"
 //#include "embedded_builder.h"
-//#include "md5.hpp"
 //#include "str.h"
 //#include "stringutils.h"
 #include "time_support.h"
@@ -328,15 +327,6 @@ namespace _bson {
 
     /* BSONObj ------------------------------------------------------------*/
 #if 0
-    string BSONObj::md5() const {
-        md5digest d;
-        md5_state_t st;
-        md5_init(&st);
-        md5_append( &st , (const md5_byte_t*)_objdata , objsize() );
-        md5_finish(&st, d);
-        return digestToString( d );
-    }
-
     string BSONObj::jsonString( JsonStringFormat format, int pretty ) const {
 
         if ( isEmpty() ) return "{}";
@@ -364,118 +354,13 @@ namespace _bson {
         s << " }";
         return s.str();
     }
+#endif
 
     bool bsonobj::valid() const {
         return validateBSON( objdata(), objsize() ).isOK();
     }
 
-    int BSONObj::woCompare(const BSONObj& r, const Ordering &o, bool considerFieldName) const {
-        if ( isEmpty() )
-            return r.isEmpty() ? 0 : -1;
-        if ( r.isEmpty() )
-            return 1;
-
-        BSONObjIterator i(*this);
-        BSONObjIterator j(r);
-        unsigned mask = 1;
-        while ( 1 ) {
-            // so far, equal...
-
-            bsonelement l = i.next();
-            bsonelement r = j.next();
-            if ( l.eoo() )
-                return r.eoo() ? 0 : -1;
-            if ( r.eoo() )
-                return 1;
-
-            int x;
-            {
-                x = l.woCompare( r, considerFieldName );
-                if( o.descending(mask) )
-                    x = -x;
-            }
-            if ( x != 0 )
-                return x;
-            mask <<= 1;
-        }
-        return -1;
-    }
-
-    /* well ordered compare */
-    int BSONObj::woCompare(const BSONObj &r, const BSONObj &idxKey,
-                           bool considerFieldName) const {
-        if ( isEmpty() )
-            return r.isEmpty() ? 0 : -1;
-        if ( r.isEmpty() )
-            return 1;
-
-        bool ordered = !idxKey.isEmpty();
-
-        BSONObjIterator i(*this);
-        BSONObjIterator j(r);
-        BSONObjIterator k(idxKey);
-        while ( 1 ) {
-            // so far, equal...
-
-            bsonelement l = i.next();
-            bsonelement r = j.next();
-            bsonelement o;
-            if ( ordered )
-                o = k.next();
-            if ( l.eoo() )
-                return r.eoo() ? 0 : -1;
-            if ( r.eoo() )
-                return 1;
-
-            int x;
-            /*
-                        if( ordered && o.type() == String && strcmp(o.valuestr(), "ascii-proto") == 0 &&
-                            l.type() == String && r.type() == String ) {
-                            // note: no negative support yet, as this is just sort of a POC
-                            x = _stricmp(l.valuestr(), r.valuestr());
-                        }
-                        else*/ {
-                x = l.woCompare( r, considerFieldName );
-                if ( ordered && o.number() < 0 )
-                    x = -x;
-            }
-            if ( x != 0 )
-                return x;
-        }
-        return -1;
-    }
-
-    /* well ordered compare */
-    int BSONObj::woSortOrder(const BSONObj& other, const BSONObj& sortKey , bool useDotted ) const {
-        if ( isEmpty() )
-            return other.isEmpty() ? 0 : -1;
-        if ( other.isEmpty() )
-            return 1;
-
-        uassert( 10060 ,  "woSortOrder needs a non-empty sortKey" , ! sortKey.isEmpty() );
-
-        BSONObjIterator i(sortKey);
-        while ( 1 ) {
-            bsonelement f = i.next();
-            if ( f.eoo() )
-                return 0;
-
-            bsonelement l = useDotted ? getFieldDotted( f.fieldName() ) : getField( f.fieldName() );
-            if ( l.eoo() )
-                l = staticNull.firstElement();
-            bsonelement r = useDotted ? other.getFieldDotted( f.fieldName() ) : other.getField( f.fieldName() );
-            if ( r.eoo() )
-                r = staticNull.firstElement();
-
-            int x = l.woCompare( r, false );
-            if ( f.number() < 0 )
-                x = -x;
-            if ( x != 0 )
-                return x;
-        }
-        return -1;
-    }
-
+#if 0
     bool BSONObj::isPrefixOf( const BSONObj& otherObj ) const {
         BSONObjIterator a( *this );
         BSONObjIterator b( otherObj );
@@ -0,0 +1,236 @@
+// workpool.h
+
+/*    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace _bson {
+
+    /** A fork-join thread pool with work stealing.
+
+        Each thread has its own task queue.  A thread spawning a task pushes it on its own
+        queue and takes work from the back of it (the most recently spawned, so recursion stays
+        depth first); an idle thread steals from the front of another queue (the oldest,
+        largest pieces of work).  A thread waiting on a group runs queued tasks instead of
+        blocking, so tasks may spawn and wait on groups of their own.
+
+        example:
+          workpool pool;
+          workpool::group g( pool );
+          g.spawn( [&]() { sortLeft(); } );
+          sortRight();
+          g.wait();
+
+        Link with -lpthread.
+    */
+    class workpool {
+    public:
+        /** @param threads total threads working, counting a thread that waits on a group;
+                   0 for the number of hardware threads
+        */
+        explicit workpool(int threads = 0) : _queued(0), _stop(false) {
+            if ( threads <= 0 )
+                threads = (int) std::thread::hardware_concurrency();
+            if ( threads < 1 )
+                threads = 1;
+            // queue 0 is for threads outside the pool
+            for( int i = 0; i < threads; i++ )
+                _queues.push_back( std::unique_ptr<Queue>( new Queue() ) );
+            _threads.reserve( threads );
+            for( int i = 1; i < threads; i++ )
+                _threads.push_back( std::thread( &workpool::work, this, i ) );
+        }
+
+        ~workpool() {
+            {
+                std::lock_guard<std::mutex> lk( _m );
+                _stop = true;
+            }
+            _cv.notify_all();
+            for( size_t i = 0; i < _threads.size(); i++ )
+                _threads[i].join();
+        }
+
+        /** @return number of threads that run tasks, counting one waiting caller */
+        int size() const { return (int) _queues.size(); }
+
+        /** A set of tasks to wait for.  wait() rethrows the first exception a task threw. */
+        class group {
+        public:
+            explicit group(workpool& p) : _p(p), _pending(0) { }
+            ~group() {
+                try {
+                    wait();
+                }
+                catch ( ... ) {
+                }
+            }
+
+            void spawn(const std::function<void()>& f) {
+                _pending++;
+                _p.push( f, this );
+            }
+
+            void wait() {
+                while ( _pending.load() > 0 ) {
+                    if ( !_p.runOne() )
+                        std::this_thread::yield();
+                }
+                std::lock_guard<std::mutex> lk( _errorMutex );
+                if ( _error ) {
+                    std::exception_ptr e = _error;
+                    _error = std::exception_ptr();
+                    std::rethrow_exception( e );
+                }
+            }
+
+        private:
+            friend class workpool;
+            group(const group&);
+            void operator=(const group&);
+
+            workpool& _p;
+            std::atomic<int> _pending;
+            std::mutex _errorMutex;
+            std::exception_ptr _error;
+        };
+
+        /** runs f(i) for i in [0, n), in chunks of at least 'grain', and waits */
+        template <class F>
+        void parallelFor(size_t n, size_t grain, const F& f) {
+            if ( grain < 1 )
+                grain = 1;
+            size_t chunk = n / ( size() * 4 ) + 1;
+            if ( chunk < grain )
+                chunk = grain;
+            group g( *this );
+            for( size_t b = chunk; b < n; b += chunk ) {
+                size_t e = b + chunk < n ? b + chunk : n;
+                g.spawn( [&f, b, e]() {
+                    for( size_t i = b; i < e; i++ )
+                        f( i );
+                } );
+            }
+            size_t e0 = chunk < n ? chunk : n;
+            for( size_t i = 0; i < e0; i++ )
+                f( i );
+            g.wait();
+        }
+
+    private:
+        workpool(const workpool&);
+        void operator=(const workpool&);
+
+        struct Task {
+            std::function<void()> f;
+            group *g;
+        };
+
+        struct Queue {
+            std::mutex m;
+            std::deque<Task> q;
+        };
+
+        /** @return index of the calling thread's queue */
+        int self() const {
+            std::thread::id me = std::this_thread::get_id();
+            for( size_t i = 0; i < _threads.size(); i++ ) {
+                if ( _threads[i].get_id() == me )
+                    return (int) i + 1;
+            }
+            return 0;
+        }
+
+        void push(const std::function<void()>& f, group *g) {
+            Queue& q = *_queues[self()];
+            {
+                std::lock_guard<std::mutex> lk( q.m );
+                Task t = { f, g };
+                q.q.push_back( t );
+            }
+            _queued++;
+            _cv.notify_one();
+        }
+
+        /** runs one task: from the back of our own queue, else stolen from the front of
+            another.  @return false if there was nothing to run.
+        */
+        bool runOne() {
+            if ( _queued.load() == 0 )
+                return false;
+            int me = self();
+            int n = (int) _queues.size();
+            Task t;
+            bool got = false;
+            for( int k = 0; k < n && !got; k++ ) {
+                Queue& q = *_queues[( me + k ) % n];
+                std::lock_guard<std::mutex> lk( q.m );
+                if ( q.q.empty() )
+                    continue;
+                if ( k == 0 ) {
+                    t = q.q.back();
+                    q.q.pop_back();
+                }
+                else {
+                    t = q.q.front();
+                    q.q.pop_front();
+                }
+                got = true;
+            }
+            if ( !got )
+                return false;
+            _queued--;
+            try {
+                t.f();
+            }
+            catch ( ... ) {
+                std::lock_guard<std::mutex> lk( t.g->_errorMutex );
+                if ( !t.g->_error )
+                    t.g->_error = std::current_exception();
+            }
+            t.g->_pending--;
+            return true;
+        }
+
+        void work(int) {
+            while ( 1 ) {
+                if ( runOne() )
+                    continue;
+                std::unique_lock<std::mutex> lk( _m );
+                if ( _stop )
+                    return;
+                _cv.wait_for( lk, std::chrono::milliseconds( 1 ) );
+            }
+        }
+
+        std::vector< std::unique_ptr<Queue> > _queues;
+        std::vector<std::thread> _threads;
+        std::atomic<int> _queued;
+        std::mutex _m;
+        std::condition_variable _cv;
+        bool _stop;
+    };
+
+}
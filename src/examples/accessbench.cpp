@@ -0,0 +1,108 @@
+/*
+    Benchmark of element access with and without bounds checks: iteration and getField()
+    over the same documents, through bsonobj, checkedbsonview and trustedbsonview.
+
+    g++ -O2 -std=c++0x accessbench.cpp ../bson/json.cpp ../bson/bson.cpp ../bson/time_support.cpp ../bson/parse_number.cpp ../bson/base64.cpp ../bson/utf8.cpp ../bson/bson_validate.cpp
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../bson/bsonobjbuilder.h"
+#include "../bson/bsonview.h"
+
+using namespace std;
+using namespace _bson;
+
+double secondsSince(chrono::steady_clock::time_point t) {
+    return chrono::duration<double>( chrono::steady_clock::now() - t ).count();
+}
+
+/** runs f over docs until about half a second has gone by; prints ns per document */
+template <class F>
+void throughput(const char *name, const vector<bsonobj>& docs, const F& f) {
+    long long n = 0;
+    unsigned long long sink = 0;
+    chrono::steady_clock::time_point t = chrono::steady_clock::now();
+    double secs;
+    do {
+        for( size_t i = 0; i < docs.size(); i++ )
+            sink += f( docs[i] );
+        n += docs.size();
+    } while( ( secs = secondsSince( t ) ) < 0.5 );
+    cout << "  " << name << ": " << secs / n * 1e9 << " ns/doc"
+         << ( sink == 42 ? " " : "" ) << endl;
+}
+
+/** sums the sizes of the elements, so each one is visited and sized */
+template <class Doc>
+unsigned long long iterate(const Doc& d) {
+    unsigned long long x = 0;
+    for( bsonelement e : d )
+        x += e.size();
+    return x;
+}
+
+/** looks up a field near the start, one in the middle, the last one, and one that's
+    missing -- which has to skip every element
+*/
+template <class Doc>
+unsigned long long lookups(const Doc& d) {
+    return d.getField( "a" ).size() + d.getField( "field10" ).size() +
+        d.getField( "field19" ).size() + d.getField( "zzz" ).size();
+}
+
+void go() {
+    const int nDocs = 2000;     // ~800KB, so it measures access rather than memory
+    vector<bsonobjbuilder*> builders;
+    vector<bsonobj> docs;
+    for( int i = 0; i < nDocs; i++ ) {
+        bsonobjbuilder *b = new bsonobjbuilder();
+        b->append( "a", i );
+        for( int j = 1; j < 20; j++ ) {
+            string name = "field" + bsonobjbuilder::numStr( j );
+            switch( j % 4 ) {
+            case 0: b->append( name, (double) j ); break;
+            case 1: b->append( name, "some string value" ); break;
+            case 2: b->append( name, (long long) i * j ); break;
+            default: b->append( name, bsonobjbuilder().append( "x", j ).obj() ); break;
+            }
+        }
+        builders.push_back( b );
+        docs.push_back( b->obj() );
+    }
+    cout << nDocs << " documents of " << docs[0].objsize() << " bytes, 20 fields" << endl;
+
+    cout << "iteration" << endl;
+    throughput( "bsonobj::begin()  ", docs, [](const bsonobj& o) { return iterate( o ); } );
+    throughput( "bsonobj::checked()", docs, [](const bsonobj& o) { return iterate( o.checked() ); } );
+    throughput( "checkedbsonview   ", docs, [](const bsonobj& o) { return iterate( checkedbsonview( o ) ); } );
+    throughput( "trustedbsonview   ", docs, [](const bsonobj& o) { return iterate( trustedbsonview( o ) ); } );
+
+    cout << "getField, 4 lookups" << endl;
+    throughput( "bsonobj           ", docs, [](const bsonobj& o) { return lookups( o ); } );
+    throughput( "checkedbsonview   ", docs, [](const bsonobj& o) { return lookups( checkedbsonview( o ) ); } );
+    throughput( "trustedbsonview   ", docs, [](const bsonobj& o) { return lookups( trustedbsonview( o ) ); } );
+
+    cout << "validate once, then trusted" << endl;
+    throughput( "trustedView() + iteration", docs, [](const bsonobj& o) {
+        return iterate( trustedView( o.objdata(), o.objsize() ).getValue() );
+    } );
+
+    for( size_t i = 0; i < builders.size(); i++ )
+        delete builders[i];
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        go();
+    }
+    catch (std::exception& e) {
+        cerr << "exception ";
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -1,5 +1,5 @@
 /* 
-    g++ example1.cpp ../bson/json.cpp ../bson/bson.cpp ../bson/time_support.cpp ../bson/parse_number.cpp  ../bson/base64.cpp 
+    g++ example1.cpp ../bson/json.cpp ../bson/bson.cpp ../bson/time_support.cpp ../bson/parse_number.cpp  ../bson/base64.cpp ../bson/utf8.cpp
 
     vstudio: see build/examples/examples.sln
  */
@@ -0,0 +1,126 @@
+/*
+    Throughput and collision benchmark for bsonobj::hash64() against the byte at a time
+    hash bsonobj::hash() used to be, and the throughput of bsonobj::valueHash().
+
+    g++ -O2 -std=c++0x hashbench.cpp ../bson/json.cpp ../bson/bson.cpp ../bson/time_support.cpp ../bson/parse_number.cpp ../bson/base64.cpp ../bson/utf8.cpp
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../bson/bsonobjbuilder.h"
+
+using namespace std;
+using namespace _bson;
+
+/** what bsonobj::hash() did before hash64() */
+unsigned oldHash(const bsonobj& o) {
+    unsigned x = 0;
+    const char *p = o.objdata();
+    for ( int i = 0; i < o.objsize(); i++ )
+        x = x * 131 + p[i];
+    return (x & 0x7fffffff) | 0x8000000;
+}
+
+double secondsSince(chrono::steady_clock::time_point t) {
+    return chrono::duration<double>( chrono::steady_clock::now() - t ).count();
+}
+
+/** hashes docs with f until about half a second has gone by; prints MB/s */
+template <class F>
+void throughput(const char *name, const vector<bsonobj>& docs, const F& f) {
+    long long bytes = 0;
+    unsigned long long sink = 0;
+    int passes = 0;
+    chrono::steady_clock::time_point t = chrono::steady_clock::now();
+    double secs;
+    do {
+        for( size_t i = 0; i < docs.size(); i++ ) {
+            sink += f( docs[i] );
+            bytes += docs[i].objsize();
+        }
+        passes++;
+    } while( ( secs = secondsSince( t ) ) < 0.5 );
+    cout << "  " << name << ": " << (long long) ( bytes / secs / 1e6 ) << " MB/s"
+         << ( sink == 42 ? " " : "" ) << endl;
+}
+
+/** @return the number of hashes that equal the one before them once sorted */
+template <class T>
+size_t collisions(vector<T>& h) {
+    sort( h.begin(), h.end() );
+    size_t n = 0;
+    for( size_t i = 1; i < h.size(); i++ )
+        if ( h[i] == h[i - 1] )
+            n++;
+    return n;
+}
+
+void go() {
+    // throughput, for small to large documents
+    int sizes[] = { 16, 64, 256, 4096, 65536, 1024 * 1024 };
+    for( int s = 0; s < 6; s++ ) {
+        int strLen = sizes[s];
+        int nDocs = max( 1, 16 * 1024 * 1024 / ( strLen + 32 ) );
+        vector<bsonobjbuilder*> builders;
+        vector<bsonobj> docs;
+        for( int i = 0; i < nDocs; i++ ) {
+            bsonobjbuilder *b = new bsonobjbuilder( strLen + 64 );
+            b->append( "_id", i );
+            b->append( "s", string( strLen, (char) ( 'a' + i % 26 ) ) );
+            builders.push_back( b );
+            docs.push_back( b->obj() );
+        }
+        cout << nDocs << " documents of " << docs[0].objsize() << " bytes" << endl;
+        throughput( "hash (old)", docs, [](const bsonobj& o) { return (unsigned long long) oldHash( o ); } );
+        throughput( "hash64    ", docs, [](const bsonobj& o) { return o.hash64(); } );
+        throughput( "valueHash ", docs, [](const bsonobj& o) { return o.valueHash(); } );
+        for( size_t i = 0; i < builders.size(); i++ )
+            delete builders[i];
+    }
+
+    // collisions, on a million documents that differ in a field or two.  hash() has 30 bits
+    // that vary (one is forced on): a perfect hash of that width gives about N*N/2^31
+    // collisions, ~465 for a million.
+    const int N = 1000 * 1000;
+    for( int grid = 0; grid < 2; grid++ ) {
+        vector<unsigned> oldHashes, hashes;
+        vector<unsigned long long> hashes64;
+        for( int i = 0; i < N; i++ ) {
+            bsonobjbuilder b;
+            if ( grid ) {
+                b.append( "x", i % 1000 );
+                b.append( "y", i / 1000 );
+            }
+            else {
+                b.append( "_id", i );
+                b.append( "name", "user" + bsonobjbuilder::numStr( i % 100 ) );
+                b.append( "score", (double) ( i / 100 ) );
+            }
+            bsonobj o = b.done();
+            oldHashes.push_back( oldHash( o ) );
+            hashes.push_back( (unsigned) o.hash() );
+            hashes64.push_back( o.hash64() );
+        }
+        cout << N << ( grid ? " { x : i, y : j } documents" : " similar documents" )
+             << "; collisions:" << endl;
+        cout << "  hash (old): " << collisions( oldHashes ) << endl;
+        cout << "  hash      : " << collisions( hashes ) << endl;
+        cout << "  hash64    : " << collisions( hashes64 ) << endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    try {
+        go();
+    }
+    catch (std::exception& e) {
+        cerr << "exception ";
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+    Regression checks for internstore: compact() and expand() round trip, and expand() of
+    objects that refer to themselves or to each other -- references in intern()'s input are
+    stored as they are -- throws instead of recursing until the stack runs out.  Exits
+    non-zero on a failure.
+
+    g++ -O2 -std=c++0x internstorecheck.cpp ../bson/internstore.cpp ../bson/json.cpp ../bson/bson.cpp ../bson/time_support.cpp ../bson/parse_number.cpp ../bson/base64.cpp ../bson/utf8.cpp -lpthread
+ */
+
+#include <iostream>
+#include <string>
+#include "../bson/bsonobjbuilder.h"
+#include "../bson/internstore.h"
+
+using namespace std;
+using namespace _bson;
+
+/** { r : <reference to h>, pad : pad } */
+bsonobj refObject(const internstore& store, internstore::handle h, int pad, bsonobjbuilder& b) {
+    store.appendRef( b, "r", h );
+    b.append( "pad", pad );
+    return b.obj();
+}
+
+/** the shard intern() puts o in.  In a new store an object is the first of its shard, so
+    its handle is the shard number.
+*/
+unsigned shardOf(const bsonobj& o) { return (unsigned) ( o.hash64() >> 60 ); }
+
+/** @return a pad for which refObject( h, pad ) lands in shard */
+int padFor(const internstore& store, internstore::handle h, unsigned shard) {
+    for( int pad = 0; ; pad++ ) {
+        bsonobjbuilder b;
+        if ( shardOf( refObject( store, h, pad, b ) ) == shard )
+            return pad;
+    }
+}
+
+/** expand() of a document referring to h must throw, not crash */
+bool expandThrows(const char *what, internstore& store, internstore::handle h) {
+    bsonobjbuilder d;
+    store.appendRef( d, "x", h );
+    bsonobj doc = d.obj();
+    try {
+        bsonobjbuilder e;
+        store.expand( doc, e );
+    }
+    catch( MsgAssertionException& ) {
+        return true;
+    }
+    cout << what << ": expand() didn't throw" << endl;
+    return false;
+}
+
+bool roundTrip() {
+    internstore store;
+    bsonobjbuilder sub;
+    for( int i = 0; i < 20; i++ )
+        sub.append( "field" + bsonobjbuilder::numStr( i ), i );
+    bsonobj big = sub.obj();
+    for( int n = 0; n < 3; n++ ) {
+        bsonobjbuilder b;
+        b.append( "n", n );
+        b.append( "desc", big );
+        bsonobjbuilder arr;
+        for( int i = 0; i < 10; i++ )
+            arr.append( bsonobjbuilder::numStr( i ), big );
+        b.appendArray( "list", arr.obj() );
+        bsonobj doc = b.obj();
+        bsonobjbuilder c, e;
+        bsonobj small = store.compact( doc, c );
+        if ( !store.expand( small, e ).binaryEqual( doc ) || small.objsize() >= doc.objsize() ) {
+            cout << "compact() and expand() of " << doc.toString() << " didn't round trip" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool selfReference() {
+    internstore store;
+    for( internstore::handle h = 0; h < 16; h++ ) {
+        int pad = padFor( store, h, h );
+        bsonobjbuilder b;
+        if ( store.intern( refObject( store, h, pad, b ) ) != h ) {
+            cout << "self reference: not the handle expected" << endl;
+            return false;
+        }
+        if ( !expandThrows( "self reference", store, h ) )
+            return false;
+    }
+    return true;
+}
+
+bool cycle() {
+    // a refers to b and b to a, each the first of its shard
+    internstore store;
+    internstore::handle a = 3, b = 11;
+    bsonobjbuilder x, y;
+    bsonobj ao = refObject( store, b, padFor( store, b, a ), x );
+    bsonobj bo = refObject( store, a, padFor( store, a, b ), y );
+    if ( store.intern( ao ) != a || store.intern( bo ) != b ) {
+        cout << "cycle: not the handles expected" << endl;
+        return false;
+    }
+    return expandThrows( "cycle of two", store, a ) && expandThrows( "cycle of two", store, b );
+}
+
+bool deepChain() {
+    // a chain of references 50 deep is fine
+    internstore store;
+    bsonobjbuilder leaf;
+    leaf.append( "leaf", 1 );
+    internstore::handle h = store.intern( leaf.obj() );
+    for( int i = 0; i < 50; i++ ) {
+        bsonobjbuilder b;
+        h = store.intern( refObject( store, h, i, b ) );
+    }
+    bsonobjbuilder d, e;
+    store.appendRef( d, "x", h );
+    try {
+        store.expand( d.obj(), e );
+    }
+    catch( MsgAssertionException& ex ) {
+        cout << "chain of 50 references: " << ex.what() << endl;
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    if ( !roundTrip() || !selfReference() || !cycle() || !deepChain() )
+        return 1;
+    cout << "internstorecheck ok" << endl;
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+    Checks the invariant of appendKeyString(): for random keys of mixed types and random
+    orderings, the memcmp order of two key strings is the order bsonobj::woCompare() gives
+    the keys, and keyStringToBSON() gives each key back.  Exits non-zero on a mismatch.
+
+    g++ -O2 -std=c++0x keystringcheck.cpp ../bson/keystring.cpp ../bson/json.cpp ../bson/bson.cpp ../bson/time_support.cpp ../bson/parse_number.cpp ../bson/base64.cpp ../bson/utf8.cpp
+ */
+
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../bson/bsonobjbuilder.h"
+#include "../bson/keystring.h"
+#include "../bson/ordering.h"
+
+using namespace std;
+using namespace _bson;
+
+mt19937_64 rng( 12345 );
+
+unsigned pick(unsigned n) { return (unsigned) ( rng() % n ); }
+
+/** a 64 bit value near one of the edges signed and unsigned comparisons disagree on */
+unsigned long long edgeValue() {
+    unsigned long long edges[] = { 0, 1, 1000, 0x7fffffffffffffffULL, 0x8000000000000000ULL,
+                                   0xffffffffffffffffULL, 0xfffffffffffffc18ULL };
+    unsigned long long x = edges[pick( 7 )];
+    return pick( 2 ) ? x : x + pick( 3 ) - 1;
+}
+
+void appendValue(bsonobjbuilder& b, const string& name, int depth) {
+    switch( pick( depth < 2 ? 16 : 14 ) ) {
+    case 0: b.appendMinKey( name ); break;
+    case 1: b.appendMaxKey( name ); break;
+    case 2: b.appendNull( name ); break;
+    case 3: b.append( name, (int) pick( 7 ) - 3 ); break;
+    case 4: b.append( name, (long long) pick( 7 ) - 3 ); break;
+    case 5: b.append( name, ( (double) pick( 13 ) - 6 ) / 2 ); break;
+    case 6: b.append( name, string( "abc", pick( 4 ) ) + string( pick( 2 ), 'b' ) ); break;
+    case 7: b.appendSymbol( name, string( "ab", pick( 3 ) ) ); break;
+    case 8: b.append( name, pick( 2 ) == 1 ); break;
+    case 9: b.appendDate( name, Date_t( edgeValue() ) ); break;
+    case 10: b.appendTimestamp( name, edgeValue() ); break;
+    case 11: {
+        unsigned char id[12] = { 0 };
+        id[11] = (unsigned char) pick( 3 );
+        id[0] = (unsigned char) ( pick( 2 ) * 0xff );
+        b.append( name, OID( id ) );
+        break;
+    }
+    case 12: {
+        char data[3] = { 'x', (char) pick( 256 ), 'y' };
+        b.appendBinData( name, (int) pick( 4 ), BinDataGeneral, data );
+        break;
+    }
+    case 13: b.appendRegex( name, string( "ab", pick( 3 ) ), pick( 2 ) ? "i" : "" ); break;
+    case 14: {
+        bsonobjbuilder sub;
+        int n = (int) pick( 3 );
+        for( int i = 0; i < n; i++ )
+            appendValue( sub, string( 1, (char) ( 'a' + pick( 2 ) ) ), depth + 1 );
+        b.append( name, sub.obj() );
+        break;
+    }
+    default: {
+        bsonobjbuilder sub;
+        int n = (int) pick( 3 );
+        for( int i = 0; i < n; i++ )
+            appendValue( sub, bsonobjbuilder::numStr( i ), depth + 1 );
+        b.appendArray( name, sub.obj() );
+        break;
+    }
+    }
+}
+
+int sign(int x) { return x < 0 ? -1 : x > 0 ? 1 : 0; }
+
+int main() {
+    const int nFields = 2;
+    long long pairs = 0, skipped = 0;
+    for( int round = 0; round < 200; round++ ) {
+        bsonobjbuilder ob;
+        for( int f = 0; f < nFields; f++ )
+            ob.append( bsonobjbuilder::numStr( f ), pick( 2 ) ? 1 : -1 );
+        bsonobj order = ob.obj();
+        Ordering o = Ordering::make( order );
+
+        vector<string> keys, ks;
+        for( int i = 0; i < 60; i++ ) {
+            bsonobjbuilder kb;
+            for( int f = 0; f < nFields; f++ )
+                appendValue( kb, "", 0 );
+            bsonobj k = kb.obj();
+            keys.push_back( string( k.objdata(), k.objsize() ) );
+            string typeBits;
+            ks.push_back( toKeyString( k, o, &typeBits ) );
+
+            bsonobjbuilder back;
+            keyStringToBSON( ks.back(), o, back, typeBits );
+            if ( back.obj().woCompare( k, order, false ) != 0 ||
+                 back.obj().toString() != k.toString() ) {
+                cout << "round trip mismatch: " << k.toString() << " came back as "
+                     << back.obj().toString() << endl;
+                return 1;
+            }
+        }
+
+        for( size_t i = 0; i < keys.size(); i++ ) {
+            for( size_t j = 0; j < keys.size(); j++ ) {
+                bsonobj a( keys[i].data() ), b( keys[j].data() );
+                // woCompare() can't compare a Date with a Timestamp: with the Date on the
+                // left it throws, with the Timestamp it compares unsigned, so there's no
+                // order to match
+                int w, wr;
+                try {
+                    w = sign( a.woCompare( b, o, false ) );
+                    wr = sign( b.woCompare( a, o, false ) );
+                }
+                catch( MsgAssertionException& ) {
+                    skipped++;
+                    continue;
+                }
+                if ( w != -wr ) {
+                    skipped++;
+                    continue;
+                }
+                size_t n = min( ks[i].size(), ks[j].size() );
+                int m = memcmp( ks[i].data(), ks[j].data(), n );
+                if ( m == 0 )
+                    m = ks[i].size() < ks[j].size() ? -1 : ks[i].size() > ks[j].size() ? 1 : 0;
+                if ( sign( m ) != w ) {
+                    cout << "order mismatch, " << order.toString() << ": " << a.toString()
+                         << " vs " << b.toString() << ": woCompare " << w << ", key strings "
+                         << sign( m ) << endl;
+                    return 1;
+                }
+                pairs++;
+            }
+        }
+    }
+    cout << "keystringcheck ok: " << pairs << " pairs (" << skipped
+         << " Date/Timestamp pairs woCompare doesn't order)" << endl;
+    return 0;
+}
@@ -0,0 +1,408 @@
+/*
+    Regression checks for input validation: a corpus of known bad documents -- truncated,
+    bad sizes, too deeply nested, bad types, overlong and surrogate UTF-8 -- each of which
+    validateBSON() has to reject from the right level on; isValidUTF8() against
+    isValidUTF8Scalar() on random and exhaustive input, so the vector paths agree with the
+    byte at a time one; and validateBatch() against validateBSON() document by document,
+    on one thread and several.  Exits non-zero on the first disagreement.
+
+    g++ -O2 -std=c++0x validatecheck.cpp ../bson/bson_validate.cpp ../bson/batchvalidate.cpp ../bson/json.cpp ../bson/bson.cpp ../bson/time_support.cpp ../bson/parse_number.cpp ../bson/base64.cpp ../bson/utf8.cpp -lpthread
+ */
+
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../bson/bsonobjbuilder.h"
+#include "../bson/batchvalidate.h"
+#include "../bson/json.h"
+
+using namespace std;
+using namespace _bson;
+
+mt19937_64 rng( 12345 );
+
+unsigned pick(unsigned n) { return (unsigned) ( rng() % n ); }
+
+const int Passes = ValidateFull + 1;    // a corpus entry no level rejects
+
+const char *levelName(int level) {
+    return level == ValidateStructure ? "ValidateStructure" :
+           level == ValidateTypes ? "ValidateTypes" : "ValidateFull";
+}
+
+// little endian, as BSON is
+string int32(int x) {
+    string s( 4, '\0' );
+    for( int i = 0; i < 4; i++ )
+        s[i] = (char) ( (unsigned) x >> ( 8 * i ) );
+    return s;
+}
+
+string elem(BSONType t, const string& name, const string& value) {
+    return string( 1, (char) t ) + name + '\0' + value;
+}
+
+string str(const string& s) { return int32( (int) s.size() + 1 ) + s + '\0'; }
+
+string doc(const string& elements) { return int32( (int) elements.size() + 5 ) + elements + '\0'; }
+
+string nested(int depth, BSONType t) {
+    string d = doc( "" );
+    for( int i = 0; i < depth; i++ )
+        d = doc( elem( t, t == Array ? "0" : "x", d ) );
+    return d;
+}
+
+int corpusSize = 0;
+
+/** validateBSON() of data, at most len bytes of it, has to pass below level firstBad and
+    fail from there on, with an error offset inside the data
+*/
+bool expect(const char *what, const string& data, size_t len, int firstBad) {
+    for( int level = ValidateStructure; level <= ValidateFull; level++ ) {
+        size_t at = (size_t) -1;
+        Status s = validateBSON( data.data(), len, (BSONValidateLevel) level, &at );
+        if ( s.isOK() != ( level < firstBad ) ) {
+            cout << "corpus: " << what << ": " << ( s.isOK() ? "passed" : "failed" ) << " at "
+                 << levelName( level ) << ( s.isOK() ? "" : ": " + s.toString() ) << endl;
+            return false;
+        }
+        if ( !s.isOK() && at > len ) {
+            cout << "corpus: " << what << ": error offset " << at << " past the end" << endl;
+            return false;
+        }
+    }
+    corpusSize++;
+    return true;
+}
+
+bool expect(const char *what, const string& data, int firstBad) {
+    return expect( what, data, data.size(), firstBad );
+}
+
+/** one document for each way a sequence can be bad, wherever it is in the document */
+bool badUTF8(const char *what, const string& bad) {
+    string pad( 40, 'a' );  // so the sequence is seen by the vector paths too
+    return expect( what, doc( elem( String, "s", str( bad ) ) ), ValidateFull ) &&
+           expect( what, doc( elem( String, "s", str( pad + bad + pad ) ) ), ValidateFull ) &&
+           expect( what, doc( elem( NumberInt, bad, int32( 1 ) ) ), ValidateFull ) &&
+           expect( what, doc( elem( Symbol, "s", str( pad + bad ) ) ), ValidateFull ) &&
+           expect( what, doc( elem( RegEx, "r", bad + '\0' + '\0' ) ), ValidateFull );
+}
+
+bool badJSON(const char *what, const string& json) {
+    istringstream in( json );
+    bsonobjbuilder b;
+    if ( tryFromjson( in, b ).isOK() ) {
+        cout << "corpus: " << what << ": tryFromjson() took " << json << endl;
+        return false;
+    }
+    corpusSize++;
+    return true;
+}
+
+bool corpus() {
+    string good = doc( elem( String, "s", str( "abc\xe2\x82\xac" ) ) +
+                       elem( NumberInt, "i", int32( 7 ) ) +
+                       elem( Object, "o", doc( elem( Bool, "b", "\x01" ) ) ) +
+                       elem( Array, "a", doc( elem( NumberInt, "0", int32( 1 ) ) +
+                                              elem( NumberInt, "1", int32( 2 ) ) ) ) );
+    if ( !expect( "good document", good, Passes ) )
+        return false;
+
+    // truncation
+    for( size_t len = 0; len < good.size(); len++ ) {
+        if ( !expect( "truncated", good, len, ValidateStructure ) ||
+             !expect( "truncated copy", good.substr( 0, len ), ValidateStructure ) )
+            return false;
+    }
+
+    // sizes
+    string s = good;
+    s.replace( 0, 4, int32( (int) good.size() + 1 ) );
+    if ( !expect( "size past the end", s, ValidateStructure ) )
+        return false;
+    s.replace( 0, 4, int32( (int) good.size() - 1 ) );
+    if ( !expect( "size short of the EOO", s, ValidateStructure ) )
+        return false;
+    int small[] = { 4, 0, -1, -5 };
+    for( int i = 0; i < 4; i++ ) {
+        s.replace( 0, 4, int32( small[i] ) );
+        if ( !expect( "size too small", s, ValidateStructure ) )
+            return false;
+    }
+    s = good;
+    s[s.size() - 1] = 1;
+    if ( !expect( "no EOO", s, ValidateStructure ) )
+        return false;
+    int strSizes[] = { 0, -1, 5, 1000, 0x7fffffff };    // "abc" is 3, and 4 with the 0
+    for( int i = 0; i < 5; i++ ) {
+        if ( !expect( "bad string size", doc( elem( String, "s", int32( strSizes[i] ) + "abc" + '\0' ) ),
+                      ValidateStructure ) )
+            return false;
+    }
+    if ( !expect( "string not terminated", doc( elem( String, "s", int32( 4 ) + "abcd" ) ),
+                  ValidateStructure ) ||
+         !expect( "field name not terminated", int32( 8 ) + (char) NumberInt + "abc",
+                  ValidateStructure ) ||
+         !expect( "embedded size past its parent",
+                  doc( elem( Object, "o", int32( 6 ) + '\0' ) ), ValidateStructure ) ||
+         !expect( "embedded size too small",
+                  doc( elem( Object, "o", int32( 4 ) + '\0' ) ), ValidateStructure ) ||
+         !expect( "value past the end", doc( elem( NumberDouble, "d", "1234" ) ),
+                  ValidateStructure ) ||
+         !expect( "unknown type", doc( elem( (BSONType) 0x20, "x", int32( 1 ) ) ),
+                  ValidateStructure ) )
+        return false;
+
+    // nesting
+    if ( !expect( "nested to the limit", nested( BSONValidateMaxDepth, Object ), Passes ) ||
+         !expect( "nested too deep", nested( BSONValidateMaxDepth + 1, Object ), ValidateStructure ) ||
+         !expect( "arrays to the limit", nested( BSONValidateMaxDepth, Array ), Passes ) ||
+         !expect( "arrays nested too deep", nested( BSONValidateMaxDepth + 1, Array ),
+                  ValidateStructure ) )
+        return false;
+
+    // the rules of each type
+    if ( !expect( "bool of 2", doc( elem( Bool, "b", "\x02" ) ), ValidateTypes ) ||
+         !expect( "array keys out of order",
+                  doc( elem( Array, "a", doc( elem( NumberInt, "1", int32( 1 ) ) +
+                                              elem( NumberInt, "0", int32( 2 ) ) ) ) ),
+                  ValidateTypes ) ||
+         !expect( "array key 00",
+                  doc( elem( Array, "a", doc( elem( NumberInt, "00", int32( 1 ) ) ) ) ),
+                  ValidateTypes ) ||
+         !expect( "UUID of 15 bytes",
+                  doc( elem( BinData, "u", int32( 15 ) + (char) newUUID + string( 15, 'x' ) ) ),
+                  ValidateTypes ) ||
+         !expect( "regex option q", doc( elem( RegEx, "r", string( "ab\0q\0", 5 ) ) ),
+                  ValidateTypes ) )
+        return false;
+
+    // UTF-8
+    const char *bad[] = {
+        "\xc0\xaf", "\xc1\xbf", "\xe0\x80\xaf", "\xe0\x9f\xbf", "\xf0\x80\x80\xaf",  // overlong
+        "\xf0\x8f\xbf\xbf",
+        "\xed\xa0\x80", "\xed\xaf\xbf", "\xed\xb0\x80", "\xed\xbf\xbf",         // surrogates
+        "\xed\xa0\xbd\xed\xb8\x80",                                             // CESU-8 pair
+        "\xf4\x90\x80\x80", "\xf5\x80\x80\x80", "\xf8\x88\x80\x80\x80",         // past U+10FFFF
+        "\xe2\x82", "\xf0\x9f\x98", "\xc3",                                     // cut short
+        "\x80", "\xbf\xbf", "\xc3\xa9\xa9", "\xfe", "\xff"                      // stray bytes
+    };
+    for( size_t i = 0; i < sizeof( bad ) / sizeof( bad[0] ); i++ ) {
+        if ( !badUTF8( "bad UTF-8", bad[i] ) )
+            return false;
+    }
+    const char *fine[] = { "\x7f", "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80", "\xed\x9f\xbf",
+                           "\xee\x80\x80", "\xef\xbf\xbf", "\xf0\x90\x80\x80",
+                           "\xf4\x8f\xbf\xbf" };
+    for( size_t i = 0; i < sizeof( fine ) / sizeof( fine[0] ); i++ ) {
+        if ( !expect( "good UTF-8", doc( elem( String, "s", str( string( 40, 'a' ) + fine[i] ) ) ),
+                      Passes ) )
+            return false;
+    }
+
+    // JSON
+    if ( !badJSON( "lone high surrogate", "{ s : \"\\ud800\" }" ) ||
+         !badJSON( "high surrogate, then not a low one", "{ s : \"\\ud83d\\u0041\" }" ) ||
+         !badJSON( "lone low surrogate", "{ s : \"\\ude00\" }" ) ||
+         !badJSON( "overlong UTF-8", "{ s : \"\xc0\xaf\" }" ) ||
+         !badJSON( "UTF-8 surrogate", "{ s : \"abc\xed\xa0\x80\" }" ) )
+        return false;
+    istringstream in( "{ s : \"\\ud83d\\ude00\" }" );
+    bsonobjbuilder b;
+    StatusWith<bsonobj> pair = tryFromjson( in, b );
+    if ( !pair.isOK() || pair.getValue()["s"].str() != "\xf0\x9f\x98\x80" ) {
+        cout << "corpus: surrogate pair in JSON not U+1F600" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool agree(const string& s, size_t start, size_t len) {
+    const char *p = s.data() + start;
+    bool v = isValidUTF8( p, len ), scalar = isValidUTF8Scalar( p, len );
+    if ( v != scalar ) {
+        cout << "isValidUTF8() " << v << ", isValidUTF8Scalar() " << scalar << " for";
+        for( size_t i = 0; i < len; i++ )
+            cout << ' ' << hex << ( (unsigned) p[i] & 0xff ) << dec;
+        cout << endl;
+    }
+    return v == scalar;
+}
+
+/** random text, mostly valid, cut or corrupted now and then, at all alignments */
+bool randomUTF8(long long& n) {
+    const char *bad[] = { "\xc0\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xe2\x82", "\x80",
+                          "\xff" };
+    for( int round = 0; round < 200000; round++ ) {
+        string s( pick( 32 ), 'x' );
+        size_t start = s.size();
+        int pieces = (int) pick( 40 );
+        for( int i = 0; i < pieces; i++ ) {
+            switch( pick( 4 ) ) {
+            case 0:
+                s.append( pick( 40 ), (char) ( 'a' + pick( 26 ) ) );
+                break;
+            default: {
+                unsigned top[] = { 0x80, 0x800, 0x10000, 0x110000 };
+                unsigned cp = pick( top[pick( 4 )] );
+                if ( cp >= 0xd800 && cp <= 0xdfff )
+                    cp = 0xfffd;
+                char out[4];
+                s.append( out, encodeUTF8( cp, out ) );
+                break;
+            }
+            }
+        }
+        switch( pick( 8 ) ) {
+        case 0:
+            if ( s.size() > start )
+                s[start + pick( (unsigned) ( s.size() - start ) )] = (char) pick( 256 );
+            break;
+        case 1:
+            if ( s.size() > start )
+                s.erase( start + pick( (unsigned) ( s.size() - start ) ), 1 );
+            break;
+        case 2:
+            s.insert( start + pick( (unsigned) ( s.size() - start + 1 ) ), bad[pick( 6 )] );
+            break;
+        default:
+            break;
+        }
+        if ( !agree( s, start, s.size() - start ) ||
+             !agree( s, start, pick( (unsigned) ( s.size() - start + 1 ) ) ) )
+            return false;
+        n += 2;
+    }
+    return true;
+}
+
+/** every two and three byte sequence starting with a non-ASCII byte, across the 16 and 32
+    byte boundaries the vector paths work in
+*/
+bool exhaustiveUTF8(long long& n) {
+    string s( 64, 'a' );
+    size_t positions[] = { 0, 14, 15, 30, 31, 61 };
+    for( size_t k = 0; k < 6; k++ ) {
+        size_t at = positions[k];
+        for( unsigned a = 0x80; a < 0x100; a++ ) {
+            for( unsigned b = 0; b < 0x100; b++ ) {
+                s[at] = (char) a;
+                s[at + 1] = (char) b;
+                s[at + 2] = 'a';
+                if ( !agree( s, 0, s.size() ) )
+                    return false;
+                n++;
+                if ( at + 2 >= s.size() - 1 )
+                    continue;
+                for( unsigned c = 0x80; c < 0xc0; c++ ) {
+                    s[at + 2] = (char) c;
+                    if ( !agree( s, 0, s.size() ) )
+                        return false;
+                    n++;
+                }
+            }
+        }
+        s[at] = s[at + 1] = s[at + 2] = 'a';
+    }
+    return true;
+}
+
+/** document by document, what validateBatch() should find */
+void reference(const string& seq, vector<size_t>& docs, vector<batchvalidation::Failure>& bad) {
+    size_t pos = 0;
+    while( pos < seq.size() ) {
+        docs.push_back( pos );
+        size_t left = seq.size() - pos;
+        if ( left < 5 )
+            break;
+        int n = readInt( seq.data() + pos );
+        if ( n < 5 || (size_t) n > left )
+            break;
+        pos += n;
+    }
+    for( size_t i = 0; i < docs.size(); i++ ) {
+        size_t end = i + 1 < docs.size() ? docs[i + 1] : seq.size();
+        size_t at;
+        if ( !validateBSON( seq.data() + docs[i], end - docs[i], ValidateFull, &at ).isOK() ) {
+            batchvalidation::Failure f = { i, docs[i] + at };
+            bad.push_back( f );
+        }
+    }
+}
+
+bool sameAsReference(const string& seq, workpool *pool) {
+    vector<size_t> docs;
+    vector<batchvalidation::Failure> bad;
+    reference( seq, docs, bad );
+    batchvalidation v = validateBatch( seq.data(), seq.size(), ValidateFull, pool );
+    bool same = v.docs == docs && v.failures.size() == bad.size();
+    for( size_t k = 0; same && k < bad.size(); k++ )
+        same = v.failures[k].doc == bad[k].doc && v.failures[k].offset == bad[k].offset;
+    size_t nBad = 0;
+    for( size_t i = 0; same && i < v.size(); i++ ) {
+        if ( !v.passed( i ) )
+            same = nBad < bad.size() && bad[nBad++].doc == i;
+    }
+    same = same && nBad == bad.size() && v.allPassed() == bad.empty();
+    if ( !same ) {
+        cout << "validateBatch() of " << seq.size() << " bytes, " << docs.size() << " documents, "
+             << ( pool ? "on a pool" : "no pool" ) << ": found " << v.failures.size()
+             << " bad, validateBSON() " << bad.size() << endl;
+    }
+    return same;
+}
+
+string randomSequence(int nDocs, int corruptions) {
+    string seq;
+    for( int i = 0; i < nDocs; i++ ) {
+        bsonobjbuilder b;
+        b.append( "_id", i );
+        int n = (int) pick( 8 );
+        for( int j = 0; j < n; j++ ) {
+            string name = "f" + bsonobjbuilder::numStr( j );
+            if ( pick( 2 ) )
+                b.append( name, (int) rng() );
+            else
+                b.append( name, string( pick( 40 ), (char) ( 'a' + j ) ) );
+        }
+        bsonobj o = b.obj();
+        seq.append( o.objdata(), o.objsize() );
+    }
+    for( int c = 0; c < corruptions && !seq.empty(); c++ )
+        seq[pick( (unsigned) seq.size() )] = (char) rng();
+    return seq;
+}
+
+bool batch(long long& n) {
+    workpool pool( 4 );
+    for( int round = 0; round < 300; round++ ) {
+        string seq = randomSequence( (int) pick( 400 ), (int) pick( 6 ) );
+        if ( pick( 5 ) == 0 && !seq.empty() )
+            seq.resize( pick( (unsigned) seq.size() ) );
+        if ( !sameAsReference( seq, 0 ) || !sameAsReference( seq, &pool ) )
+            return false;
+        n++;
+    }
+    // past the size validateBatch() splits without a pool
+    string big = randomSequence( 40000, 20 );
+    if ( !sameAsReference( big, 0 ) || !sameAsReference( big, &pool ) )
+        return false;
+    n++;
+    return true;
+}
+
+int main() {
+    if ( !corpus() )
+        return 1;
+    long long random = 0, exhaustive = 0, batches = 0;
+    if ( !randomUTF8( random ) || !exhaustiveUTF8( exhaustive ) || !batch( batches ) )
+        return 1;
+    cout << "validatecheck ok: " << corpusSize << " bad or edge cases, " << random << " random and "
+         << exhaustive << " exhaustive UTF-8 strings, " << batches << " batches" << endl;
+    return 0;
+}